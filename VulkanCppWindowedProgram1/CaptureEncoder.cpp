@@ -0,0 +1,316 @@
+#include "CaptureEncoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	bool endsWith(const std::string& text, const char* suffix)
+	{
+		size_t length = std::strlen(suffix);
+		return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+	}
+
+	uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+	{
+		static uint32_t table[256];
+		static bool tableReady = false;
+		if (!tableReady)
+		{
+			for (uint32_t n = 0; n < 256; ++n)
+			{
+				uint32_t c = n;
+				for (int k = 0; k < 8; ++k)
+				{
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				table[n] = c;
+			}
+			tableReady = true;
+		}
+
+		crc = ~crc;
+		for (size_t i = 0; i < size; ++i)
+		{
+			crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	void putBigEndian(std::vector<uint8_t>& out, uint32_t value)
+	{
+		out.push_back(static_cast<uint8_t>(value >> 24));
+		out.push_back(static_cast<uint8_t>(value >> 16));
+		out.push_back(static_cast<uint8_t>(value >> 8));
+		out.push_back(static_cast<uint8_t>(value));
+	}
+
+	void putChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+	{
+		putBigEndian(out, static_cast<uint32_t>(size));
+		size_t start = out.size();
+		out.insert(out.end(), type, type + 4);
+		out.insert(out.end(), data, data + size);
+		putBigEndian(out, crc32(out.data() + start, size + 4));
+	}
+
+	uint8_t clampByte(float value)
+	{
+		return static_cast<uint8_t>((std::min)(255.0f, (std::max)(0.0f, value + 0.5f)));
+	}
+}
+
+bool captureFormatFromPath(const std::string& path, CaptureFormat& format)
+{
+	if (endsWith(path, ".raw"))
+	{
+		format = CaptureFormat::Raw;
+	}
+	else if (endsWith(path, ".png"))
+	{
+		format = CaptureFormat::Png;
+	}
+	else if (endsWith(path, ".y4m"))
+	{
+		format = CaptureFormat::Y4m;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+CaptureEncoder::CaptureEncoder(const std::string& path, CaptureFormat format, uint32_t width, uint32_t height, bool bgra, uint32_t framesPerSecond)
+	: path(path)
+	, format(format)
+	, width(width)
+	, height(height)
+	, bgra(bgra)
+	, framesPerSecond(framesPerSecond)
+{
+}
+
+bool CaptureEncoder::open()
+{
+	if (format == CaptureFormat::Png)
+	{
+		return true;
+	}
+
+	stream.open(path, std::ios::binary | std::ios::trunc);
+	if (!stream.is_open())
+	{
+		return false;
+	}
+
+	if (format == CaptureFormat::Y4m)
+	{
+		// Full range BT.601, chroma sited like JPEG's
+		char header[128];
+		int length = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height, framesPerSecond);
+		stream.write(header, length);
+		written += static_cast<uint64_t>(length);
+	}
+	return true;
+}
+
+std::string CaptureEncoder::framePath(uint64_t frame) const
+{
+	if (format != CaptureFormat::Png)
+	{
+		return path;
+	}
+
+	char number[32];
+	std::snprintf(number, sizeof(number), "_%06llu", static_cast<unsigned long long>(frame));
+	return path.substr(0, path.size() - 4) + number + ".png";
+}
+
+bool CaptureEncoder::encode(uint64_t frame, const uint8_t* pixels)
+{
+	switch (format)
+	{
+	case CaptureFormat::Png:
+		return writePng(frame, pixels);
+	case CaptureFormat::Y4m:
+		return writeY4m(pixels);
+	case CaptureFormat::Raw:
+		return writeRaw(pixels);
+	}
+	return false;
+}
+
+bool CaptureEncoder::writeRaw(const uint8_t* pixels)
+{
+	size_t size = size_t(width) * height * 4;
+	if (!bgra)
+	{
+		stream.write(reinterpret_cast<const char*>(pixels), size);
+	}
+	else
+	{
+		scratch.resize(size);
+		for (size_t i = 0; i < size; i += 4)
+		{
+			scratch[i + 0] = pixels[i + 2];
+			scratch[i + 1] = pixels[i + 1];
+			scratch[i + 2] = pixels[i + 0];
+			scratch[i + 3] = pixels[i + 3];
+		}
+		stream.write(reinterpret_cast<const char*>(scratch.data()), size);
+	}
+
+	written += size;
+	return stream.good();
+}
+
+// 8-bit RGB, no filtering, and deflate's stored blocks rather than real compression: no zlib
+// to depend on, and the worker keeps up with the frame rate. The files are big, but they are
+// for diffing, not for keeping.
+bool CaptureEncoder::writePng(uint64_t frame, const uint8_t* pixels)
+{
+	const size_t rowBytes = size_t(width) * 3 + 1;
+	const size_t rawSize = rowBytes * height;
+
+	// Rows with their filter byte, then wrapped in a zlib stream of stored blocks
+	std::vector<uint8_t> raw(rawSize);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		uint8_t* row = &raw[y * rowBytes];
+		row[0] = 0;
+		const uint8_t* source = pixels + size_t(y) * width * 4;
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			row[1 + x * 3 + 0] = source[x * 4 + (bgra ? 2 : 0)];
+			row[1 + x * 3 + 1] = source[x * 4 + 1];
+			row[1 + x * 3 + 2] = source[x * 4 + (bgra ? 0 : 2)];
+		}
+	}
+
+	std::vector<uint8_t> zlib;
+	zlib.reserve(rawSize + rawSize / 65535 * 5 + 16);
+	zlib.push_back(0x78);
+	zlib.push_back(0x01);
+
+	uint32_t adlerA = 1;
+	uint32_t adlerB = 0;
+	for (size_t offset = 0; offset < rawSize || offset == 0; )
+	{
+		size_t block = (std::min)(rawSize - offset, size_t(65535));
+		bool last = offset + block == rawSize;
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(static_cast<uint8_t>(block));
+		zlib.push_back(static_cast<uint8_t>(block >> 8));
+		zlib.push_back(static_cast<uint8_t>(~block));
+		zlib.push_back(static_cast<uint8_t>(~block >> 8));
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+
+		for (size_t i = offset; i < offset + block; ++i)
+		{
+			adlerA = (adlerA + raw[i]) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+
+		offset += block;
+		if (last)
+		{
+			break;
+		}
+	}
+	putBigEndian(zlib, (adlerB << 16) | adlerA);
+
+	std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	uint8_t header[13];
+	header[0] = static_cast<uint8_t>(width >> 24);
+	header[1] = static_cast<uint8_t>(width >> 16);
+	header[2] = static_cast<uint8_t>(width >> 8);
+	header[3] = static_cast<uint8_t>(width);
+	header[4] = static_cast<uint8_t>(height >> 24);
+	header[5] = static_cast<uint8_t>(height >> 16);
+	header[6] = static_cast<uint8_t>(height >> 8);
+	header[7] = static_cast<uint8_t>(height);
+	header[8] = 8;		// bits per channel
+	header[9] = 2;		// truecolor
+	header[10] = 0;		// deflate
+	header[11] = 0;		// adaptive filtering
+	header[12] = 0;		// not interlaced
+	putChunk(png, "IHDR", header, sizeof(header));
+	putChunk(png, "IDAT", zlib.data(), zlib.size());
+	putChunk(png, "IEND", nullptr, 0);
+
+	std::ofstream file(framePath(frame), std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(png.data()), png.size());
+	written += png.size();
+	return file.good();
+}
+
+bool CaptureEncoder::writeY4m(const uint8_t* pixels)
+{
+	const uint32_t chromaWidth = (width + 1) / 2;
+	const uint32_t chromaHeight = (height + 1) / 2;
+	const size_t lumaSize = size_t(width) * height;
+	const size_t chromaSize = size_t(chromaWidth) * chromaHeight;
+
+	scratch.resize(lumaSize + chromaSize * 2);
+	uint8_t* lumaPlane = scratch.data();
+	uint8_t* bluePlane = lumaPlane + lumaSize;
+	uint8_t* redPlane = bluePlane + chromaSize;
+
+	const int red = bgra ? 2 : 0;
+	const int blue = bgra ? 0 : 2;
+
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const uint8_t* row = pixels + size_t(y) * width * 4;
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const uint8_t* p = row + x * 4;
+			lumaPlane[size_t(y) * width + x] = clampByte(0.299f * p[red] + 0.587f * p[1] + 0.114f * p[blue]);
+		}
+	}
+
+	// Each chroma sample averages the (up to) 2x2 pixels it covers
+	for (uint32_t cy = 0; cy < chromaHeight; ++cy)
+	{
+		for (uint32_t cx = 0; cx < chromaWidth; ++cx)
+		{
+			float r = 0.0f;
+			float g = 0.0f;
+			float b = 0.0f;
+			int count = 0;
+			for (uint32_t y = cy * 2; y < (std::min)(cy * 2 + 2, height); ++y)
+			{
+				for (uint32_t x = cx * 2; x < (std::min)(cx * 2 + 2, width); ++x)
+				{
+					const uint8_t* p = pixels + (size_t(y) * width + x) * 4;
+					r += p[red];
+					g += p[1];
+					b += p[blue];
+					++count;
+				}
+			}
+			r /= count;
+			g /= count;
+			b /= count;
+
+			bluePlane[size_t(cy) * chromaWidth + cx] = clampByte(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b);
+			redPlane[size_t(cy) * chromaWidth + cx] = clampByte(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b);
+		}
+	}
+
+	stream.write("FRAME\n", 6);
+	stream.write(reinterpret_cast<const char*>(scratch.data()), scratch.size());
+	written += 6 + scratch.size();
+	return stream.good();
+}
+
+void CaptureEncoder::close()
+{
+	if (stream.is_open())
+	{
+		stream.close();
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+enum class CaptureFormat
+{
+	Raw,	// RGBA8 frames back to back in one file, width * height * 4 bytes each
+	Png,	// one file per frame, the frame number inserted before the extension
+	Y4m		// one YUV4MPEG2 4:2:0 stream, which ffmpeg and most players read directly
+};
+
+// Picks the format from the extension: .raw, .png or .y4m. Returns false for anything else.
+bool captureFormatFromPath(const std::string& path, CaptureFormat& format);
+
+// Writes captured frames to disk. Frames come in as 8-bit, four channel pixels, rows tightly
+// packed, in RGBA or BGRA order. Not thread safe; FrameCapture calls it from its worker.
+class CaptureEncoder
+{
+public:
+	CaptureEncoder(const std::string& path, CaptureFormat format, uint32_t width, uint32_t height, bool bgra, uint32_t framesPerSecond = 60);
+
+	// Opens the stream for raw and Y4M output. Returns false if it can't be created.
+	bool open();
+
+	bool encode(uint64_t frame, const uint8_t* pixels);
+
+	void close();
+
+	uint64_t bytesWritten() const { return written; }
+
+	// For PNG, the file a frame goes to; otherwise the path itself
+	std::string framePath(uint64_t frame) const;
+
+private:
+	bool writePng(uint64_t frame, const uint8_t* pixels);
+	bool writeY4m(const uint8_t* pixels);
+	bool writeRaw(const uint8_t* pixels);
+
+	std::string path;
+	CaptureFormat format;
+	uint32_t width;
+	uint32_t height;
+	bool bgra;
+	uint32_t framesPerSecond;
+
+	std::ofstream stream;
+	std::vector<uint8_t> scratch;
+	uint64_t written = 0;
+};
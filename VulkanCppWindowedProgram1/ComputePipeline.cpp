@@ -0,0 +1,41 @@
+#include "ComputePipeline.h"
+
+ComputePipeline createComputePipeline(vk::Device device, PipelineCache& pipelineCache, DescriptorLayoutCache& layouts, vk::ShaderModule shader, uint32_t storageBufferCount, uint32_t pushConstantSize)
+{
+	ComputePipeline computePipeline;
+
+	computePipeline.setLayout = layouts.get(vk::DescriptorType::eStorageBuffer, storageBufferCount, vk::ShaderStageFlagBits::eCompute);
+
+	vk::PushConstantRange pushConstantRange = vk::PushConstantRange()
+		.setStageFlags(vk::ShaderStageFlagBits::eCompute)
+		.setOffset(0)
+		.setSize(pushConstantSize);
+
+	vk::PipelineLayoutCreateInfo layoutInfo = vk::PipelineLayoutCreateInfo()
+		.setSetLayoutCount(1)
+		.setPSetLayouts(&computePipeline.setLayout)
+		.setPushConstantRangeCount(pushConstantSize > 0 ? 1 : 0)
+		.setPPushConstantRanges(&pushConstantRange);
+
+	computePipeline.layout = device.createPipelineLayout(layoutInfo);
+
+	vk::PipelineShaderStageCreateInfo stageInfo = vk::PipelineShaderStageCreateInfo()
+		.setStage(vk::ShaderStageFlagBits::eCompute)
+		.setModule(shader)
+		.setPName("main");
+
+	vk::ComputePipelineCreateInfo pipelineInfo = vk::ComputePipelineCreateInfo()
+		.setStage(stageInfo)
+		.setLayout(computePipeline.layout);
+
+	computePipeline.pipeline = pipelineCache.createComputePipeline(pipelineInfo);
+
+	return computePipeline;
+}
+
+void destroyComputePipeline(vk::Device device, ComputePipeline& computePipeline)
+{
+	device.destroyPipeline(computePipeline.pipeline);
+	device.destroyPipelineLayout(computePipeline.layout);
+	computePipeline = ComputePipeline();
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+
+#include "Descriptors.h"
+#include "PipelineCache.h"
+
+// A compute shader together with the layouts it was built against. Set 0 holds
+// storageBufferCount storage buffers at bindings 0..n-1; push constants, if any,
+// start at offset 0. The set layout comes from, and belongs to, the layout cache.
+struct ComputePipeline
+{
+	vk::DescriptorSetLayout setLayout;
+	vk::PipelineLayout layout;
+	vk::Pipeline pipeline;
+};
+
+ComputePipeline createComputePipeline(vk::Device device, PipelineCache& pipelineCache, DescriptorLayoutCache& layouts, vk::ShaderModule shader, uint32_t storageBufferCount, uint32_t pushConstantSize);
+void destroyComputePipeline(vk::Device device, ComputePipeline& computePipeline);
+
+// Workgroups needed to cover itemCount invocations.
+inline uint32_t dispatchSize(uint32_t itemCount, uint32_t localSize)
+{
+	return (itemCount + localSize - 1) / localSize;
+}
@@ -0,0 +1,405 @@
+#include "Descriptors.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+DescriptorLayoutCache::DescriptorLayoutCache(vk::Device device)
+	: device(device)
+{
+}
+
+vk::DescriptorSetLayout DescriptorLayoutCache::get(const std::vector<DescriptorBinding>& bindings, vk::DescriptorSetLayoutCreateFlags flags)
+{
+	LayoutKey key;
+	key.first = static_cast<VkDescriptorSetLayoutCreateFlags>(flags);
+	for (const auto& binding : bindings)
+	{
+		key.second.push_back(std::make_tuple(binding.binding, static_cast<VkDescriptorType>(binding.type), binding.count,
+			static_cast<VkShaderStageFlags>(binding.stages), static_cast<VkDescriptorBindingFlagsEXT>(binding.flags)));
+	}
+
+	// The same bindings in a different order are the same layout
+	std::sort(key.second.begin(), key.second.end());
+
+	auto found = layouts.find(key);
+	if (found != layouts.end())
+	{
+		++hits;
+		return found->second;
+	}
+
+	std::vector<vk::DescriptorSetLayoutBinding> layoutBindings;
+	std::vector<vk::DescriptorBindingFlagsEXT> bindingFlags;
+	bool anyBindingFlags = false;
+	for (const auto& binding : bindings)
+	{
+		layoutBindings.push_back(vk::DescriptorSetLayoutBinding()
+			.setBinding(binding.binding)
+			.setDescriptorType(binding.type)
+			.setDescriptorCount(binding.count)
+			.setStageFlags(binding.stages));
+		bindingFlags.push_back(binding.flags);
+		anyBindingFlags = anyBindingFlags || binding.flags;
+	}
+
+	vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT()
+		.setBindingCount(static_cast<uint32_t>(bindingFlags.size()))
+		.setPBindingFlags(bindingFlags.data());
+
+	vk::DescriptorSetLayoutCreateInfo layoutInfo = vk::DescriptorSetLayoutCreateInfo()
+		.setPNext(anyBindingFlags ? &bindingFlagsInfo : nullptr)
+		.setFlags(flags)
+		.setBindingCount(static_cast<uint32_t>(layoutBindings.size()))
+		.setPBindings(layoutBindings.data());
+
+	vk::DescriptorSetLayout layout = device.createDescriptorSetLayout(layoutInfo);
+	layouts[key] = layout;
+	return layout;
+}
+
+vk::DescriptorSetLayout DescriptorLayoutCache::get(vk::DescriptorType type, uint32_t count, vk::ShaderStageFlags stages)
+{
+	std::vector<DescriptorBinding> bindings(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		bindings[i].binding = i;
+		bindings[i].type = type;
+		bindings[i].count = 1;
+		bindings[i].stages = stages;
+	}
+	return get(bindings);
+}
+
+void DescriptorLayoutCache::logStats() const
+{
+	std::cout << "descriptor layouts: " << layouts.size() << " created, " << hits << " requests shared an existing one" << std::endl;
+}
+
+void DescriptorLayoutCache::destroy()
+{
+	for (auto& entry : layouts)
+	{
+		device.destroyDescriptorSetLayout(entry.second);
+	}
+	layouts.clear();
+}
+
+namespace
+{
+	// Enough of everything for the sets this program makes; a pool that runs out of any one
+	// type is simply followed by another
+	const uint32_t setsPerPool = 64;
+}
+
+DescriptorAllocator::DescriptorAllocator(vk::Device device)
+	: device(device)
+{
+}
+
+vk::DescriptorPool DescriptorAllocator::createPool()
+{
+	vk::DescriptorPoolSize poolSizes[] = {
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, setsPerPool * 4),
+		vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, setsPerPool * 2),
+		vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, setsPerPool),
+		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, setsPerPool * 2),
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, setsPerPool),
+	};
+
+	vk::DescriptorPoolCreateInfo poolInfo = vk::DescriptorPoolCreateInfo()
+		.setMaxSets(setsPerPool)
+		.setPoolSizeCount(sizeof(poolSizes) / sizeof(poolSizes[0]))
+		.setPPoolSizes(poolSizes);
+
+	return device.createDescriptorPool(poolInfo);
+}
+
+vk::DescriptorSet DescriptorAllocator::allocate(vk::DescriptorSetLayout layout)
+{
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		if (!currentPool || attempt > 0)
+		{
+			if (freePools.empty())
+			{
+				currentPool = createPool();
+			}
+			else
+			{
+				currentPool = freePools.back();
+				freePools.pop_back();
+			}
+			usedPools.push_back(currentPool);
+		}
+
+		vk::DescriptorSetAllocateInfo allocateInfo = vk::DescriptorSetAllocateInfo()
+			.setDescriptorPool(currentPool)
+			.setDescriptorSetCount(1)
+			.setPSetLayouts(&layout);
+
+		// The non-throwing overload, since running out is expected
+		vk::DescriptorSet descriptorSet;
+		vk::Result result = device.allocateDescriptorSets(&allocateInfo, &descriptorSet);
+		if (result == vk::Result::eSuccess)
+		{
+			return descriptorSet;
+		}
+		if (result != vk::Result::eErrorOutOfPoolMemory && result != vk::Result::eErrorFragmentedPool)
+		{
+			break;
+		}
+	}
+
+	throw std::runtime_error("descriptor allocator: could not allocate a descriptor set");
+}
+
+void DescriptorAllocator::reset()
+{
+	for (vk::DescriptorPool pool : usedPools)
+	{
+		device.resetDescriptorPool(pool);
+		freePools.push_back(pool);
+	}
+	usedPools.clear();
+	currentPool = vk::DescriptorPool();
+}
+
+void DescriptorAllocator::destroy()
+{
+	for (vk::DescriptorPool pool : usedPools)
+	{
+		device.destroyDescriptorPool(pool);
+	}
+	for (vk::DescriptorPool pool : freePools)
+	{
+		device.destroyDescriptorPool(pool);
+	}
+	usedPools.clear();
+	freePools.clear();
+	currentPool = vk::DescriptorPool();
+}
+
+BindlessSupport queryBindlessSupport(vk::PhysicalDevice physicalDevice, const vk::DispatchLoaderDynamic& dispatch)
+{
+	BindlessSupport support;
+
+	if (!dispatch.vkGetPhysicalDeviceFeatures2KHR)
+	{
+		return support;
+	}
+
+	const char* required[] = { VK_KHR_MAINTENANCE3_EXTENSION_NAME, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME };
+	auto available = physicalDevice.enumerateDeviceExtensionProperties();
+	for (const char* extension : required)
+	{
+		bool found = false;
+		for (const auto& properties : available)
+		{
+			found = found || std::strcmp(properties.extensionName, extension) == 0;
+		}
+		if (!found)
+		{
+			return support;
+		}
+	}
+
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = {};
+	indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+	VkPhysicalDeviceFeatures2KHR features = {};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+	features.pNext = &indexing;
+
+	dispatch.vkGetPhysicalDeviceFeatures2KHR(static_cast<VkPhysicalDevice>(physicalDevice), &features);
+
+	// The index comes from a push constant, so it is dynamically uniform: the core dynamic indexing
+	// features are needed for both arrays, but no non-uniform indexing feature is
+	vk::PhysicalDeviceFeatures core = physicalDevice.getFeatures();
+	if (!core.shaderStorageBufferArrayDynamicIndexing || !core.shaderSampledImageArrayDynamicIndexing)
+	{
+		return support;
+	}
+	if (!indexing.runtimeDescriptorArray || !indexing.descriptorBindingPartiallyBound
+		|| !indexing.descriptorBindingStorageBufferUpdateAfterBind || !indexing.descriptorBindingSampledImageUpdateAfterBind)
+	{
+		return support;
+	}
+
+	// The heap is one set visible to every stage, so both the per-stage and the per-set limits apply
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {};
+	limits.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+
+	VkPhysicalDeviceProperties2KHR properties = {};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+	properties.pNext = &limits;
+
+	dispatch.vkGetPhysicalDeviceProperties2KHR(static_cast<VkPhysicalDevice>(physicalDevice), &properties);
+
+	uint32_t resources = limits.maxPerStageUpdateAfterBindResources;
+	support.bufferSlots = (std::min)({ BindlessHeap::maxBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+		limits.maxDescriptorSetUpdateAfterBindStorageBuffers, resources / 2 });
+	support.imageSlots = (std::min)({ BindlessHeap::maxImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		limits.maxPerStageDescriptorUpdateAfterBindSamplers, limits.maxDescriptorSetUpdateAfterBindSampledImages,
+		limits.maxDescriptorSetUpdateAfterBindSamplers, resources - support.bufferSlots });
+
+	if (support.bufferSlots < 16 || support.imageSlots < 16)
+	{
+		return support;
+	}
+
+	support.supported = true;
+	support.extensions.assign(std::begin(required), std::end(required));
+	support.enabledFeatures
+		.setRuntimeDescriptorArray(VK_TRUE)
+		.setDescriptorBindingPartiallyBound(VK_TRUE)
+		.setDescriptorBindingStorageBufferUpdateAfterBind(VK_TRUE)
+		.setDescriptorBindingSampledImageUpdateAfterBind(VK_TRUE);
+	return support;
+}
+
+BindlessHeap::BindlessHeap(vk::Device device, DescriptorLayoutCache& layouts, const BindlessSupport& support, uint32_t framesInFlight)
+	: device(device)
+	, bufferSlots(support.bufferSlots)
+	, imageSlots(support.imageSlots)
+	, framesInFlight(framesInFlight)
+{
+	vk::ShaderStageFlags stages = vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute;
+	vk::DescriptorBindingFlagsEXT flags = vk::DescriptorBindingFlagBitsEXT::ePartiallyBound | vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind;
+
+	std::vector<DescriptorBinding> bindings = {
+		{ 0, vk::DescriptorType::eStorageBuffer, bufferSlots, stages, flags },
+		{ 1, vk::DescriptorType::eCombinedImageSampler, imageSlots, stages, flags },
+	};
+	setLayout = layouts.get(bindings, vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT);
+
+	vk::DescriptorPoolSize poolSizes[] = {
+		vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, bufferSlots),
+		vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, imageSlots),
+	};
+
+	vk::DescriptorPoolCreateInfo poolInfo = vk::DescriptorPoolCreateInfo()
+		.setFlags(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT)
+		.setMaxSets(1)
+		.setPoolSizeCount(2)
+		.setPPoolSizes(poolSizes);
+
+	pool = device.createDescriptorPool(poolInfo);
+
+	vk::DescriptorSetAllocateInfo allocateInfo = vk::DescriptorSetAllocateInfo()
+		.setDescriptorPool(pool)
+		.setDescriptorSetCount(1)
+		.setPSetLayouts(&setLayout);
+
+	descriptorSet = device.allocateDescriptorSets(allocateInfo)[0];
+}
+
+uint32_t BindlessHeap::buffer(vk::Buffer buffer)
+{
+	auto found = buffers.find(static_cast<VkBuffer>(buffer));
+	if (found != buffers.end())
+	{
+		return found->second;
+	}
+
+	uint32_t index;
+	if (!freeBufferSlots.empty())
+	{
+		index = freeBufferSlots.back();
+		freeBufferSlots.pop_back();
+	}
+	else if (nextBufferSlot < bufferSlots)
+	{
+		index = nextBufferSlot++;
+	}
+	else
+	{
+		throw std::runtime_error("bindless heap: out of buffer slots");
+	}
+
+	vk::DescriptorBufferInfo bufferInfo(buffer, 0, VK_WHOLE_SIZE);
+
+	vk::WriteDescriptorSet write = vk::WriteDescriptorSet()
+		.setDstSet(descriptorSet)
+		.setDstBinding(0)
+		.setDstArrayElement(index)
+		.setDescriptorCount(1)
+		.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+		.setPBufferInfo(&bufferInfo);
+
+	device.updateDescriptorSets(write, nullptr);
+
+	buffers[static_cast<VkBuffer>(buffer)] = index;
+	return index;
+}
+
+uint32_t BindlessHeap::image(vk::ImageView view, vk::Sampler sampler)
+{
+	auto key = std::make_pair(static_cast<VkImageView>(view), static_cast<VkSampler>(sampler));
+	auto found = images.find(key);
+	if (found != images.end())
+	{
+		return found->second;
+	}
+
+	uint32_t index = static_cast<uint32_t>(images.size());
+	if (index == imageSlots)
+	{
+		throw std::runtime_error("bindless heap: out of image slots");
+	}
+
+	vk::DescriptorImageInfo imageInfo(sampler, view, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+	vk::WriteDescriptorSet write = vk::WriteDescriptorSet()
+		.setDstSet(descriptorSet)
+		.setDstBinding(1)
+		.setDstArrayElement(index)
+		.setDescriptorCount(1)
+		.setDescriptorType(vk::DescriptorType::eCombinedImageSampler)
+		.setPImageInfo(&imageInfo);
+
+	device.updateDescriptorSets(write, nullptr);
+
+	images[key] = index;
+	return index;
+}
+
+void BindlessHeap::remove(vk::Buffer buffer, uint64_t frame)
+{
+	auto found = buffers.find(static_cast<VkBuffer>(buffer));
+	if (found == buffers.end())
+	{
+		return;
+	}
+
+	// The descriptor is left pointing at the old buffer; the set is partially bound, so that's
+	// fine as long as nothing reads the index, and the slot isn't reused until nothing can
+	removedBufferSlots.push_back(std::make_pair(frame, found->second));
+	buffers.erase(found);
+}
+
+void BindlessHeap::beginFrame(uint64_t frame)
+{
+	while (!removedBufferSlots.empty() && frame >= removedBufferSlots.front().first + framesInFlight)
+	{
+		freeBufferSlots.push_back(removedBufferSlots.front().second);
+		removedBufferSlots.pop_front();
+	}
+}
+
+void BindlessHeap::logStats() const
+{
+	std::cout << "bindless heap: " << buffers.size() << " of " << bufferSlots << " buffer slots, "
+		<< images.size() << " of " << imageSlots << " image slots in use" << std::endl;
+}
+
+void BindlessHeap::destroy()
+{
+	device.destroyDescriptorPool(pool);
+	buffers.clear();
+	images.clear();
+	freeBufferSlots.clear();
+	removedBufferSlots.clear();
+}
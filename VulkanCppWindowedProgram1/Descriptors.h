@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// One binding in a set layout, plus the descriptor indexing flags it was created with
+struct DescriptorBinding
+{
+	uint32_t binding;
+	vk::DescriptorType type;
+	uint32_t count;
+	vk::ShaderStageFlags stages;
+	vk::DescriptorBindingFlagsEXT flags;
+};
+
+// Set layouts shared by everything with the same binding signature. Layouts handed out stay
+// valid until destroy(); nobody else destroys them.
+class DescriptorLayoutCache
+{
+public:
+	explicit DescriptorLayoutCache(vk::Device device);
+
+	vk::DescriptorSetLayout get(const std::vector<DescriptorBinding>& bindings, vk::DescriptorSetLayoutCreateFlags flags = vk::DescriptorSetLayoutCreateFlags());
+
+	// The common case: bindings 0..count-1, one descriptor of the same type each
+	vk::DescriptorSetLayout get(vk::DescriptorType type, uint32_t count, vk::ShaderStageFlags stages);
+
+	void logStats() const;
+	void destroy();
+
+private:
+	typedef std::tuple<uint32_t, VkDescriptorType, uint32_t, VkShaderStageFlags, VkDescriptorBindingFlagsEXT> BindingKey;
+	typedef std::pair<VkDescriptorSetLayoutCreateFlags, std::vector<BindingKey>> LayoutKey;
+
+	vk::Device device;
+	std::map<LayoutKey, vk::DescriptorSetLayout> layouts;
+	uint32_t hits = 0;
+};
+
+// Hands out descriptor sets from a growing list of pools and takes them all back at once.
+// Sets are never freed one by one: give each lifetime its own allocator (one per frame in
+// flight, one per set of pre-recorded command buffers, one for the life of the program) and
+// reset() it when nothing on the GPU can still be using its sets.
+class DescriptorAllocator
+{
+public:
+	explicit DescriptorAllocator(vk::Device device);
+
+	vk::DescriptorSet allocate(vk::DescriptorSetLayout layout);
+
+	// Returns every set to the pools. The pools are kept for the next round.
+	void reset();
+
+	uint32_t poolCount() const { return static_cast<uint32_t>(usedPools.size() + freePools.size()); }
+
+	void destroy();
+
+private:
+	vk::DescriptorPool createPool();
+
+	vk::Device device;
+	vk::DescriptorPool currentPool;
+	std::vector<vk::DescriptorPool> usedPools;
+	std::vector<vk::DescriptorPool> freePools;
+};
+
+// Device requirements for BindlessHeap. Query them before creating the device, then chain
+// enabledFeatures into VkDeviceCreateInfo::pNext and add extensions to the device extensions.
+struct BindlessSupport
+{
+	bool supported = false;
+	std::vector<const char*> extensions;
+	vk::PhysicalDeviceDescriptorIndexingFeaturesEXT enabledFeatures;
+
+	// Heap sizes the update-after-bind limits allow, at most BindlessHeap::maxBuffers/maxImages
+	uint32_t bufferSlots = 0;
+	uint32_t imageSlots = 0;
+};
+
+// Needs VK_KHR_get_physical_device_properties2 enabled on the instance. Not supported either
+// when the update-after-bind limits leave room for fewer than 16 buffers or images.
+BindlessSupport queryBindlessSupport(vk::PhysicalDevice physicalDevice, const vk::DispatchLoaderDynamic& dispatch);
+
+// One descriptor set holding a large array of storage buffers (binding 0) and one of combined
+// image samplers (binding 1), built on VK_EXT_descriptor_indexing. Resources are added once
+// and then addressed by index, normally through a push constant, so drawing from a different
+// buffer or texture never means another descriptor set. The set is update-after-bind and
+// partially bound: adding a resource doesn't disturb command buffers already recorded against it.
+class BindlessHeap
+{
+public:
+	static const uint32_t maxBuffers = 1024;
+	static const uint32_t maxImages = 1024;
+
+	// support must be supported; the heap takes its slot counts from it
+	BindlessHeap(vk::Device device, DescriptorLayoutCache& layouts, const BindlessSupport& support, uint32_t framesInFlight);
+
+	vk::DescriptorSetLayout layout() const { return setLayout; }
+	vk::DescriptorSet set() const { return descriptorSet; }
+
+	// Index of buffer in the heap, adding it the first time. Not thread safe; resolve indices
+	// before handing work to recording threads.
+	uint32_t buffer(vk::Buffer buffer);
+	uint32_t image(vk::ImageView view, vk::Sampler sampler);
+
+	// Takes buffer out of the heap, before it is destroyed or once it has been replaced (e.g. moved
+	// by ResidencyManager). Frames already submitted may still read its index, so the slot is
+	// only handed out again once the frames in flight at frame are done.
+	void remove(vk::Buffer buffer, uint64_t frame);
+
+	// Call once a frame with the frame number remove() gets, to recycle slots nobody reads anymore
+	void beginFrame(uint64_t frame);
+
+	void logStats() const;
+	void destroy();
+
+private:
+	vk::Device device;
+	vk::DescriptorSetLayout setLayout;
+	vk::DescriptorPool pool;
+	vk::DescriptorSet descriptorSet;
+
+	uint32_t bufferSlots;
+	uint32_t imageSlots;
+	uint32_t framesInFlight;
+
+	std::map<VkBuffer, uint32_t> buffers;
+	std::map<std::pair<VkImageView, VkSampler>, uint32_t> images;
+
+	uint32_t nextBufferSlot = 0;
+	std::vector<uint32_t> freeBufferSlots;
+	std::deque<std::pair<uint64_t, uint32_t>> removedBufferSlots;	// frame removed, slot
+};
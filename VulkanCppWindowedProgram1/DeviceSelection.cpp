@@ -0,0 +1,229 @@
+#include "DeviceSelection.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+std::vector<uint32_t> QueueFamilies::unique() const
+{
+	std::vector<uint32_t> families;
+	for (uint32_t family : { graphics, present, compute, transfer })
+	{
+		if (family != none && std::find(families.begin(), families.end(), family) == families.end())
+		{
+			families.push_back(family);
+		}
+	}
+	return families;
+}
+
+QueueFamilies findQueueFamilies(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface)
+{
+	QueueFamilies families;
+	std::vector<vk::QueueFamilyProperties> properties = physicalDevice.getQueueFamilyProperties();
+
+	auto supportsPresent = [&](uint32_t family)
+	{
+		return surface && physicalDevice.getSurfaceSupportKHR(family, surface);
+	};
+
+	for (uint32_t family = 0; family < properties.size(); ++family)
+	{
+		if (properties[family].queueCount == 0)
+		{
+			continue;
+		}
+
+		vk::QueueFlags flags = properties[family].queueFlags;
+
+		// Prefer a graphics family that can present too, so we don't need ownership transfers
+		if (flags & vk::QueueFlagBits::eGraphics)
+		{
+			if (families.graphics == QueueFamilies::none || (supportsPresent(family) && !supportsPresent(families.graphics)))
+			{
+				families.graphics = family;
+			}
+		}
+
+		// Async compute: a compute family that isn't also the graphics family
+		if ((flags & vk::QueueFlagBits::eCompute) && !(flags & vk::QueueFlagBits::eGraphics) && families.compute == QueueFamilies::none)
+		{
+			families.compute = family;
+		}
+
+		// Dedicated transfer (DMA) engines advertise transfer without graphics or compute
+		if ((flags & vk::QueueFlagBits::eTransfer) && !(flags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+		{
+			families.transfer = family;
+		}
+	}
+
+	if (families.graphics == QueueFamilies::none)
+	{
+		return families;
+	}
+
+	if (surface)
+	{
+		if (supportsPresent(families.graphics))
+		{
+			families.present = families.graphics;
+		}
+		else
+		{
+			for (uint32_t family = 0; family < properties.size(); ++family)
+			{
+				if (properties[family].queueCount > 0 && supportsPresent(family))
+				{
+					families.present = family;
+					break;
+				}
+			}
+		}
+	}
+
+	// Graphics queues always support compute and transfer
+	if (families.compute == QueueFamilies::none)
+	{
+		families.compute = families.graphics;
+	}
+	if (families.transfer == QueueFamilies::none)
+	{
+		families.transfer = families.compute != families.graphics ? families.compute : families.graphics;
+	}
+
+	return families;
+}
+
+namespace
+{
+	// Why the device can't run the program at all, or empty when it can
+	std::string unsuitableReason(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, const std::vector<const char*>& requiredExtensions, const vk::PhysicalDeviceFeatures& requiredFeatures)
+	{
+		auto availableExtensions = physicalDevice.enumerateDeviceExtensionProperties();
+		for (const char* required : requiredExtensions)
+		{
+			bool found = std::any_of(availableExtensions.begin(), availableExtensions.end(), [required](const vk::ExtensionProperties& extension)
+			{
+				return std::strcmp(extension.extensionName, required) == 0;
+			});
+
+			if (!found)
+			{
+				return std::string("it lacks the ") + required + " extension";
+			}
+		}
+
+		// PhysicalDeviceFeatures is nothing but VkBool32s, so compare them member by member
+		vk::PhysicalDeviceFeatures availableFeatures = physicalDevice.getFeatures();
+		const VkBool32* required = reinterpret_cast<const VkBool32*>(&requiredFeatures);
+		const VkBool32* available = reinterpret_cast<const VkBool32*>(&availableFeatures);
+		for (size_t i = 0; i < sizeof(vk::PhysicalDeviceFeatures) / sizeof(VkBool32); ++i)
+		{
+			if (required[i] && !available[i])
+			{
+				return "it lacks a required device feature";
+			}
+		}
+
+		QueueFamilies families = findQueueFamilies(physicalDevice, surface);
+		if (families.graphics == QueueFamilies::none || (surface && families.present == QueueFamilies::none))
+		{
+			return "it has no graphics or present queue";
+		}
+
+		return std::string();
+	}
+}
+
+int64_t scorePhysicalDevice(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, const std::vector<const char*>& requiredExtensions, const vk::PhysicalDeviceFeatures& requiredFeatures)
+{
+	if (!unsuitableReason(physicalDevice, surface, requiredExtensions, requiredFeatures).empty())
+	{
+		return -1;
+	}
+
+	vk::PhysicalDeviceProperties properties = physicalDevice.getProperties();
+	QueueFamilies families = findQueueFamilies(physicalDevice, surface);
+
+	int64_t score = 0;
+	switch (properties.deviceType)
+	{
+	case vk::PhysicalDeviceType::eDiscreteGpu:
+		score += 100000;
+		break;
+	case vk::PhysicalDeviceType::eIntegratedGpu:
+		score += 10000;
+		break;
+	case vk::PhysicalDeviceType::eVirtualGpu:
+		score += 5000;
+		break;
+	case vk::PhysicalDeviceType::eCpu:
+		score += 1000;
+		break;
+	default:
+		break;
+	}
+
+	// Break ties on device local memory, one point per 64MB
+	vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+	{
+		if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+		{
+			score += static_cast<int64_t>(memoryProperties.memoryHeaps[i].size >> 26);
+		}
+	}
+
+	if (families.asyncCompute())
+	{
+		score += 500;
+	}
+	if (families.dedicatedTransfer())
+	{
+		score += 500;
+	}
+
+	return score;
+}
+
+vk::PhysicalDevice selectPhysicalDevice(const std::vector<vk::PhysicalDevice>& physicalDevices, vk::SurfaceKHR surface, const std::vector<const char*>& requiredExtensions, const vk::PhysicalDeviceFeatures& requiredFeatures, int forcedIndex)
+{
+	if (forcedIndex >= 0)
+	{
+		if (static_cast<size_t>(forcedIndex) >= physicalDevices.size())
+		{
+			throw std::runtime_error("requested physical device does not exist!");
+		}
+
+		// Forcing a device skips the ranking, not the checks the device has to pass
+		std::string reason = unsuitableReason(physicalDevices[forcedIndex], surface, requiredExtensions, requiredFeatures);
+		if (!reason.empty())
+		{
+			throw std::runtime_error(std::string("requested physical device ") + physicalDevices[forcedIndex].getProperties().deviceName + " can't be used: " + reason);
+		}
+		return physicalDevices[forcedIndex];
+	}
+
+	vk::PhysicalDevice best;
+	int64_t bestScore = -1;
+	for (const auto& physicalDevice : physicalDevices)
+	{
+		int64_t score = scorePhysicalDevice(physicalDevice, surface, requiredExtensions, requiredFeatures);
+		std::cout << "\t" << physicalDevice.getProperties().deviceName << " scored " << score << std::endl;
+
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = physicalDevice;
+		}
+	}
+
+	if (!best)
+	{
+		throw std::runtime_error("failed to find a suitable physical device!");
+	}
+
+	return best;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Queue family indices picked for each kind of work. Compute and transfer fall back to the
+// graphics family when the device has no dedicated family for them.
+struct QueueFamilies
+{
+	static const uint32_t none = UINT32_MAX;
+
+	uint32_t graphics = none;
+	uint32_t present = none;
+	uint32_t compute = none;
+	uint32_t transfer = none;
+
+	bool asyncCompute() const { return compute != graphics; }
+	bool dedicatedTransfer() const { return transfer != graphics; }
+
+	// Every distinct family we use, for queue creation and concurrent sharing
+	std::vector<uint32_t> unique() const;
+};
+
+// Pass a null surface when rendering headless; present is then left as none.
+QueueFamilies findQueueFamilies(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface);
+
+// Higher is better, negative means the device can't run us at all.
+int64_t scorePhysicalDevice(vk::PhysicalDevice physicalDevice, vk::SurfaceKHR surface, const std::vector<const char*>& requiredExtensions, const vk::PhysicalDeviceFeatures& requiredFeatures);
+
+// Picks the best scoring device, or the one at forcedIndex if that is not negative.
+// Throws if nothing is usable.
+vk::PhysicalDevice selectPhysicalDevice(const std::vector<vk::PhysicalDevice>& physicalDevices, vk::SurfaceKHR surface, const std::vector<const char*>& requiredExtensions, const vk::PhysicalDeviceFeatures& requiredFeatures, int forcedIndex);
@@ -0,0 +1,101 @@
+#include "DynamicResolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+	// Frames averaged before deciding, and fewer when far over budget
+	const uint32_t windowSize = 8;
+	const uint32_t urgentWindowSize = 3;
+	const double urgentRatio = 1.25;
+
+	// Under this fraction of the target there is room to grow; resizing aims between the two
+	const double headroom = 0.85;
+	const double aim = 0.92;
+
+	// Largest growth in one step
+	const float maxGrowth = 1.1f;
+
+	const float scaleStep = 1.0f / 64.0f;
+}
+
+DynamicResolution::DynamicResolution(double targetMilliseconds, float minScale, float maxScale)
+	: target(targetMilliseconds)
+	, minScale((std::min)(minScale, maxScale))
+	, maxScale(maxScale)
+	, current(maxScale)
+	, lowestScale(maxScale)
+{
+}
+
+void DynamicResolution::addSample(uint64_t frame, double gpuMilliseconds)
+{
+	++measuredFrames;
+	if (gpuMilliseconds > target)
+	{
+		++overBudgetFrames;
+	}
+
+	if (frame < changedAtFrame)
+	{
+		return;
+	}
+
+	windowMilliseconds += gpuMilliseconds;
+	++windowFrames;
+}
+
+float DynamicResolution::scaleFor(uint64_t frame)
+{
+	if (windowFrames > 0)
+	{
+		double measured = windowMilliseconds / windowFrames;
+		bool urgent = windowFrames >= urgentWindowSize && measured > target * urgentRatio;
+
+		if (windowFrames >= windowSize || urgent)
+		{
+			if (measured > target || measured < target * headroom)
+			{
+				float wanted = current * static_cast<float>(std::sqrt(target * aim / measured));
+				wanted = (std::min)(wanted, current * maxGrowth);
+				wanted = std::round(wanted / scaleStep) * scaleStep;
+				wanted = (std::max)(minScale, (std::min)(maxScale, wanted));
+				if (wanted != current)
+				{
+					change(wanted, frame);
+				}
+			}
+
+			windowMilliseconds = 0.0;
+			windowFrames = 0;
+		}
+	}
+
+	++frames;
+	scaleSum += current;
+	return current;
+}
+
+void DynamicResolution::change(float scale, uint64_t frame)
+{
+	current = scale;
+	changedAtFrame = frame;
+	lowestScale = (std::min)(lowestScale, scale);
+	++changes;
+}
+
+vk::Extent2D DynamicResolution::scaledExtent(vk::Extent2D full) const
+{
+	return vk::Extent2D(
+		(std::max)(1u, static_cast<uint32_t>(full.width * current + 0.5f)),
+		(std::max)(1u, static_cast<uint32_t>(full.height * current + 0.5f)));
+}
+
+void DynamicResolution::logStats() const
+{
+	std::cout << "dynamic resolution: " << target << "ms GPU target, scale averaged "
+		<< (frames ? scaleSum / frames : double(current)) << " (lowest " << lowestScale << ", " << changes << " changes), "
+		<< overBudgetFrames << " of " << measuredFrames << " measured frames over budget" << std::endl;
+}
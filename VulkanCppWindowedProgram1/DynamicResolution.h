@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+
+// Picks the resolution to render at from measured GPU frame times, so a fill-heavy frame gives
+// up pixels instead of missing its budget. GPU time is taken to follow the pixel count: when a
+// window of frames averages over the target, the area shrinks by target / measured; when it
+// runs well under, the area grows back, a step at a time so it doesn't overshoot. The scale
+// applies to each axis and moves in steps of 1/64, so noise doesn't resize every frame.
+//
+// Timings arrive frames late; samples from frames rendered before the last change are
+// ignored, so the controller never reacts twice to the same overload.
+class DynamicResolution
+{
+public:
+	// targetMilliseconds is the GPU time per frame to stay under
+	DynamicResolution(double targetMilliseconds, float minScale, float maxScale = 1.0f);
+
+	// The GPU time of a finished frame
+	void addSample(uint64_t frame, double gpuMilliseconds);
+
+	// The scale to render frame at. Call once per frame, in order, before recording it.
+	float scaleFor(uint64_t frame);
+
+	float scale() const { return current; }
+
+	// full at the current scale, at least 1x1
+	vk::Extent2D scaledExtent(vk::Extent2D full) const;
+
+	void logStats() const;
+
+private:
+	void change(float scale, uint64_t frame);
+
+	double target;
+	float minScale;
+	float maxScale;
+	float current;
+
+	uint64_t changedAtFrame = 0;
+	double windowMilliseconds = 0.0;
+	uint32_t windowFrames = 0;
+
+	uint64_t frames = 0;
+	double scaleSum = 0.0;
+	float lowestScale;
+	uint32_t changes = 0;
+	uint64_t measuredFrames = 0;
+	uint64_t overBudgetFrames = 0;
+};
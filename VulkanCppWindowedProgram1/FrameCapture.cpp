@@ -0,0 +1,224 @@
+#include "FrameCapture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	bool isBgra(vk::Format format)
+	{
+		return format == vk::Format::eB8G8R8A8Unorm || format == vk::Format::eB8G8R8A8Srgb;
+	}
+}
+
+FrameCapture::FrameCapture(vk::Device device, MemoryAllocator& allocator, vk::Format format, vk::Extent2D extent, uint32_t slotCount, const std::string& path, CaptureFormat captureFormat)
+	: device(device)
+	, allocator(allocator)
+	, extent(extent)
+	, path(path)
+	, encoder(path, captureFormat, extent.width, extent.height, isBgra(format))
+{
+	if (!encoder.open())
+	{
+		throw std::runtime_error("frame capture: cannot create " + path);
+	}
+
+	// Host cached where the device has it, so the encoder's reads aren't uncached loads
+	vk::DeviceSize frameBytes = vk::DeviceSize(extent.width) * extent.height * 4;
+	slots.resize((std::max)(slotCount, 1u));
+	for (Slot& slot : slots)
+	{
+		slot.buffer = allocator.createBuffer(frameBytes, vk::BufferUsageFlagBits::eTransferDst, MemoryUsage::GpuToCpu);
+	}
+
+	worker = std::thread(&FrameCapture::workerMain, this);
+}
+
+bool FrameCapture::supportsFormat(vk::Format format)
+{
+	return isBgra(format)
+		|| format == vk::Format::eR8G8B8A8Unorm
+		|| format == vk::Format::eR8G8B8A8Srgb;
+}
+
+int32_t FrameCapture::begin(uint64_t frame, vk::Extent2D extent)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	int32_t result = -1;
+
+	if (extent != this->extent)
+	{
+		++skippedResized;
+	}
+	else
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (size_t i = 0; i < slots.size(); ++i)
+		{
+			if (slots[i].state == SlotState::Free)
+			{
+				slots[i].state = SlotState::Recorded;
+				slots[i].frame = frame;
+				result = static_cast<int32_t>(i);
+				break;
+			}
+		}
+		if (result < 0)
+		{
+			++skippedBusy;
+		}
+	}
+
+	renderThreadMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+	return result;
+}
+
+void FrameCapture::record(vk::CommandBuffer commandBuffer, vk::Image image, int32_t slot) const
+{
+	vk::BufferImageCopy region = vk::BufferImageCopy()
+		.setBufferOffset(0)
+		.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+		.setImageExtent(vk::Extent3D(extent.width, extent.height, 1));
+	commandBuffer.copyImageToBuffer(image, vk::ImageLayout::eTransferSrcOptimal, slots[slot].buffer->buffer, region);
+
+	// The fence wait alone doesn't make transfer writes visible to the host
+	vk::BufferMemoryBarrier toHost = vk::BufferMemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eHostRead)
+		.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+		.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+		.setBuffer(slots[slot].buffer->buffer)
+		.setOffset(0)
+		.setSize(VK_WHOLE_SIZE);
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), nullptr, toHost, nullptr);
+}
+
+void FrameCapture::complete(uint64_t frame)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// In frame order, so streams come out in the order the frames were rendered
+		std::vector<uint32_t> ready;
+		for (uint32_t i = 0; i < slots.size(); ++i)
+		{
+			if (slots[i].state == SlotState::Recorded && slots[i].frame <= frame)
+			{
+				ready.push_back(i);
+			}
+		}
+		std::sort(ready.begin(), ready.end(), [this](uint32_t a, uint32_t b) { return slots[a].frame < slots[b].frame; });
+
+		for (uint32_t i : ready)
+		{
+			slots[i].state = SlotState::Queued;
+			queue.push_back(i);
+		}
+		queued = !ready.empty();
+	}
+	if (queued)
+	{
+		workReady.notify_one();
+	}
+
+	renderThreadMicroseconds += std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void FrameCapture::workerMain()
+{
+	for (;;)
+	{
+		Slot* slot = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workReady.wait(lock, [this] { return quit || !queue.empty(); });
+			if (queue.empty())
+			{
+				return;
+			}
+
+			slot = &slots[queue.front()];
+			queue.pop_front();
+			slot->state = SlotState::Encoding;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		allocator.invalidate(slot->buffer);
+		bool written = encoder.encode(slot->frame, static_cast<const uint8_t*>(slot->buffer->mapped));
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slot->state = SlotState::Free;
+			if (written)
+			{
+				++captured;
+			}
+			else if (failed++ == 0)
+			{
+				std::cout << "frame capture: writing " << encoder.framePath(slot->frame) << " failed" << std::endl;
+			}
+			encodeMilliseconds += milliseconds;
+		}
+	}
+}
+
+void FrameCapture::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	workReady.notify_all();
+
+	if (worker.joinable())
+	{
+		worker.join();
+	}
+	encoder.close();
+}
+
+void FrameCapture::logStats(double seconds) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint64_t encoded = captured + failed;
+	double frameMegabytes = double(extent.width) * extent.height * 4 / (1024.0 * 1024.0);
+	double writtenMegabytes = encoder.bytesWritten() / (1024.0 * 1024.0);
+
+	std::cout << "frame capture: " << captured << " frames of " << extent.width << "x" << extent.height << " to " << path
+		<< " through " << slots.size() << " slots of " << frameMegabytes << "MB; "
+		<< skippedBusy << " skipped with every slot busy, " << skippedResized << " at another size";
+	if (failed)
+	{
+		std::cout << ", " << failed << " failed to write";
+	}
+	std::cout << std::endl;
+
+	if (encoded)
+	{
+		double perFrame = encodeMilliseconds / encoded;
+		std::cout << "frame capture: encoding took " << perFrame << "ms a frame on the worker (keeps up with "
+			<< (perFrame > 0.0 ? 1000.0 / perFrame : 0.0) << "fps), " << writtenMegabytes << "MB written";
+		if (seconds > 0.0)
+		{
+			std::cout << " (" << writtenMegabytes / seconds << "MB/s)";
+		}
+		std::cout << "; the render thread spent " << renderThreadMicroseconds / encoded << "us per captured frame on it" << std::endl;
+	}
+}
+
+void FrameCapture::destroy()
+{
+	finish();
+
+	for (Slot& slot : slots)
+	{
+		allocator.destroyBuffer(slot.buffer);
+	}
+	slots.clear();
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CaptureEncoder.h"
+#include "MemoryAllocator.h"
+
+// Streams rendered frames to disk without stalling the frame loop. Each captured frame is
+// copied into one of a ring of persistently mapped, host cached readback buffers as part of
+// its own command buffer. Once that submission's fence has signaled, which the frame loop
+// waits for anyway before reusing its FrameContext, the buffer goes to a worker thread that
+// converts and writes it out and then hands the slot back. Nothing on the render thread ever
+// waits for the GPU or the disk: when every slot is still in flight or being encoded, the
+// frame simply isn't captured, and logStats() says how many were dropped that way.
+class FrameCapture
+{
+public:
+	// slotCount buffers of extent, in format, which supportsFormat() must accept. The output
+	// kind follows path's extension (see captureFormatFromPath). Throws if it can't be created.
+	FrameCapture(vk::Device device, MemoryAllocator& allocator, vk::Format format, vk::Extent2D extent, uint32_t slotCount, const std::string& path, CaptureFormat captureFormat);
+
+	// 8-bit RGBA and BGRA, linear or sRGB: what swapchains and our headless targets use
+	static bool supportsFormat(vk::Format format);
+
+	// Picks a free slot for frame, or returns -1 (and counts the frame as skipped) when none is
+	// free or extent is no longer the size the ring was made for.
+	int32_t begin(uint64_t frame, vk::Extent2D extent);
+
+	// Copies image, which must be in eTransferSrcOptimal, into slot and makes the copy visible
+	// to the host once the command buffer's fence signals.
+	void record(vk::CommandBuffer commandBuffer, vk::Image image, int32_t slot) const;
+
+	// Hands every slot filled by frame or earlier to the encoder. Only once the fence of frame's
+	// submission has signaled.
+	void complete(uint64_t frame);
+
+	// Encodes whatever has been completed, then stops the worker
+	void finish();
+
+	void logStats(double seconds) const;
+	void destroy();
+
+private:
+	enum class SlotState
+	{
+		Free,
+		Recorded,	// copy submitted, fence not yet seen
+		Queued,		// waiting for the worker
+		Encoding
+	};
+
+	struct Slot
+	{
+		Allocation* buffer = nullptr;
+		SlotState state = SlotState::Free;
+		uint64_t frame = 0;
+	};
+
+	void workerMain();
+
+	vk::Device device;
+	MemoryAllocator& allocator;
+	vk::Extent2D extent;
+	std::string path;
+	CaptureEncoder encoder;
+
+	std::vector<Slot> slots;
+	std::deque<uint32_t> queue;
+	std::thread worker;
+	bool quit = false;
+	mutable std::mutex mutex;
+	std::condition_variable workReady;
+
+	// Render thread only
+	uint64_t skippedBusy = 0;
+	uint64_t skippedResized = 0;
+	double renderThreadMicroseconds = 0.0;
+
+	// Worker, read under mutex
+	uint64_t captured = 0;
+	uint64_t failed = 0;
+	double encodeMilliseconds = 0.0;
+};
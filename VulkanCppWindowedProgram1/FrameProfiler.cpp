@@ -0,0 +1,240 @@
+#include "FrameProfiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	struct Stage
+	{
+		const char* name;
+		double FrameRecord::* field;
+	};
+
+	const Stage stages[] = {
+		{ "frame", &FrameRecord::cpuFrameMs },
+		{ "acquire", &FrameRecord::acquireMs },
+		{ "record", &FrameRecord::recordMs },
+		{ "submit", &FrameRecord::submitMs },
+		{ "present", &FrameRecord::presentMs },
+		{ "gpu", &FrameRecord::gpuMs },
+	};
+
+	std::string jsonString(const std::string& text)
+	{
+		std::string quoted = "\"";
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				quoted += '\\';
+			}
+			if (static_cast<unsigned char>(c) >= 0x20)
+			{
+				quoted += c;
+			}
+		}
+		return quoted + "\"";
+	}
+}
+
+FrameProfiler::FrameProfiler(size_t windowSize, bool keepTrace)
+	: windowSize((std::max)(windowSize, size_t(1)))
+	, keepTrace(keepTrace)
+{
+	window.reserve(this->windowSize);
+}
+
+FrameRecord& FrameProfiler::beginFrame(uint64_t frame)
+{
+	frameStart = Clock::now();
+
+	FrameRecord record;
+	record.frame = frame;
+
+	// A frame that was abandoned (e.g. its swapchain went out of date) restarts in the same slot
+	if (!window.empty() && window[next].frame == frame)
+	{
+		window[next] = record;
+	}
+	else if (window.size() < windowSize)
+	{
+		window.push_back(record);
+		next = window.size() - 1;
+	}
+	else
+	{
+		next = (next + 1) % windowSize;
+		if (keepTrace)
+		{
+			// The oldest record is complete by now (or never will be)
+			trace.push_back(window[next]);
+		}
+		window[next] = record;
+	}
+
+	return window[next];
+}
+
+void FrameProfiler::endFrame()
+{
+	window[next].cpuFrameMs = millisecondsSince(frameStart);
+}
+
+void FrameProfiler::setGpuTime(uint64_t frame, double milliseconds)
+{
+	FrameRecord* record = find(frame);
+	if (record)
+	{
+		record->gpuMs = milliseconds;
+	}
+}
+
+FrameRecord* FrameProfiler::find(uint64_t frame)
+{
+	if (window.empty())
+	{
+		return nullptr;
+	}
+
+	uint64_t newest = window[next].frame;
+	if (frame > newest || newest - frame >= window.size())
+	{
+		return nullptr;
+	}
+
+	size_t index = (next + window.size() - static_cast<size_t>(newest - frame)) % window.size();
+	return window[index].frame == frame ? &window[index] : nullptr;
+}
+
+Percentiles FrameProfiler::percentiles(double FrameRecord::* field, uint64_t firstFrame) const
+{
+	std::vector<double> values;
+	values.reserve(window.size());
+	for (const auto& record : window)
+	{
+		if (record.frame >= firstFrame && record.*field >= 0.0)
+		{
+			values.push_back(record.*field);
+		}
+	}
+
+	Percentiles result;
+	if (values.empty())
+	{
+		return result;
+	}
+
+	std::sort(values.begin(), values.end());
+	auto at = [&values](double p) { return values[static_cast<size_t>(p * (values.size() - 1))]; };
+	result.p50 = at(0.50);
+	result.p95 = at(0.95);
+	result.p99 = at(0.99);
+	return result;
+}
+
+std::string FrameProfiler::summary() const
+{
+	std::ostringstream out;
+	out.precision(3);
+	out << std::fixed;
+	for (const auto& stage : stages)
+	{
+		Percentiles p = percentiles(stage.field);
+		out << stage.name << " " << p.p50 << "/" << p.p95 << "/" << p.p99 << "ms  ";
+	}
+	return out.str();
+}
+
+bool FrameProfiler::exportTrace(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// The window still holds the most recent frames, oldest first starting after `next`
+	std::vector<FrameRecord> records = trace;
+	for (size_t i = 1; i <= window.size(); ++i)
+	{
+		records.push_back(window[(next + i) % window.size()]);
+	}
+
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+	if (json)
+	{
+		file << "[\n";
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			const auto& r = records[i];
+			file << "  {\"frame\": " << r.frame
+				<< ", \"acquireMs\": " << r.acquireMs
+				<< ", \"recordMs\": " << r.recordMs
+				<< ", \"submitMs\": " << r.submitMs
+				<< ", \"presentMs\": " << r.presentMs
+				<< ", \"cpuFrameMs\": " << r.cpuFrameMs
+				<< ", \"gpuMs\": " << r.gpuMs << "}"
+				<< (i + 1 < records.size() ? ",\n" : "\n");
+		}
+		file << "]\n";
+	}
+	else
+	{
+		file << "frame,acquireMs,recordMs,submitMs,presentMs,cpuFrameMs,gpuMs\n";
+		for (const auto& r : records)
+		{
+			file << r.frame << "," << r.acquireMs << "," << r.recordMs << "," << r.submitMs << "," << r.presentMs << "," << r.cpuFrameMs << "," << r.gpuMs << "\n";
+		}
+	}
+
+	return true;
+}
+
+bool FrameProfiler::exportReport(const std::string& path, const std::vector<std::pair<std::string, std::string>>& labels, uint64_t frames, double seconds) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file << "{\n";
+	for (const auto& label : labels)
+	{
+		file << "  " << jsonString(label.first) << ": " << jsonString(label.second) << ",\n";
+	}
+	file << "  \"frames\": " << frames << ",\n"
+		<< "  \"seconds\": " << seconds << ",\n"
+		<< "  \"fps\": " << (seconds > 0.0 ? frames / seconds : 0.0) << ",\n"
+		<< "  \"sampleFrames\": " << window.size() << ",\n"
+		<< "  \"stages\": {\n";
+
+	for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i)
+	{
+		const Stage& stage = stages[i];
+		file << "    " << jsonString(stage.name) << ": ";
+
+		// GPU times stay negative on queues without timestamps
+		bool sampled = false;
+		for (const auto& record : window)
+		{
+			sampled = sampled || record.*stage.field >= 0.0;
+		}
+
+		if (sampled)
+		{
+			Percentiles p = percentiles(stage.field);
+			file << "{\"p50\": " << p.p50 << ", \"p95\": " << p.p95 << ", \"p99\": " << p.p99 << "}";
+		}
+		else
+		{
+			file << "null";
+		}
+		file << (i + 1 < sizeof(stages) / sizeof(stages[0]) ? ",\n" : "\n");
+	}
+
+	file << "  }\n}\n";
+	return true;
+}
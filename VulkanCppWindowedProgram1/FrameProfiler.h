@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Timing for a single frame. Stage times are CPU milliseconds; gpuMs is filled in
+// later, once the frame's timestamp queries have been read back.
+struct FrameRecord
+{
+	uint64_t frame = 0;
+	double acquireMs = 0.0;
+	double recordMs = 0.0;
+	double submitMs = 0.0;
+	double presentMs = 0.0;
+	double cpuFrameMs = 0.0;
+	double gpuMs = -1.0;
+};
+
+struct Percentiles
+{
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+};
+
+// Collects per-frame records, keeps rolling percentiles over the most recent frames
+// and optionally keeps every record for a CSV/JSON trace.
+class FrameProfiler
+{
+public:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	explicit FrameProfiler(size_t windowSize = 1000, bool keepTrace = false);
+
+	static double millisecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	FrameRecord& beginFrame(uint64_t frame);
+	void endFrame();
+
+	// GPU results arrive a few frames late; frames that already left the window are dropped.
+	void setGpuTime(uint64_t frame, double milliseconds);
+
+	// Over the frames in the window, or only those numbered firstFrame and later
+	Percentiles percentiles(double FrameRecord::* field, uint64_t firstFrame = 0) const;
+
+	std::string summary() const;
+
+	// Writes the trace as CSV or JSON depending on the file extension.
+	bool exportTrace(const std::string& path) const;
+
+	// Writes a JSON summary of a run: the labels as strings, the frame count, wall time and
+	// frame rate, then p50/p95/p99 of every stage over the frames still in the window.
+	bool exportReport(const std::string& path, const std::vector<std::pair<std::string, std::string>>& labels, uint64_t frames, double seconds) const;
+
+private:
+	FrameRecord* find(uint64_t frame);
+
+	std::vector<FrameRecord> window;
+	size_t windowSize;
+	size_t next = 0;
+	bool keepTrace;
+	std::vector<FrameRecord> trace;
+	Clock::time_point frameStart;
+};
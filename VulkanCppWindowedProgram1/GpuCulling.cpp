@@ -0,0 +1,74 @@
+#include "GpuCulling.h"
+
+#include <algorithm>
+
+namespace
+{
+	const uint32_t localSize = 256;
+
+	// Matches QuadInstance in main.cpp and in the shader
+	const vk::DeviceSize instanceSize = 2 * 4 * sizeof(float);
+
+	struct CullParams
+	{
+		float camera[4];
+		uint32_t count;
+	};
+}
+
+GpuCulling::GpuCulling(vk::Device device, MemoryAllocator& allocator, PipelineCache& pipelineCache, DescriptorLayoutCache& layouts, vk::ShaderModule shader, uint32_t maxInstances, uint32_t indexCount)
+	: device(device), allocator(allocator), maxInstances(maxInstances), indexCount(indexCount)
+{
+	pipeline = createComputePipeline(device, pipelineCache, layouts, shader, 3, sizeof(CullParams));
+
+	visible = allocator.createBuffer(maxInstances * instanceSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer, MemoryUsage::GpuOnly);
+	indirect = allocator.createBuffer(sizeof(vk::DrawIndexedIndirectCommand), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer, MemoryUsage::GpuOnly);
+}
+
+void GpuCulling::record(vk::CommandBuffer commandBuffer, DescriptorAllocator& descriptors, vk::Buffer source, uint32_t count, const float camera[4])
+{
+	count = (std::min)(count, maxInstances);
+
+	// Start from an empty draw; the shader counts the survivors into instanceCount
+	vk::DrawIndexedIndirectCommand emptyDraw = vk::DrawIndexedIndirectCommand(indexCount, 0, 0, 0, 0);
+	commandBuffer.updateBuffer(indirect->buffer, 0, sizeof(emptyDraw), &emptyDraw);
+
+	vk::MemoryBarrier resetBarrier = vk::MemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), resetBarrier, nullptr, nullptr);
+
+	vk::DescriptorSet descriptorSet = descriptors.allocate(pipeline.setLayout);
+
+	vk::DescriptorBufferInfo bufferInfos[] = {
+		vk::DescriptorBufferInfo(source, 0, VK_WHOLE_SIZE),
+		vk::DescriptorBufferInfo(visible->buffer, 0, VK_WHOLE_SIZE),
+		vk::DescriptorBufferInfo(indirect->buffer, 0, VK_WHOLE_SIZE),
+	};
+
+	vk::WriteDescriptorSet write = vk::WriteDescriptorSet()
+		.setDstSet(descriptorSet)
+		.setDstBinding(0)
+		.setDescriptorCount(3)
+		.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+		.setPBufferInfo(bufferInfos);
+
+	device.updateDescriptorSets(write, nullptr);
+
+	CullParams params;
+	std::copy(camera, camera + 4, params.camera);
+	params.count = count;
+
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.pipeline);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.layout, 0, descriptorSet, nullptr);
+	commandBuffer.pushConstants(pipeline.layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+	commandBuffer.dispatch(dispatchSize(count, localSize), 1, 1);
+}
+
+void GpuCulling::destroy()
+{
+	allocator.destroyBuffer(visible);
+	allocator.destroyBuffer(indirect);
+	destroyComputePipeline(device, pipeline);
+}
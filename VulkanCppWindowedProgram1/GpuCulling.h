@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+
+#include "ComputePipeline.h"
+#include "Descriptors.h"
+#include "MemoryAllocator.h"
+#include "PipelineCache.h"
+
+// Frustum culls quad instances on the GPU. A compute pass tests every instance's bounds
+// against the view, compacts the survivors into a visible instance buffer and writes their
+// number into an indexed indirect draw, so the CPU records the same handful of commands no
+// matter how many instances there are.
+class GpuCulling
+{
+public:
+	GpuCulling(vk::Device device, MemoryAllocator& allocator, PipelineCache& pipelineCache, DescriptorLayoutCache& layouts, vk::ShaderModule shader, uint32_t maxInstances, uint32_t indexCount);
+
+	// Records the cull of count QuadInstances from source, viewed through camera (xy center,
+	// z zoom). Must be recorded outside a render pass, on a queue that draws the result. Only
+	// the barrier between clearing and counting is recorded here; ordering against the draws on
+	// either side is up to the caller (the render graph pass that wraps this declares it).
+	// The descriptor set comes from descriptors, which must outlive the command buffer's use.
+	void record(vk::CommandBuffer commandBuffer, DescriptorAllocator& descriptors, vk::Buffer source, uint32_t count, const float camera[4]);
+
+	// Bind as the instance buffer and draw with drawIndexedIndirect(indirectBuffer(), 0, 1, ...)
+	vk::Buffer visibleBuffer() const { return visible->buffer; }
+	vk::Buffer indirectBuffer() const { return indirect->buffer; }
+
+	void destroy();
+
+private:
+	vk::Device device;
+	MemoryAllocator& allocator;
+	uint32_t maxInstances;
+	uint32_t indexCount;
+
+	ComputePipeline pipeline;
+
+	Allocation* visible;
+	Allocation* indirect;
+};
@@ -0,0 +1,335 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	// Which JobSystem, and which of its slots, the current thread is a worker of
+	thread_local const JobSystem* workerOf = nullptr;
+	thread_local uint32_t workerSlot = 0;
+
+	// Minutes of per-frame jobs; any after that are counted but not kept
+	const size_t maxTraceEvents = 1 << 20;
+
+	void writeJsonString(std::ostream& out, const std::string& text)
+	{
+		out << '"';
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out << '\\';
+			}
+			if (static_cast<unsigned char>(c) >= 0x20)
+			{
+				out << c;
+			}
+		}
+		out << '"';
+	}
+}
+
+JobGraph::Job JobGraph::add(const std::string& name, std::function<void()> work)
+{
+	nodes.emplace_back();
+	Node& node = nodes.back();
+	node.graph = this;
+	node.name = name;
+	node.work = std::move(work);
+	return static_cast<Job>(nodes.size() - 1);
+}
+
+void JobGraph::precede(Job before, Job after)
+{
+	nodes[before].successors.push_back(after);
+	++nodes[after].predecessors;
+}
+
+JobSystem::JobSystem(uint32_t workerCount)
+	: workerCount(workerCount ? workerCount : (std::max)(1u, std::thread::hardware_concurrency()) - 1)
+	, start(Clock::now())
+{
+	slots.resize(this->workerCount + 1);
+	for (uint32_t slot = 0; slot < this->workerCount; ++slot)
+	{
+		workers.emplace_back(&JobSystem::workerMain, this, slot);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	destroy();
+}
+
+uint32_t JobSystem::currentSlot() const
+{
+	return workerOf == this ? workerSlot : workerCount;
+}
+
+void JobSystem::submit(JobGraph& graph)
+{
+	if (graph.nodes.empty())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(graph.errorMutex);
+		graph.error = nullptr;
+	}
+	graph.unfinished = static_cast<uint32_t>(graph.nodes.size());
+	for (auto& node : graph.nodes)
+	{
+		node.waiting = node.predecessors;
+		node.skipped = false;
+	}
+
+	uint32_t slot = currentSlot();
+	for (auto& node : graph.nodes)
+	{
+		if (node.predecessors == 0)
+		{
+			push(slot, &node);
+		}
+	}
+}
+
+void JobSystem::push(uint32_t slot, JobGraph::Node* node)
+{
+	{
+		std::lock_guard<std::mutex> lock(slots[slot].mutex);
+		slots[slot].jobs.push_back(node);
+	}
+
+	// Counted only once it can be found, so a thread that sees the count finds the job
+	++queued;
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+	}
+	wakeup.notify_one();
+}
+
+JobGraph::Node* JobSystem::take(uint32_t slot)
+{
+	if (queued == 0)
+	{
+		return nullptr;
+	}
+
+	{
+		Slot& own = slots[slot];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.jobs.empty())
+		{
+			JobGraph::Node* node = own.jobs.back();
+			own.jobs.pop_back();
+			--queued;
+			return node;
+		}
+	}
+
+	// Steal the oldest job of the next slot that has one
+	for (size_t i = 1; i < slots.size(); ++i)
+	{
+		Slot& victim = slots[(slot + i) % slots.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.jobs.empty())
+		{
+			JobGraph::Node* node = victim.jobs.front();
+			victim.jobs.pop_front();
+			--queued;
+			++slots[slot].stolen;
+			return node;
+		}
+	}
+	return nullptr;
+}
+
+void JobSystem::execute(uint32_t slot, JobGraph::Node* node)
+{
+	JobGraph& graph = *node->graph;
+
+	// A job whose predecessor failed would run on whatever half-done state it left, so it
+	// doesn't run at all; it still counts as finished and passes the failure on
+	bool failed = node->skipped;
+	if (!failed)
+	{
+		runWork(slot, node, failed);
+	}
+
+	for (JobGraph::Job successor : node->successors)
+	{
+		JobGraph::Node& next = graph.nodes[successor];
+		if (failed)
+		{
+			// Ordered before the decrement, so whoever takes the count to zero sees it
+			next.skipped = true;
+		}
+		if (--next.waiting == 0)
+		{
+			push(slot, &next);
+		}
+	}
+
+	// The graph may be gone as soon as its last job is counted, so nothing touches it after
+	if (--graph.unfinished == 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		wakeup.notify_all();
+	}
+}
+
+void JobSystem::runWork(uint32_t slot, JobGraph::Node* node, bool& failed)
+{
+	Clock::time_point begin = Clock::now();
+	try
+	{
+		node->work();
+	}
+	catch (...)
+	{
+		failed = true;
+
+		std::lock_guard<std::mutex> lock(node->graph->errorMutex);
+		if (!node->graph->error)
+		{
+			node->graph->error = std::current_exception();
+		}
+	}
+	Clock::time_point end = Clock::now();
+
+	Slot& own = slots[slot];
+	++own.executed;
+	own.busyMilliseconds += std::chrono::duration<double, std::milli>(end - begin).count();
+
+	if (tracing)
+	{
+		std::lock_guard<std::mutex> lock(traceMutex);
+		if (trace.size() < maxTraceEvents)
+		{
+			TraceEvent event;
+			event.name = &*traceNames.insert(node->name).first;
+			event.thread = slot;
+			event.startMicroseconds = std::chrono::duration<double, std::micro>(begin - start).count();
+			event.durationMicroseconds = std::chrono::duration<double, std::micro>(end - begin).count();
+			trace.push_back(event);
+		}
+		else
+		{
+			++droppedTraceEvents;
+		}
+	}
+}
+
+void JobSystem::wait(JobGraph& graph)
+{
+	uint32_t slot = currentSlot();
+	while (graph.unfinished != 0)
+	{
+		if (JobGraph::Node* node = take(slot))
+		{
+			execute(slot, node);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeup.wait(lock, [&] { return graph.unfinished == 0 || queued != 0; });
+	}
+
+	std::lock_guard<std::mutex> lock(graph.errorMutex);
+	if (graph.error)
+	{
+		std::exception_ptr error = graph.error;
+		graph.error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void JobSystem::workerMain(uint32_t slot)
+{
+	workerOf = this;
+	workerSlot = slot;
+
+	for (;;)
+	{
+		if (JobGraph::Node* node = take(slot))
+		{
+			execute(slot, node);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeup.wait(lock, [this] { return quit || queued != 0; });
+		if (quit)
+		{
+			return;
+		}
+	}
+}
+
+bool JobSystem::exportTrace(const std::string& path) const
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+
+	// Complete ("X") events, one track per thread; the last track is the thread that called run()
+	file << "{\"traceEvents\": [\n";
+	for (uint32_t slot = 0; slot < slots.size(); ++slot)
+	{
+		file << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << slot
+			<< ", \"args\": {\"name\": \"" << (slot < workerCount ? "worker " + std::to_string(slot) : std::string("main")) << "\"}},\n";
+	}
+	for (size_t i = 0; i < trace.size(); ++i)
+	{
+		const TraceEvent& event = trace[i];
+		file << "  {\"name\": ";
+		writeJsonString(file, *event.name);
+		file << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << event.thread
+			<< ", \"ts\": " << event.startMicroseconds << ", \"dur\": " << event.durationMicroseconds << "}"
+			<< (i + 1 < trace.size() ? ",\n" : "\n");
+	}
+	file << "], \"displayTimeUnit\": \"ms\"}\n";
+
+	return file.good();
+}
+
+void JobSystem::logStats() const
+{
+	std::cout << "job system: " << workerCount << " workers plus the main thread" << std::endl;
+	for (uint32_t slot = 0; slot < slots.size(); ++slot)
+	{
+		const Slot& s = slots[slot];
+		std::cout << "\t" << (slot < workerCount ? "Worker " + std::to_string(slot) : std::string("Main")) << ": "
+			<< s.executed << " jobs (" << s.stolen << " stolen), " << s.busyMilliseconds << "ms busy" << std::endl;
+	}
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+	if (droppedTraceEvents)
+	{
+		std::cout << "\t" << droppedTraceEvents << " jobs not traced, the trace was full" << std::endl;
+	}
+}
+
+void JobSystem::destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		quit = true;
+	}
+	wakeup.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
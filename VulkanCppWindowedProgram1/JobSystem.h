@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class JobSystem;
+
+// A set of jobs and the order between them. Build it once, then hand it to JobSystem::run as
+// often as you like; every run executes each job once, after all of its predecessors. Don't
+// change a graph while it is running.
+class JobGraph
+{
+public:
+	typedef uint32_t Job;
+
+	JobGraph() = default;
+	JobGraph(const JobGraph&) = delete;
+	JobGraph& operator=(const JobGraph&) = delete;
+
+	Job add(const std::string& name, std::function<void()> work);
+
+	// after doesn't start until before has finished
+	void precede(Job before, Job after);
+
+	size_t size() const { return nodes.size(); }
+
+private:
+	friend class JobSystem;
+
+	struct Node
+	{
+		JobGraph* graph;
+		std::string name;
+		std::function<void()> work;
+		std::vector<Job> successors;
+		uint32_t predecessors = 0;
+		std::atomic<uint32_t> waiting{ 0 };
+		std::atomic<bool> skipped{ false };	// a predecessor threw or was skipped, so this doesn't run
+	};
+
+	std::deque<Node> nodes;
+	std::atomic<uint32_t> unfinished{ 0 };
+
+	std::mutex errorMutex;
+	std::exception_ptr error;
+};
+
+// Runs JobGraphs on a fixed set of worker threads. Every worker has a deque of its own: jobs
+// it makes ready go on the back, it takes its next job from the back too (the data that job
+// needs is likely still in its cache), and a worker that runs dry steals from the front of
+// someone else's. The thread that calls run() works through the graph alongside the workers
+// instead of sleeping. A job becomes ready when the counter of predecessors it is waiting for
+// reaches zero.
+//
+// Jobs should be short and never block on each other; anything long-running, such as
+// background pipeline compiles, belongs on a pool of its own so it can't hold up a frame.
+//
+// With tracing on, every job's start and end is recorded; exportTrace writes them in the
+// Chrome trace event format (chrome://tracing, Perfetto).
+class JobSystem
+{
+public:
+	// workerCount threads besides the caller. 0 picks one per hardware thread, less the caller's.
+	explicit JobSystem(uint32_t workerCount = 0);
+	~JobSystem();
+
+	// Starts the jobs with no predecessors and returns
+	void submit(JobGraph& graph);
+
+	// Runs jobs on this thread until every job of graph has finished. Rethrows the first
+	// exception a job threw; the jobs that (transitively) come after a job that threw are skipped.
+	void wait(JobGraph& graph);
+
+	void run(JobGraph& graph) { submit(graph); wait(graph); }
+
+	// Workers plus the thread calling run()
+	uint32_t threadCount() const { return workerCount + 1; }
+
+	void setTracing(bool enabled) { tracing = enabled; }
+	bool exportTrace(const std::string& path) const;
+
+	void logStats() const;
+	void destroy();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Slot
+	{
+		std::mutex mutex;
+		std::deque<JobGraph::Node*> jobs;
+
+		// Only touched by the slot's own thread
+		uint64_t executed = 0;
+		uint64_t stolen = 0;
+		double busyMilliseconds = 0.0;
+	};
+
+	struct TraceEvent
+	{
+		const std::string* name;
+		uint32_t thread;
+		double startMicroseconds;
+		double durationMicroseconds;
+	};
+
+	void workerMain(uint32_t slot);
+	uint32_t currentSlot() const;
+	void push(uint32_t slot, JobGraph::Node* node);
+	JobGraph::Node* take(uint32_t slot);
+	void execute(uint32_t slot, JobGraph::Node* node);
+	void runWork(uint32_t slot, JobGraph::Node* node, bool& failed);
+
+	uint32_t workerCount;
+	std::vector<std::thread> workers;
+
+	// One per worker, then one shared by every other thread
+	std::deque<Slot> slots;
+
+	std::atomic<uint32_t> queued{ 0 };
+	std::mutex sleepMutex;
+	std::condition_variable wakeup;
+	bool quit = false;
+
+	Clock::time_point start;
+	std::atomic<bool> tracing{ false };
+	mutable std::mutex traceMutex;
+	std::set<std::string> traceNames;
+	std::vector<TraceEvent> trace;
+	uint64_t droppedTraceEvents = 0;
+};
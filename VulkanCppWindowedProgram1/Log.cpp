@@ -0,0 +1,467 @@
+#include "Log.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+	uint64_t hashText(const char* text, size_t length)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < length; ++i)
+		{
+			hash = (hash ^ static_cast<uint8_t>(text[i])) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	const char* levelName(LogLevel level)
+	{
+		switch (level)
+		{
+		case LogLevel::Error: return "error";
+		case LogLevel::Warning: return "warning";
+		case LogLevel::Info: return "info";
+		default: return "verbose";
+		}
+	}
+
+	vk::DebugUtilsMessageSeverityFlagsEXT severitiesFor(LogLevel level)
+	{
+		vk::DebugUtilsMessageSeverityFlagsEXT severities = vk::DebugUtilsMessageSeverityFlagBitsEXT::eError;
+		if (level >= LogLevel::Warning)
+		{
+			severities |= vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning;
+		}
+		if (level >= LogLevel::Info)
+		{
+			severities |= vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo;
+		}
+		if (level >= LogLevel::Verbose)
+		{
+			severities |= vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose;
+		}
+		return severities;
+	}
+
+	const char* sourceName(LogSource source)
+	{
+		switch (source)
+		{
+		case LogSource::General: return "general";
+		case LogSource::Validation: return "validation";
+		case LogSource::Performance: return "performance";
+		default: return "program";
+		}
+	}
+}
+
+bool parseLogLevel(const std::string& name, LogLevel& level)
+{
+	const LogLevel levels[] = { LogLevel::Error, LogLevel::Warning, LogLevel::Info, LogLevel::Verbose };
+	for (LogLevel candidate : levels)
+	{
+		if (name == levelName(candidate))
+		{
+			level = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parseLogSources(const std::string& names, uint32_t& sources)
+{
+	const LogSource all[] = { LogSource::Program, LogSource::General, LogSource::Validation, LogSource::Performance };
+
+	uint32_t parsed = 0;
+	size_t begin = 0;
+	while (begin <= names.size())
+	{
+		size_t end = names.find(',', begin);
+		if (end == std::string::npos)
+		{
+			end = names.size();
+		}
+
+		std::string name = names.substr(begin, end - begin);
+		bool known = false;
+		for (LogSource source : all)
+		{
+			if (name == sourceName(source))
+			{
+				parsed |= logSourceBit(source);
+				known = true;
+			}
+		}
+		if (!known)
+		{
+			return false;
+		}
+
+		begin = end + 1;
+	}
+
+	sources = parsed;
+	return true;
+}
+
+Logger::Logger(uint32_t capacity)
+	: enqueuePosition(0)
+	, levelFilter(static_cast<uint32_t>(LogLevel::Info))
+	, sourceFilter(allLogSources)
+	, dropped(0)
+	, scratch(new Record())
+{
+	// Positions are masked into the ring, so it has to be a power of two
+	uint64_t size = 1;
+	while (size < capacity)
+	{
+		size *= 2;
+	}
+	mask = size - 1;
+
+	slots.reset(new Slot[size]);
+	for (uint64_t i = 0; i < size; ++i)
+	{
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	writer = std::thread(&Logger::writerMain, this);
+}
+
+Logger::~Logger()
+{
+	stop();
+}
+
+bool Logger::write(LogLevel level, LogSource source, uint64_t id, const char* text, size_t length)
+{
+	if (!enabled(level, source))
+	{
+		return false;
+	}
+
+	uint64_t position = enqueuePosition.load(std::memory_order_relaxed);
+	Slot* slot;
+	for (;;)
+	{
+		slot = &slots[position & mask];
+		uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		int64_t difference = static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+
+		if (difference == 0)
+		{
+			// Free for this position; claim it unless another producer got there first
+			if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			// Still holds a message from a lap ago: the ring is full
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		else
+		{
+			position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+	}
+
+	Record& record = slot->record;
+	record.level = level;
+	record.source = source;
+	record.id = id;
+	record.truncated = length > maxMessageLength;
+	record.length = static_cast<uint32_t>(record.truncated ? maxMessageLength : length);
+	std::memcpy(record.text, text, record.length);
+
+	slot->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+bool Logger::pop(Record& record)
+{
+	Slot& slot = slots[dequeuePosition & mask];
+	if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+	{
+		return false;
+	}
+
+	record.level = slot.record.level;
+	record.source = slot.record.source;
+	record.id = slot.record.id;
+	record.length = slot.record.length;
+	record.truncated = slot.record.truncated;
+	std::memcpy(record.text, slot.record.text, record.length);
+
+	// Free for the producer one lap later
+	slot.sequence.store(dequeuePosition + mask + 1, std::memory_order_release);
+	++dequeuePosition;
+	return true;
+}
+
+void Logger::flush()
+{
+	uint64_t target = enqueuePosition.load(std::memory_order_acquire);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	wake.notify_one();
+	drained.wait(lock, [&]() { return processed >= target || quit; });
+}
+
+void Logger::stop()
+{
+	if (!writer.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_one();
+	writer.join();
+}
+
+void Logger::writerMain()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		bool finished = quit;
+		lock.unlock();
+
+		bool wrote = false;
+		while (pop(*scratch))
+		{
+			emit(*scratch);
+			wrote = true;
+		}
+		if (wrote)
+		{
+			std::fflush(stdout);
+			std::fflush(stderr);
+		}
+
+		lock.lock();
+		processed = dequeuePosition;
+		drained.notify_all();
+
+		// Quit was seen before the last drain, so nothing written before stop() is left behind
+		if (finished)
+		{
+			break;
+		}
+
+		// Producers never signal, so they never make a system call; poll instead
+		wake.wait_for(lock, std::chrono::milliseconds(5));
+	}
+	lock.unlock();
+
+	for (auto& entry : ids)
+	{
+		reportRepeats(entry.first, entry.second);
+		reportSuppressed(entry.first, entry.second);
+	}
+
+	uint64_t lost = dropped.load(std::memory_order_relaxed);
+	if (duplicates > 0 || rateLimited > 0 || lost > 0)
+	{
+		output(LogLevel::Info, LogSource::Program, "log: " + std::to_string(written) + " messages written, " + std::to_string(duplicates) + " repeats folded, "
+			+ std::to_string(rateLimited) + " rate limited, " + std::to_string(lost) + " dropped with the ring full");
+	}
+	std::fflush(stdout);
+	std::fflush(stderr);
+}
+
+void Logger::emit(const Record& record)
+{
+	std::string text(record.text, record.length);
+	if (record.truncated)
+	{
+		text += "...";
+	}
+
+	if (record.id != 0)
+	{
+		IdState& state = ids[record.id];
+
+		uint64_t hash = hashText(text.data(), text.size());
+		if (hash == state.lastHash)
+		{
+			++state.repeats;
+			++duplicates;
+			return;
+		}
+		reportRepeats(record.id, state);
+		state.lastHash = hash;
+
+		auto now = std::chrono::steady_clock::now();
+		if (now - state.windowStart >= std::chrono::seconds(1))
+		{
+			reportSuppressed(record.id, state);
+			state.windowStart = now;
+			state.inWindow = 0;
+		}
+
+		if (rateLimit > 0 && state.inWindow >= rateLimit)
+		{
+			++state.suppressed;
+			++rateLimited;
+			return;
+		}
+		++state.inWindow;
+	}
+
+	output(record.level, record.source, text);
+	++written;
+}
+
+void Logger::output(LogLevel level, LogSource source, const std::string& line)
+{
+	std::string formatted;
+	if (source != LogSource::Program)
+	{
+		formatted = std::string(sourceName(source)) + " " + levelName(level) + ": ";
+	}
+	else if (level == LogLevel::Error || level == LogLevel::Warning)
+	{
+		formatted = std::string(levelName(level)) + ": ";
+	}
+	formatted += line;
+	formatted += '\n';
+
+	// Only the program's own ordinary output goes to stdout
+	bool toStdout = source == LogSource::Program && level != LogLevel::Error && level != LogLevel::Warning;
+	std::fwrite(formatted.data(), 1, formatted.size(), toStdout ? stdout : stderr);
+}
+
+void Logger::reportRepeats(uint64_t id, IdState& state)
+{
+	if (state.repeats > 0)
+	{
+		output(LogLevel::Info, LogSource::Program, "log: previous message (id " + std::to_string(id) + ") repeated " + std::to_string(state.repeats) + " more times");
+		state.repeats = 0;
+	}
+}
+
+void Logger::reportSuppressed(uint64_t id, IdState& state)
+{
+	if (state.suppressed > 0)
+	{
+		output(LogLevel::Info, LogSource::Program, "log: suppressed " + std::to_string(state.suppressed) + " messages with id " + std::to_string(id) + " over the rate limit");
+		state.suppressed = 0;
+	}
+}
+
+VKAPI_ATTR VkBool32 VKAPI_CALL Logger::debugCallback(
+	VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+	VkDebugUtilsMessageTypeFlagsEXT messageType,
+	const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
+	void* userData)
+{
+	Logger* logger = static_cast<Logger*>(userData);
+
+	LogLevel level = LogLevel::Verbose;
+	if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+	{
+		level = LogLevel::Error;
+	}
+	else if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+	{
+		level = LogLevel::Warning;
+	}
+	else if (messageSeverity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT)
+	{
+		level = LogLevel::Info;
+	}
+
+	LogSource source = LogSource::General;
+	if (messageType & VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT)
+	{
+		source = LogSource::Validation;
+	}
+	else if (messageType & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT)
+	{
+		source = LogSource::Performance;
+	}
+
+	// Checked before touching the message at all, so filtered messages cost next to nothing
+	if (!logger->enabled(level, source))
+	{
+		return VK_FALSE;
+	}
+
+	const char* text = callbackData->pMessage ? callbackData->pMessage : "";
+	size_t length = std::strlen(text);
+
+	// Messages without an ID (the loader's, for one) are told apart by their name or text
+	uint64_t id = static_cast<uint32_t>(callbackData->messageIdNumber);
+	if (id == 0)
+	{
+		const char* name = callbackData->pMessageIdName;
+		id = name ? hashText(name, std::strlen(name)) : hashText(text, length);
+	}
+
+	logger->write(level, source, id, text, length);
+	return VK_FALSE;
+}
+
+DebugMessenger::DebugMessenger(vk::Instance instance, Logger& logger, bool debugUtilsEnabled)
+	: instance(instance)
+	, dispatch(instance)
+	, logger(logger)
+	, enabled(debugUtilsEnabled)
+{
+	// The loader only resolves the messenger functions when the extension is enabled
+	if (enabled)
+	{
+		messenger = create();
+	}
+}
+
+void DebugMessenger::setLevel(LogLevel level)
+{
+	if (level == logger.level())
+	{
+		return;
+	}
+
+	logger.setLevel(level);
+	if (!enabled)
+	{
+		return;
+	}
+
+	// The new messenger goes in before the old one goes, so nothing is missed in between
+	vk::DebugUtilsMessengerEXT replacement = create();
+	instance.destroyDebugUtilsMessengerEXT(messenger, nullptr, dispatch);
+	messenger = replacement;
+}
+
+void DebugMessenger::destroy()
+{
+	if (!messenger)
+	{
+		return;
+	}
+
+	instance.destroyDebugUtilsMessengerEXT(messenger, nullptr, dispatch);
+	messenger = vk::DebugUtilsMessengerEXT();
+}
+
+vk::DebugUtilsMessengerEXT DebugMessenger::create() const
+{
+	// Every type is asked for; the logger filters sources itself, and those can change freely
+	vk::DebugUtilsMessengerCreateInfoEXT debugInfo = vk::DebugUtilsMessengerCreateInfoEXT()
+		.setMessageSeverity(severitiesFor(logger.level()))
+		.setMessageType(vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral | vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance | vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation)
+		.setPfnUserCallback(Logger::debugCallback)
+		.setPUserData(&logger);
+
+	return instance.createDebugUtilsMessengerEXT(debugInfo, nullptr, dispatch);
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// In increasing verbosity; a logger set to a level writes that level and everything above it
+enum class LogLevel
+{
+	Error,
+	Warning,
+	Info,
+	Verbose
+};
+
+// Where a message came from. The debug messenger's message types each get their own, so they
+// can be filtered separately from the program's own output.
+enum class LogSource
+{
+	Program,
+	General,
+	Validation,
+	Performance
+};
+
+const uint32_t allLogSources = 0xf;
+
+inline uint32_t logSourceBit(LogSource source) { return 1u << static_cast<uint32_t>(source); }
+
+// Accepts "error", "warning", "info" or "verbose". Returns false for anything else.
+bool parseLogLevel(const std::string& name, LogLevel& level);
+
+// Accepts a comma separated list of "program", "general", "validation" and "performance".
+bool parseLogSources(const std::string& names, uint32_t& sources);
+
+// Takes messages from any thread and writes them from a thread of its own. write() copies the
+// message into a fixed ring of slots with one compare-and-swap, so it never locks, allocates or
+// waits on the console; that makes it cheap enough to call from inside the driver, which is
+// where the debug messenger calls us. Messages longer than a slot are truncated, and if the
+// writer falls behind until the ring is full, new messages are dropped and counted.
+//
+// Messages with a nonzero id (the debug messenger's message ID) are also deduplicated and
+// rate limited on the writer thread: an exact repeat of the previous message with that id is
+// only counted, and past the rate limit each id is quiet until the next second.
+class Logger
+{
+public:
+	static const size_t maxMessageLength = 1024;
+
+	explicit Logger(uint32_t capacity = 1024);
+	~Logger();
+
+	// Filters apply to messages as they are written, so they can change at any time
+	void setLevel(LogLevel level) { levelFilter.store(static_cast<uint32_t>(level), std::memory_order_relaxed); }
+	LogLevel level() const { return static_cast<LogLevel>(levelFilter.load(std::memory_order_relaxed)); }
+	void setSources(uint32_t sources) { sourceFilter.store(sources, std::memory_order_relaxed); }
+
+	// Messages per id per second, 0 for no limit. Only call before messages with ids arrive.
+	void setRateLimit(uint32_t perSecond) { rateLimit = perSecond; }
+
+	bool enabled(LogLevel level, LogSource source) const
+	{
+		return static_cast<uint32_t>(level) <= levelFilter.load(std::memory_order_relaxed)
+			&& (sourceFilter.load(std::memory_order_relaxed) & logSourceBit(source)) != 0;
+	}
+
+	// Safe from any thread. Returns false if the message was filtered out or dropped.
+	bool write(LogLevel level, LogSource source, uint64_t id, const char* text, size_t length);
+	bool write(LogLevel level, const std::string& text) { return write(level, LogSource::Program, 0, text.data(), text.size()); }
+
+	// Waits until everything written so far is out
+	void flush();
+
+	// Writes what is left, then the totals, and stops the writer thread
+	void stop();
+
+	// For VkDebugUtilsMessengerCreateInfoEXT, with the Logger as pUserData
+	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+		VkDebugUtilsMessageTypeFlagsEXT messageType,
+		const VkDebugUtilsMessengerCallbackDataEXT* callbackData,
+		void* userData);
+
+private:
+	struct Record
+	{
+		LogLevel level;
+		LogSource source;
+		uint64_t id;
+		uint32_t length;
+		bool truncated;
+		char text[maxMessageLength];
+	};
+
+	// The writer's own record of each id it has seen
+	struct IdState
+	{
+		std::chrono::steady_clock::time_point windowStart;
+		uint32_t inWindow = 0;
+		uint64_t suppressed = 0;
+		uint64_t lastHash = 0;
+		uint64_t repeats = 0;
+	};
+
+	// A bounded multi-producer queue (Vyukov's): each slot's sequence number says whether it is
+	// free for the producer at that position or full for the consumer
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence;
+		Record record;
+	};
+
+	bool pop(Record& record);
+	void writerMain();
+	void emit(const Record& record);
+	void output(LogLevel level, LogSource source, const std::string& line);
+	void reportRepeats(uint64_t id, IdState& state);
+	void reportSuppressed(uint64_t id, IdState& state);
+
+	std::unique_ptr<Slot[]> slots;
+	uint64_t mask;
+	std::atomic<uint64_t> enqueuePosition;
+	uint64_t dequeuePosition = 0;
+
+	std::atomic<uint32_t> levelFilter;
+	std::atomic<uint32_t> sourceFilter;
+	uint32_t rateLimit = 10;
+
+	std::atomic<uint64_t> dropped;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable drained;
+	uint64_t processed = 0;
+	bool quit = false;
+
+	// Writer thread only
+	std::unique_ptr<Record> scratch;
+	std::unordered_map<uint64_t, IdState> ids;
+	uint64_t written = 0;
+	uint64_t duplicates = 0;
+	uint64_t rateLimited = 0;
+};
+
+// The debug utils messenger feeding a Logger. It only asks for the severities the logger's level
+// lets through, since the driver and layers skip the work of formatting the others; change the
+// level through setLevel() so the messenger is recreated to match. Without VK_EXT_debug_utils
+// enabled on the instance there is no messenger, and setLevel() only changes the logger's level.
+class DebugMessenger
+{
+public:
+	DebugMessenger(vk::Instance instance, Logger& logger, bool debugUtilsEnabled);
+
+	void setLevel(LogLevel level);
+
+	void destroy();
+
+private:
+	vk::DebugUtilsMessengerEXT create() const;
+
+	vk::Instance instance;
+	vk::DispatchLoaderDynamic dispatch;
+	Logger& logger;
+	bool enabled;
+	vk::DebugUtilsMessengerEXT messenger;
+};
+
+// Builds one line with operator<< and writes it when it goes out of scope, if the level is
+// enabled. For the program's own messages; the formatting allocates, unlike Logger::write().
+//
+//	LogLine(logger, LogLevel::Verbose) << "found " << count << " devices";
+class LogLine
+{
+public:
+	LogLine(Logger& logger, LogLevel level)
+		: logger(logger)
+		, level(level)
+		, active(logger.enabled(level, LogSource::Program))
+	{
+	}
+
+	~LogLine()
+	{
+		if (active)
+		{
+			logger.write(level, stream.str());
+		}
+	}
+
+	template<typename T>
+	LogLine& operator<<(const T& value)
+	{
+		if (active)
+		{
+			stream << value;
+		}
+		return *this;
+	}
+
+private:
+	Logger& logger;
+	LogLevel level;
+	bool active;
+	std::ostringstream stream;
+};
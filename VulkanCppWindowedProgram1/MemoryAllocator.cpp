@@ -0,0 +1,884 @@
+#include "MemoryAllocator.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	// Smallest range the buddy allocator hands out
+	const vk::DeviceSize minAllocationSize = 256;
+
+	vk::DeviceSize orderSize(uint32_t order)
+	{
+		return minAllocationSize << order;
+	}
+
+	// A buffer like the one allocation holds, to copy it into
+	vk::BufferCreateInfo replacementInfo(const Allocation& allocation)
+	{
+		return vk::BufferCreateInfo()
+			.setSize(allocation.size)
+			.setUsage(allocation.bufferUsage)
+			.setSharingMode(allocation.bufferFamilies.empty() ? vk::SharingMode::eExclusive : vk::SharingMode::eConcurrent)
+			.setQueueFamilyIndexCount(static_cast<uint32_t>(allocation.bufferFamilies.size()))
+			.setPQueueFamilyIndices(allocation.bufferFamilies.data());
+	}
+
+	// What a memory type must offer for usage wherever it is. The GPU-only usages can make do
+	// with any type (see findMemoryType's last resort); the rest need the CPU to reach it.
+	vk::MemoryPropertyFlags hostAccessFlags(MemoryUsage usage)
+	{
+		switch (usage)
+		{
+		case MemoryUsage::CpuToGpu:
+		case MemoryUsage::CpuOnly:
+			return vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+		case MemoryUsage::GpuToCpu:
+			return vk::MemoryPropertyFlagBits::eHostVisible;
+		default:
+			return vk::MemoryPropertyFlags();
+		}
+	}
+
+	// The copies must land before anyone reads the new buffers
+	void recordMoveBarrier(vk::CommandBuffer commandBuffer)
+	{
+		vk::MemoryBarrier barrier = vk::MemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setDstAccessMask(vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), barrier, nullptr, nullptr);
+	}
+}
+
+struct MemoryBlock
+{
+	vk::DeviceMemory memory;
+	uint8_t* mapped = nullptr;
+	uint32_t memoryType = 0;
+	bool linear = true;
+
+	// Free offsets for each buddy order, order 0 being minAllocationSize
+	std::vector<std::vector<vk::DeviceSize>> freeLists;
+	vk::DeviceSize usedBytes = 0;
+	vk::DeviceSize requestedBytes = 0;
+	uint32_t allocationCount = 0;
+};
+
+MemoryAllocator::MemoryAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize)
+	: physicalDevice(physicalDevice)
+	, device(device)
+	, properties(physicalDevice.getMemoryProperties())
+	, maxAllocationCount(physicalDevice.getProperties().limits.maxMemoryAllocationCount)
+	, nonCoherentAtomSize(physicalDevice.getProperties().limits.nonCoherentAtomSize)
+{
+	// Round the block size up to a power of two so the whole block is one buddy
+	this->blockSize = minAllocationSize;
+	maxOrder = 0;
+	while (this->blockSize < blockSize)
+	{
+		this->blockSize <<= 1;
+		++maxOrder;
+	}
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeBits, MemoryUsage usage) const
+{
+	vk::MemoryPropertyFlags required = hostAccessFlags(usage);
+	vk::MemoryPropertyFlags preferred;
+	vk::MemoryPropertyFlags avoided;
+
+	switch (usage)
+	{
+	case MemoryUsage::GpuOnly:
+		required = vk::MemoryPropertyFlagBits::eDeviceLocal;
+		avoided = vk::MemoryPropertyFlagBits::eHostVisible;
+		break;
+	case MemoryUsage::CpuToGpu:
+		preferred = vk::MemoryPropertyFlagBits::eDeviceLocal;
+		break;
+	case MemoryUsage::CpuOnly:
+		avoided = vk::MemoryPropertyFlagBits::eDeviceLocal;
+		break;
+	case MemoryUsage::GpuToCpu:
+		preferred = vk::MemoryPropertyFlagBits::eHostCached;
+		break;
+	case MemoryUsage::GpuLazy:
+		required = vk::MemoryPropertyFlagBits::eDeviceLocal;
+		preferred = vk::MemoryPropertyFlagBits::eLazilyAllocated;
+		avoided = vk::MemoryPropertyFlagBits::eHostVisible;
+		break;
+	}
+
+	uint32_t bestType = UINT32_MAX;
+	int bestScore = -1;
+	for (uint32_t i = 0; i < properties.memoryTypeCount; ++i)
+	{
+		vk::MemoryPropertyFlags flags = properties.memoryTypes[i].propertyFlags;
+		if (!(typeBits & (1u << i)) || (flags & required) != required)
+		{
+			continue;
+		}
+
+		int score = (preferred && (flags & preferred) == preferred ? 2 : 0) + (avoided && !(flags & avoided) ? 1 : 0);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			bestType = i;
+		}
+	}
+
+	// Integrated GPUs and software rasterizers may only have host visible device memory
+	if (bestType == UINT32_MAX && (usage == MemoryUsage::GpuOnly || usage == MemoryUsage::GpuLazy))
+	{
+		for (uint32_t i = 0; i < properties.memoryTypeCount; ++i)
+		{
+			if (typeBits & (1u << i))
+			{
+				return i;
+			}
+		}
+	}
+
+	if (bestType == UINT32_MAX)
+	{
+		throw std::runtime_error("failed to find a suitable memory type!");
+	}
+
+	return bestType;
+}
+
+uint32_t MemoryAllocator::orderFor(vk::DeviceSize size, vk::DeviceSize alignment) const
+{
+	// Buddies are aligned to their own size, so rounding up to the alignment is enough
+	vk::DeviceSize needed = (std::max)(size, alignment);
+	uint32_t order = 0;
+	while (orderSize(order) < needed)
+	{
+		++order;
+	}
+	return order;
+}
+
+vk::DeviceMemory MemoryAllocator::allocateMemory(vk::DeviceSize size, uint32_t memoryType, void** mapped)
+{
+	vk::MemoryAllocateInfo allocateInfo = vk::MemoryAllocateInfo()
+		.setAllocationSize(size)
+		.setMemoryTypeIndex(memoryType);
+
+	vk::DeviceMemory memory = device.allocateMemory(allocateInfo);
+	++deviceAllocationCount;
+
+	*mapped = nullptr;
+	if (properties.memoryTypes[memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostVisible)
+	{
+		*mapped = device.mapMemory(memory, 0, VK_WHOLE_SIZE);
+	}
+
+	return memory;
+}
+
+MemoryBlock* MemoryAllocator::createBlock(uint32_t memoryType, bool linear)
+{
+	std::unique_ptr<MemoryBlock> block(new MemoryBlock());
+	void* mapped;
+	block->memory = allocateMemory(blockSize, memoryType, &mapped);
+	block->mapped = static_cast<uint8_t*>(mapped);
+	block->memoryType = memoryType;
+	block->linear = linear;
+	block->freeLists.resize(maxOrder + 1);
+	block->freeLists[maxOrder].push_back(0);
+
+	blocks.push_back(std::move(block));
+	return blocks.back().get();
+}
+
+bool MemoryAllocator::allocateFromBlock(MemoryBlock* block, uint32_t order, vk::DeviceSize& offset)
+{
+	uint32_t available = order;
+	while (available <= maxOrder && block->freeLists[available].empty())
+	{
+		++available;
+	}
+
+	if (available > maxOrder)
+	{
+		return false;
+	}
+
+	offset = block->freeLists[available].back();
+	block->freeLists[available].pop_back();
+
+	// Split down to the size we want, keeping the upper halves free
+	while (available > order)
+	{
+		--available;
+		block->freeLists[available].push_back(offset + orderSize(available));
+	}
+
+	block->usedBytes += orderSize(order);
+	++block->allocationCount;
+	return true;
+}
+
+void MemoryAllocator::freeToBlock(MemoryBlock* block, vk::DeviceSize offset, uint32_t order)
+{
+	block->usedBytes -= orderSize(order);
+	--block->allocationCount;
+
+	// Merge with our buddy for as long as it is free too
+	while (order < maxOrder)
+	{
+		vk::DeviceSize buddy = offset ^ orderSize(order);
+		auto& list = block->freeLists[order];
+		auto it = std::find(list.begin(), list.end(), buddy);
+		if (it == list.end())
+		{
+			break;
+		}
+
+		list.erase(it);
+		offset = (std::min)(offset, buddy);
+		++order;
+	}
+
+	block->freeLists[order].push_back(offset);
+}
+
+void MemoryAllocator::invalidate(const Allocation* allocation) const
+{
+	if (properties.memoryTypes[allocation->memoryType].propertyFlags & vk::MemoryPropertyFlagBits::eHostCoherent)
+	{
+		return;
+	}
+
+	// The range has to be whole atoms of the memory object. Blocks are a power of two in size,
+	// so rounding out stays inside them; a dedicated allocation is the whole object anyway.
+	vk::MappedMemoryRange range = vk::MappedMemoryRange()
+		.setMemory(allocation->memory)
+		.setOffset(0)
+		.setSize(VK_WHOLE_SIZE);
+	if (allocation->block)
+	{
+		vk::DeviceSize begin = allocation->offset / nonCoherentAtomSize * nonCoherentAtomSize;
+		vk::DeviceSize end = (allocation->offset + allocation->size + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize;
+		range.setOffset(begin).setSize(end - begin);
+	}
+	device.invalidateMappedMemoryRanges(range);
+}
+
+bool MemoryAllocator::overBudget(uint32_t heap, vk::DeviceSize bytes) const
+{
+	HeapBudget budget = heapBudgetsLocked()[heap];
+	return budget.usage + bytes > budget.budget;
+}
+
+void MemoryAllocator::place(Allocation& allocation, const vk::MemoryRequirements& requirements, MemoryUsage usage, bool linear, bool dedicatedMemory)
+{
+	uint32_t order = orderFor(requirements.size, requirements.alignment);
+	dedicatedMemory = dedicatedMemory || order >= maxOrder;
+
+	uint32_t typeBits = requirements.memoryTypeBits;
+	bool fellBack = false;
+	for (;;)
+	{
+		uint32_t memoryType = findMemoryType(typeBits, usage);
+		uint32_t heap = properties.memoryTypes[memoryType].heapIndex;
+
+		allocation.memoryType = memoryType;
+		allocation.order = order;
+		allocation.block = nullptr;
+		allocation.offset = 0;
+
+		// Room in a block we already have doesn't cost any budget
+		if (!dedicatedMemory)
+		{
+			for (const auto& block : blocks)
+			{
+				if (block->memoryType == memoryType && block->linear == linear && allocateFromBlock(block.get(), order, allocation.offset))
+				{
+					allocation.block = block.get();
+					break;
+				}
+			}
+		}
+
+		if (!allocation.block)
+		{
+			// Leaving the heap means leaving every memory type on it, for one the usage can still
+			// work with; with none of those, stay and let the allocation fail here
+			uint32_t otherHeaps = 0;
+			vk::MemoryPropertyFlags needed = hostAccessFlags(usage);
+			for (uint32_t i = 0; i < properties.memoryTypeCount; ++i)
+			{
+				if ((typeBits & (1u << i)) && properties.memoryTypes[i].heapIndex != heap
+					&& (properties.memoryTypes[i].propertyFlags & needed) == needed)
+				{
+					otherHeaps |= 1u << i;
+				}
+			}
+
+			if (otherHeaps && overBudget(heap, dedicatedMemory ? requirements.size : blockSize))
+			{
+				typeBits = otherHeaps;
+				fellBack = true;
+				continue;
+			}
+
+			try
+			{
+				if (dedicatedMemory)
+				{
+					allocation.memory = allocateMemory(requirements.size, memoryType, &allocation.mapped);
+				}
+				else
+				{
+					allocation.block = createBlock(memoryType, linear);
+					allocateFromBlock(allocation.block, order, allocation.offset);
+				}
+			}
+			catch (const vk::OutOfDeviceMemoryError&)
+			{
+				if (!otherHeaps)
+				{
+					throw;
+				}
+				typeBits = otherHeaps;
+				fellBack = true;
+				continue;
+			}
+		}
+
+		if (allocation.block)
+		{
+			allocation.block->requestedBytes += allocation.size;
+			allocation.memory = allocation.block->memory;
+			allocation.mapped = allocation.block->mapped ? allocation.block->mapped + allocation.offset : nullptr;
+		}
+		if (fellBack)
+		{
+			++fallbackAllocations;
+		}
+		return;
+	}
+}
+
+void MemoryAllocator::release(const Allocation& allocation)
+{
+	if (allocation.block)
+	{
+		allocation.block->requestedBytes -= allocation.size;
+		freeToBlock(allocation.block, allocation.offset, allocation.order);
+	}
+	else
+	{
+		if (allocation.mapped)
+		{
+			device.unmapMemory(allocation.memory);
+		}
+		device.freeMemory(allocation.memory);
+		--deviceAllocationCount;
+	}
+}
+
+void MemoryAllocator::track(Allocation* allocation)
+{
+	if (allocation->block)
+	{
+		live.insert(allocation);
+	}
+	else
+	{
+		dedicated.push_back(allocation);
+	}
+}
+
+void MemoryAllocator::untrack(Allocation* allocation)
+{
+	if (allocation->block)
+	{
+		live.erase(allocation);
+	}
+	else
+	{
+		dedicated.erase(std::find(dedicated.begin(), dedicated.end(), allocation));
+	}
+}
+
+Allocation* MemoryAllocator::allocate(const vk::MemoryRequirements& requirements, MemoryUsage usage, bool linear, bool dedicatedMemory)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (deviceAllocationCount >= maxAllocationCount)
+	{
+		std::cout << "memory allocator: at maxMemoryAllocationCount (" << maxAllocationCount << ")" << std::endl;
+	}
+
+	Allocation* allocation = new Allocation();
+	allocation->size = requirements.size;
+	try
+	{
+		place(*allocation, requirements, usage, linear, dedicatedMemory);
+	}
+	catch (...)
+	{
+		delete allocation;
+		throw;
+	}
+
+	track(allocation);
+	return allocation;
+}
+
+void MemoryAllocator::free(Allocation* allocation)
+{
+	if (!allocation)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	release(*allocation);
+	untrack(allocation);
+	delete allocation;
+}
+
+Allocation* MemoryAllocator::createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryUsage memoryUsage, const std::vector<uint32_t>& sharingFamilies)
+{
+	// Always copyable, so the defragmenter can move it
+	usage |= vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+
+	// Concurrent sharing wants distinct families, and is pointless for just one
+	std::vector<uint32_t> families = sharingFamilies;
+	std::sort(families.begin(), families.end());
+	families.erase(std::unique(families.begin(), families.end()), families.end());
+	if (families.size() < 2)
+	{
+		families.clear();
+	}
+
+	vk::BufferCreateInfo bufferInfo = vk::BufferCreateInfo()
+		.setSize(size)
+		.setUsage(usage)
+		.setSharingMode(families.empty() ? vk::SharingMode::eExclusive : vk::SharingMode::eConcurrent)
+		.setQueueFamilyIndexCount(static_cast<uint32_t>(families.size()))
+		.setPQueueFamilyIndices(families.data());
+
+	vk::Buffer buffer = device.createBuffer(bufferInfo);
+
+	Allocation* allocation = allocate(device.getBufferMemoryRequirements(buffer), memoryUsage, true);
+	device.bindBufferMemory(buffer, allocation->memory, allocation->offset);
+
+	allocation->buffer = buffer;
+	allocation->bufferUsage = usage;
+	allocation->bufferFamilies = families;
+	return allocation;
+}
+
+void MemoryAllocator::destroyBuffer(Allocation* allocation)
+{
+	device.destroyBuffer(allocation->buffer);
+	free(allocation);
+}
+
+Allocation* MemoryAllocator::createImage(const vk::ImageCreateInfo& imageInfo, MemoryUsage memoryUsage)
+{
+	vk::Image image = device.createImage(imageInfo);
+
+	vk::MemoryRequirements requirements = device.getImageMemoryRequirements(image);
+
+	// Big render targets and textures get their own allocation rather than eating half a block
+	Allocation* allocation = allocate(requirements, memoryUsage, imageInfo.tiling == vk::ImageTiling::eLinear, requirements.size >= blockSize / 2);
+
+	device.bindImageMemory(image, allocation->memory, allocation->offset);
+
+	allocation->image = image;
+	return allocation;
+}
+
+void MemoryAllocator::destroyImage(Allocation* allocation)
+{
+	device.destroyImage(allocation->image);
+	free(allocation);
+}
+
+std::vector<DefragmentationMove> MemoryAllocator::defragment(vk::CommandBuffer commandBuffer)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::vector<DefragmentationMove> moves;
+
+	// Empty the least used blocks first, moving their contents into fuller ones
+	std::vector<MemoryBlock*> sortedBlocks;
+	for (const auto& block : blocks)
+	{
+		sortedBlocks.push_back(block.get());
+	}
+	std::sort(sortedBlocks.begin(), sortedBlocks.end(), [](const MemoryBlock* a, const MemoryBlock* b) { return a->usedBytes < b->usedBytes; });
+
+	// Only buffers we created can be moved; images would need a layout-aware copy
+	std::vector<Allocation*> candidates;
+	for (Allocation* allocation : live)
+	{
+		if (allocation->buffer && !allocation->image)
+		{
+			candidates.push_back(allocation);
+		}
+	}
+
+	for (size_t source = 0; source < sortedBlocks.size(); ++source)
+	{
+		MemoryBlock* sourceBlock = sortedBlocks[source];
+
+		for (Allocation* allocation : candidates)
+		{
+			if (allocation->block != sourceBlock)
+			{
+				continue;
+			}
+
+			// Look for room in a fuller block of the same kind
+			MemoryBlock* target = nullptr;
+			vk::DeviceSize offset = 0;
+			for (size_t t = sortedBlocks.size(); t-- > source + 1;)
+			{
+				MemoryBlock* block = sortedBlocks[t];
+				if (block->memoryType == sourceBlock->memoryType && block->linear == sourceBlock->linear && allocateFromBlock(block, allocation->order, offset))
+				{
+					target = block;
+					break;
+				}
+			}
+
+			if (!target)
+			{
+				continue;
+			}
+
+			vk::Buffer newBuffer = device.createBuffer(replacementInfo(*allocation));
+			device.bindBufferMemory(newBuffer, target->memory, offset);
+
+			vk::BufferCopy region = vk::BufferCopy()
+				.setSrcOffset(0)
+				.setDstOffset(0)
+				.setSize(allocation->size);
+			commandBuffer.copyBuffer(allocation->buffer, newBuffer, region);
+
+			DefragmentationMove move;
+			move.allocation = allocation;
+			move.oldBlock = sourceBlock;
+			move.oldOffset = allocation->offset;
+			move.oldOrder = allocation->order;
+			move.oldBuffer = allocation->buffer;
+			moves.push_back(move);
+
+			sourceBlock->requestedBytes -= allocation->size;
+			target->requestedBytes += allocation->size;
+
+			allocation->block = target;
+			allocation->memory = target->memory;
+			allocation->offset = offset;
+			allocation->buffer = newBuffer;
+			allocation->mapped = target->mapped ? target->mapped + offset : nullptr;
+		}
+	}
+
+	if (!moves.empty())
+	{
+		recordMoveBarrier(commandBuffer);
+	}
+
+	return moves;
+}
+
+bool MemoryAllocator::migrate(Allocation* allocation, MemoryUsage usage, vk::CommandBuffer commandBuffer, DefragmentationMove& move)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Nothing to do if usage's memory is on the heap the buffer is already on (e.g. there is
+	// only one heap), and no point in making a buffer to find that out
+	uint32_t targetHeap;
+	try
+	{
+		targetHeap = properties.memoryTypes[findMemoryType(device.getBufferMemoryRequirements(allocation->buffer).memoryTypeBits, usage)].heapIndex;
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+	if (targetHeap == heapOf(allocation))
+	{
+		return false;
+	}
+
+	vk::Buffer newBuffer = device.createBuffer(replacementInfo(*allocation));
+
+	Allocation placed;
+	placed.size = allocation->size;
+	try
+	{
+		place(placed, device.getBufferMemoryRequirements(newBuffer), usage, true, false);
+	}
+	catch (const std::exception&)
+	{
+		device.destroyBuffer(newBuffer);
+		return false;
+	}
+
+	if (properties.memoryTypes[placed.memoryType].heapIndex == heapOf(allocation))
+	{
+		release(placed);
+		device.destroyBuffer(newBuffer);
+		return false;
+	}
+
+	device.bindBufferMemory(newBuffer, placed.memory, placed.offset);
+
+	vk::BufferCopy region = vk::BufferCopy()
+		.setSrcOffset(0)
+		.setDstOffset(0)
+		.setSize(allocation->size);
+	commandBuffer.copyBuffer(allocation->buffer, newBuffer, region);
+	recordMoveBarrier(commandBuffer);
+
+	move.allocation = allocation;
+	move.oldBlock = allocation->block;
+	move.oldOffset = allocation->offset;
+	move.oldOrder = allocation->order;
+	move.oldBuffer = allocation->buffer;
+	move.oldDedicatedMemory = allocation->block ? vk::DeviceMemory() : allocation->memory;
+	move.oldDedicatedMapped = !allocation->block && allocation->mapped;
+
+	// The old range is only given back in finishDefragmentation, once the copy is done
+	untrack(allocation);
+	if (allocation->block)
+	{
+		allocation->block->requestedBytes -= allocation->size;
+	}
+
+	allocation->memory = placed.memory;
+	allocation->offset = placed.offset;
+	allocation->memoryType = placed.memoryType;
+	allocation->block = placed.block;
+	allocation->order = placed.order;
+	allocation->mapped = placed.mapped;
+	allocation->buffer = newBuffer;
+	track(allocation);
+
+	return true;
+}
+
+void MemoryAllocator::finishDefragmentation(const std::vector<DefragmentationMove>& moves)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (const auto& move : moves)
+		{
+			device.destroyBuffer(move.oldBuffer);
+			if (move.oldBlock)
+			{
+				freeToBlock(move.oldBlock, move.oldOffset, move.oldOrder);
+			}
+			else
+			{
+				if (move.oldDedicatedMapped)
+				{
+					device.unmapMemory(move.oldDedicatedMemory);
+				}
+				device.freeMemory(move.oldDedicatedMemory);
+				--deviceAllocationCount;
+			}
+		}
+	}
+
+	releaseEmptyBlocks();
+}
+
+void MemoryAllocator::releaseEmptyBlocks()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (auto it = blocks.begin(); it != blocks.end();)
+	{
+		MemoryBlock* block = it->get();
+		if (block->allocationCount == 0)
+		{
+			if (block->mapped)
+			{
+				device.unmapMemory(block->memory);
+			}
+			device.freeMemory(block->memory);
+			--deviceAllocationCount;
+			it = blocks.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void MemoryAllocator::enableMemoryBudget(const vk::DispatchLoaderDynamic& dispatch)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	getMemoryProperties2 = dispatch.vkGetPhysicalDeviceMemoryProperties2KHR;
+}
+
+void MemoryAllocator::setBudgetLimit(vk::DeviceSize bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	budgetLimit = bytes;
+}
+
+std::vector<HeapBudget> MemoryAllocator::heapBudgets() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return heapBudgetsLocked();
+}
+
+std::vector<HeapBudget> MemoryAllocator::heapBudgetsLocked() const
+{
+	std::vector<HeapBudget> budgets(properties.memoryHeapCount);
+
+	for (const auto& block : blocks)
+	{
+		HeapBudget& heap = budgets[properties.memoryTypes[block->memoryType].heapIndex];
+		heap.allocatorBytes += blockSize;
+		heap.unusedBytes += blockSize - block->usedBytes;
+	}
+	for (const Allocation* allocation : dedicated)
+	{
+		budgets[properties.memoryTypes[allocation->memoryType].heapIndex].allocatorBytes += allocation->size;
+	}
+
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT driverBudget = {};
+	driverBudget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	if (getMemoryProperties2)
+	{
+		VkPhysicalDeviceMemoryProperties2KHR memory = {};
+		memory.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+		memory.pNext = &driverBudget;
+		getMemoryProperties2(static_cast<VkPhysicalDevice>(physicalDevice), &memory);
+	}
+
+	for (uint32_t i = 0; i < properties.memoryHeapCount; ++i)
+	{
+		HeapBudget& heap = budgets[i];
+		heap.size = properties.memoryHeaps[i].size;
+		if (getMemoryProperties2)
+		{
+			// The driver may refresh its usage only now and then, but it is at least what we hold
+			heap.budget = driverBudget.heapBudget[i];
+			heap.usage = (std::max)(driverBudget.heapUsage[i], heap.allocatorBytes);
+			heap.fromDriver = true;
+		}
+		else
+		{
+			// Leave a fifth of the heap for the driver, the compositor and everyone else
+			heap.budget = heap.size / 5 * 4;
+			heap.usage = heap.allocatorBytes;
+		}
+
+		if (budgetLimit && (properties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal))
+		{
+			heap.budget = (std::min)(heap.budget, budgetLimit);
+		}
+	}
+
+	return budgets;
+}
+
+std::vector<HeapStats> MemoryAllocator::heapStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::vector<HeapStats> stats(properties.memoryHeapCount);
+
+	for (const auto& block : blocks)
+	{
+		HeapStats& heap = stats[properties.memoryTypes[block->memoryType].heapIndex];
+		++heap.blockCount;
+		heap.allocationCount += block->allocationCount;
+		heap.blockBytes += blockSize;
+		heap.usedBytes += block->requestedBytes;
+		heap.freeBytes += blockSize - block->usedBytes;
+
+		for (uint32_t order = maxOrder + 1; order-- > 0;)
+		{
+			if (!block->freeLists[order].empty())
+			{
+				heap.largestFreeRange = (std::max)(heap.largestFreeRange, orderSize(order));
+				break;
+			}
+		}
+	}
+
+	for (const Allocation* allocation : dedicated)
+	{
+		HeapStats& heap = stats[properties.memoryTypes[allocation->memoryType].heapIndex];
+		++heap.dedicatedCount;
+		heap.dedicatedBytes += allocation->size;
+		heap.usedBytes += allocation->size;
+	}
+
+	return stats;
+}
+
+void MemoryAllocator::logStats() const
+{
+	std::vector<HeapStats> stats = heapStats();
+	std::vector<HeapBudget> budgets = heapBudgets();
+
+	std::cout << "memory heaps: " << std::endl;
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		const HeapStats& heap = stats[i];
+		std::cout << "	Heap " << i << " (" << (properties.memoryHeaps[i].size >> 20) << "MB)"
+			<< ": " << heap.blockCount << " blocks, " << heap.allocationCount << " allocations, "
+			<< heap.dedicatedCount << " dedicated, "
+			<< (heap.usedBytes >> 10) << "KB used of " << ((heap.blockBytes + heap.dedicatedBytes) >> 10) << "KB, "
+			<< "fragmentation " << heap.fragmentation() << "; process using " << (budgets[i].usage >> 20) << "MB of a "
+			<< (budgets[i].budget >> 20) << "MB budget" << (budgets[i].fromDriver ? "" : " (estimated)") << std::endl;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (fallbackAllocations)
+	{
+		std::cout << "	" << fallbackAllocations << " allocations went to another heap, theirs being over budget or full" << std::endl;
+	}
+}
+
+void MemoryAllocator::destroy()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (Allocation* allocation : live)
+	{
+		delete allocation;
+	}
+	live.clear();
+
+	for (Allocation* allocation : dedicated)
+	{
+		if (allocation->mapped)
+		{
+			device.unmapMemory(allocation->memory);
+		}
+		device.freeMemory(allocation->memory);
+		delete allocation;
+	}
+	dedicated.clear();
+
+	for (const auto& block : blocks)
+	{
+		if (block->mapped)
+		{
+			device.unmapMemory(block->memory);
+		}
+		device.freeMemory(block->memory);
+	}
+	blocks.clear();
+
+	deviceAllocationCount = 0;
+}
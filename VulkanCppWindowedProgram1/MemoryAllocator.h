@@ -0,0 +1,181 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+// How the CPU and GPU will touch a resource; picks the memory type.
+enum class MemoryUsage
+{
+	GpuOnly,	// device local, never mapped
+	CpuToGpu,	// mapped and written by the CPU every frame, read by the GPU
+	CpuOnly,	// staging memory, preferably not device local
+	GpuToCpu,	// readback, preferably host cached
+	GpuLazy		// transient attachments, lazily allocated (tile memory) where the device has it
+};
+
+struct MemoryBlock;
+
+// A range of device memory handed out by MemoryAllocator. Host visible allocations are
+// persistently mapped. The allocator owns these; don't delete them yourself.
+struct Allocation
+{
+	vk::DeviceMemory memory;
+	vk::DeviceSize offset = 0;
+	vk::DeviceSize size = 0;
+	void* mapped = nullptr;
+	uint32_t memoryType = 0;
+
+	// Set when the allocator created the resource as well
+	vk::Buffer buffer;
+	vk::BufferUsageFlags bufferUsage;
+	std::vector<uint32_t> bufferFamilies;	// empty for exclusive buffers
+	vk::Image image;
+
+	// Internal bookkeeping
+	MemoryBlock* block = nullptr;	// null for dedicated allocations
+	uint32_t order = 0;
+};
+
+struct HeapStats
+{
+	uint32_t blockCount = 0;
+	uint32_t allocationCount = 0;
+	uint32_t dedicatedCount = 0;
+	vk::DeviceSize blockBytes = 0;
+	vk::DeviceSize usedBytes = 0;		// what callers asked for
+	vk::DeviceSize dedicatedBytes = 0;
+	vk::DeviceSize freeBytes = 0;
+	vk::DeviceSize largestFreeRange = 0;
+
+	// 0 when all free space in the blocks is one contiguous range, approaching 1 as it splinters
+	double fragmentation() const { return freeBytes ? 1.0 - double(largestFreeRange) / double(freeBytes) : 0.0; }
+};
+
+// How much of a heap the process can use. With VK_EXT_memory_budget the budget and usage are
+// the driver's, which accounts for other processes and for memory we didn't allocate here;
+// without it the budget is most of the heap and the usage is what this allocator holds.
+struct HeapBudget
+{
+	vk::DeviceSize size = 0;
+	vk::DeviceSize budget = 0;
+	vk::DeviceSize usage = 0;
+	vk::DeviceSize allocatorBytes = 0;	// our blocks and dedicated allocations, part of usage
+	vk::DeviceSize unusedBytes = 0;		// free space in our blocks, reusable without touching the budget
+	bool fromDriver = false;
+
+	// Usage less the space our blocks can still hand out, as a fraction of the budget
+	double pressure() const { return budget ? double(usage - (std::min)(usage, unusedBytes)) / double(budget) : 0.0; }
+};
+
+// Where a buffer moved to during defragmentation or migration. The copy has been recorded but
+// not executed; pass these back to finishDefragmentation once the command buffer completes.
+struct DefragmentationMove
+{
+	Allocation* allocation;
+	MemoryBlock* oldBlock;			// null when the buffer had a dedicated allocation
+	vk::DeviceSize oldOffset;
+	uint32_t oldOrder;
+	vk::Buffer oldBuffer;
+	vk::DeviceMemory oldDedicatedMemory;
+	bool oldDedicatedMapped = false;
+};
+
+// Sub-allocates buffers and images out of large vkAllocateMemory blocks using a buddy
+// allocator, so we stay far below maxMemoryAllocationCount. Linear (buffer) and optimal
+// (image) resources live in separate blocks, which sidesteps bufferImageGranularity.
+// Anything bigger than half a block gets its own dedicated allocation.
+//
+// New device memory goes where the heap has budget for it: when the preferred heap is over
+// budget or out of memory, the allocation falls back to another heap the resource can live
+// in (for GPU resources, host memory the GPU reads over the bus) rather than failing.
+class MemoryAllocator
+{
+public:
+	MemoryAllocator(vk::PhysicalDevice physicalDevice, vk::Device device, vk::DeviceSize blockSize = 64 * 1024 * 1024);
+
+	// dedicatedMemory gives the allocation a vkAllocateMemory of its own, whatever its size
+	Allocation* allocate(const vk::MemoryRequirements& requirements, MemoryUsage usage, bool linear, bool dedicatedMemory = false);
+	void free(Allocation* allocation);
+
+	// Passing more than one queue family creates the buffer with concurrent sharing, so those
+	// queues can use it without ownership transfers.
+	Allocation* createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, MemoryUsage memoryUsage, const std::vector<uint32_t>& sharingFamilies = std::vector<uint32_t>());
+	void destroyBuffer(Allocation* allocation);
+
+	Allocation* createImage(const vk::ImageCreateInfo& imageInfo, MemoryUsage memoryUsage);
+	void destroyImage(Allocation* allocation);
+
+	uint32_t findMemoryType(uint32_t typeBits, MemoryUsage usage) const;
+
+	uint32_t heapOf(const Allocation* allocation) const { return properties.memoryTypes[allocation->memoryType].heapIndex; }
+
+	// Makes GPU writes to a mapped allocation visible to the host. Readback memory may not be
+	// host coherent; call this after the fence of the writing submission, before reading.
+	void invalidate(const Allocation* allocation) const;
+
+	// Moves buffers out of the emptiest blocks into fuller ones, recording the copies into
+	// commandBuffer. Allocations are updated in place, so read allocation->buffer again
+	// after finishDefragmentation.
+	std::vector<DefragmentationMove> defragment(vk::CommandBuffer commandBuffer);
+	void finishDefragmentation(const std::vector<DefragmentationMove>& moves);
+
+	// Moves a buffer into the memory usage would pick, on another heap, recording the copy into
+	// commandBuffer like defragment does. Returns false, changing nothing, when that memory is on
+	// the heap the buffer is already on or there is no room for it.
+	bool migrate(Allocation* allocation, MemoryUsage usage, vk::CommandBuffer commandBuffer, DefragmentationMove& move);
+
+	// Returns blocks with nothing left in them to the driver.
+	void releaseEmptyBlocks();
+
+	const vk::PhysicalDeviceMemoryProperties& memoryProperties() const { return properties; }
+
+	// Call once VK_EXT_memory_budget is enabled on the device (which needs
+	// VK_KHR_get_physical_device_properties2 on the instance) to get the driver's budgets.
+	void enableMemoryBudget(const vk::DispatchLoaderDynamic& dispatch);
+
+	// Caps the budget of every device local heap at bytes, to see how a scene fares on a
+	// smaller GPU. 0 removes the cap.
+	void setBudgetLimit(vk::DeviceSize bytes);
+
+	std::vector<HeapBudget> heapBudgets() const;
+	std::vector<HeapStats> heapStats() const;
+	void logStats() const;
+
+	void destroy();
+
+private:
+	void place(Allocation& allocation, const vk::MemoryRequirements& requirements, MemoryUsage usage, bool linear, bool dedicatedMemory);
+	void release(const Allocation& allocation);
+	void track(Allocation* allocation);
+	void untrack(Allocation* allocation);
+	bool overBudget(uint32_t heap, vk::DeviceSize bytes) const;
+	std::vector<HeapBudget> heapBudgetsLocked() const;
+	MemoryBlock* createBlock(uint32_t memoryType, bool linear);
+	bool allocateFromBlock(MemoryBlock* block, uint32_t order, vk::DeviceSize& offset);
+	void freeToBlock(MemoryBlock* block, vk::DeviceSize offset, uint32_t order);
+	uint32_t orderFor(vk::DeviceSize size, vk::DeviceSize alignment) const;
+	vk::DeviceMemory allocateMemory(vk::DeviceSize size, uint32_t memoryType, void** mapped);
+
+	vk::PhysicalDevice physicalDevice;
+	vk::Device device;
+	vk::PhysicalDeviceMemoryProperties properties;
+	uint32_t maxAllocationCount;
+	vk::DeviceSize nonCoherentAtomSize;
+	vk::DeviceSize blockSize;
+	uint32_t maxOrder;
+
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+	vk::DeviceSize budgetLimit = 0;
+	uint32_t fallbackAllocations = 0;	// placed on another heap than the one asked for
+
+	uint32_t deviceAllocationCount = 0;
+	std::vector<std::unique_ptr<MemoryBlock>> blocks;
+	std::unordered_set<Allocation*> live;
+	std::vector<Allocation*> dedicated;
+	mutable std::mutex mutex;
+};
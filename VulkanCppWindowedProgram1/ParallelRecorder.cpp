@@ -0,0 +1,112 @@
+#include "ParallelRecorder.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+ParallelRecorder::ParallelRecorder(JobSystem& jobs, vk::Device device, uint32_t queueFamilyIndex, uint32_t sliceCount, uint32_t framesInFlight)
+	: jobs(jobs)
+	, device(device)
+	, sliceCount(sliceCount)
+	, pools(framesInFlight)
+	, secondaries(framesInFlight)
+	, sliceMilliseconds(sliceCount, 0.0)
+	, totalSliceMilliseconds(sliceCount, 0.0)
+{
+	vk::CommandPoolCreateInfo poolInfo = vk::CommandPoolCreateInfo()
+		.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+		.setQueueFamilyIndex(queueFamilyIndex);
+
+	for (uint32_t frame = 0; frame < framesInFlight; ++frame)
+	{
+		for (uint32_t slice = 0; slice < sliceCount; ++slice)
+		{
+			vk::CommandPool pool = device.createCommandPool(poolInfo);
+
+			vk::CommandBufferAllocateInfo allocateInfo = vk::CommandBufferAllocateInfo()
+				.setCommandPool(pool)
+				.setLevel(vk::CommandBufferLevel::eSecondary)
+				.setCommandBufferCount(1);
+
+			pools[frame].push_back(pool);
+			secondaries[frame].push_back(device.allocateCommandBuffers(allocateInfo)[0]);
+		}
+	}
+
+	for (uint32_t slice = 0; slice < sliceCount; ++slice)
+	{
+		graph.add("record slice " + std::to_string(slice), [this, slice] { recordSlice(slice); });
+	}
+}
+
+const std::vector<vk::CommandBuffer>& ParallelRecorder::record(uint32_t frameIndex, const vk::CommandBufferInheritanceInfo& inheritance, size_t itemCount, const RecordSlice& recordSlice)
+{
+	jobFrame = frameIndex;
+	jobInheritance = &inheritance;
+	jobItemCount = itemCount;
+	jobRecordSlice = &recordSlice;
+
+	jobs.run(graph);
+
+	++recordCount;
+	for (uint32_t slice = 0; slice < sliceCount; ++slice)
+	{
+		totalSliceMilliseconds[slice] += sliceMilliseconds[slice];
+	}
+
+	return secondaries[frameIndex];
+}
+
+void ParallelRecorder::recordSlice(uint32_t slice)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Only this slice's job uses its pool, so no two threads ever record into the same one
+	device.resetCommandPool(pools[jobFrame][slice], vk::CommandPoolResetFlags());
+
+	vk::CommandBuffer commandBuffer = secondaries[jobFrame][slice];
+	vk::CommandBufferBeginInfo beginInfo = vk::CommandBufferBeginInfo()
+		.setFlags(vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
+		.setPInheritanceInfo(jobInheritance);
+
+	commandBuffer.begin(beginInfo);
+
+	// Each slice is a contiguous run of items, so no two jobs touch the same draw
+	size_t begin = jobItemCount * slice / sliceCount;
+	size_t end = jobItemCount * (slice + 1) / sliceCount;
+	if (begin < end)
+	{
+		(*jobRecordSlice)(commandBuffer, begin, end);
+	}
+
+	commandBuffer.end();
+
+	sliceMilliseconds[slice] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void ParallelRecorder::logStats() const
+{
+	if (recordCount == 0)
+	{
+		return;
+	}
+
+	std::cout << "command recording, average per frame: " << std::endl;
+	for (uint32_t slice = 0; slice < sliceCount; ++slice)
+	{
+		std::cout << "\tSlice " << slice << ": " << totalSliceMilliseconds[slice] / recordCount << "ms" << std::endl;
+	}
+}
+
+void ParallelRecorder::destroy()
+{
+	for (const auto& framePools : pools)
+	{
+		for (const auto& pool : framePools)
+		{
+			device.destroyCommandPool(pool);
+		}
+	}
+	pools.clear();
+	secondaries.clear();
+}
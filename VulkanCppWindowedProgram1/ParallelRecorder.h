@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <functional>
+#include <vector>
+
+#include "JobSystem.h"
+
+// Records a draw list into secondary command buffers, one slice of it per job on the job system.
+// Each slice owns one command pool per frame in flight; the pool is reset in bulk when the frame
+// comes around again instead of freeing individual command buffers.
+class ParallelRecorder
+{
+public:
+	// Records draw list items [begin, end) into an already begun secondary command buffer
+	typedef std::function<void(vk::CommandBuffer commandBuffer, size_t begin, size_t end)> RecordSlice;
+
+	ParallelRecorder(JobSystem& jobs, vk::Device device, uint32_t queueFamilyIndex, uint32_t sliceCount, uint32_t framesInFlight);
+
+	// Splits itemCount items evenly across the slices and blocks until they have all been
+	// recorded, running slices on the calling thread too. Only call this once the GPU is done
+	// with frameIndex's previous submission.
+	const std::vector<vk::CommandBuffer>& record(uint32_t frameIndex, const vk::CommandBufferInheritanceInfo& inheritance, size_t itemCount, const RecordSlice& recordSlice);
+
+	// Milliseconds each slice took during the last record() call
+	const std::vector<double>& lastSliceMilliseconds() const { return sliceMilliseconds; }
+
+	void logStats() const;
+
+	void destroy();
+
+private:
+	void recordSlice(uint32_t slice);
+
+	JobSystem& jobs;
+	vk::Device device;
+	uint32_t sliceCount;
+
+	// [frame][slice]
+	std::vector<std::vector<vk::CommandPool>> pools;
+	std::vector<std::vector<vk::CommandBuffer>> secondaries;
+
+	// One job per slice, built once and rerun every record()
+	JobGraph graph;
+
+	std::vector<double> sliceMilliseconds;
+	std::vector<double> totalSliceMilliseconds;
+	uint64_t recordCount = 0;
+
+	// The arguments of the record() call in progress, read by the slice jobs
+	uint32_t jobFrame = 0;
+	const vk::CommandBufferInheritanceInfo* jobInheritance = nullptr;
+	size_t jobItemCount = 0;
+	const RecordSlice* jobRecordSlice = nullptr;
+};
@@ -0,0 +1,296 @@
+#include "ParticleSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+	const uint32_t localSize = 256;
+
+	struct Particle
+	{
+		float position[2];
+		float velocity[2];
+	};
+
+	// Matches QuadInstance in main.cpp and in the shader
+	const vk::DeviceSize instanceSize = 2 * 4 * sizeof(float);
+
+	struct ParticleParams
+	{
+		float deltaTime;
+		uint32_t count;
+		uint32_t seed;
+		float size;
+	};
+
+	// Intervals that never found a partner (e.g. the first frame) are dropped after this many frames
+	const uint64_t intervalHistory = 16;
+}
+
+ParticleSystem::ParticleSystem(vk::PhysicalDevice physicalDevice, vk::Device device, MemoryAllocator& allocator, PipelineCache& pipelineCache, DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors, const QueueFamilies& queueFamilies, vk::Queue computeQueue, vk::ShaderModule shader, uint32_t particleCount, uint32_t framesInFlight)
+	: device(device), allocator(allocator), computeQueue(computeQueue), particleCount(particleCount)
+{
+	// Roughly fill the screen without the quads turning into single pixels
+	particleSize = (std::max)(0.004f, (std::min)(0.05f, 1.0f / std::sqrt(static_cast<float>(particleCount))));
+
+	pipeline = createComputePipeline(device, pipelineCache, layouts, shader, 2, sizeof(ParticleParams));
+
+	// Simulation state never leaves the compute queue; the instance buffers are shared with graphics
+	state = allocator.createBuffer(particleCount * sizeof(Particle), vk::BufferUsageFlagBits::eStorageBuffer, MemoryUsage::GpuOnly);
+
+	std::vector<uint32_t> sharedFamilies = { queueFamilies.compute, queueFamilies.graphics };
+	for (auto& output : outputs)
+	{
+		output = allocator.createBuffer(particleCount * instanceSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer, MemoryUsage::GpuOnly, sharedFamilies);
+	}
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		descriptorSets[i] = descriptors.allocate(pipeline.setLayout);
+
+		vk::DescriptorBufferInfo bufferInfos[] = {
+			vk::DescriptorBufferInfo(state->buffer, 0, VK_WHOLE_SIZE),
+			vk::DescriptorBufferInfo(outputs[i]->buffer, 0, VK_WHOLE_SIZE),
+		};
+
+		vk::WriteDescriptorSet write = vk::WriteDescriptorSet()
+			.setDstSet(descriptorSets[i])
+			.setDstBinding(0)
+			.setDescriptorCount(2)
+			.setDescriptorType(vk::DescriptorType::eStorageBuffer)
+			.setPBufferInfo(bufferInfos);
+
+		device.updateDescriptorSets(write, nullptr);
+
+		simulatedSemaphores[i] = device.createSemaphore(vk::SemaphoreCreateInfo());
+		drawnSemaphores[i] = device.createSemaphore(vk::SemaphoreCreateInfo());
+	}
+
+	vk::CommandPoolCreateInfo commandPoolInfo = vk::CommandPoolCreateInfo()
+		.setFlags(vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+		.setQueueFamilyIndex(queueFamilies.compute);
+
+	commandPool = device.createCommandPool(commandPoolInfo);
+
+	vk::CommandBufferAllocateInfo allocateInfo = vk::CommandBufferAllocateInfo()
+		.setCommandPool(commandPool)
+		.setLevel(vk::CommandBufferLevel::ePrimary)
+		.setCommandBufferCount(framesInFlight);
+
+	commandBuffers = device.allocateCommandBuffers(allocateInfo);
+
+	std::vector<vk::QueueFamilyProperties> familyProperties = physicalDevice.getQueueFamilyProperties();
+	uint32_t computeBits = familyProperties[queueFamilies.compute].timestampValidBits;
+	timestamps = computeBits > 0;
+	// Counters of different widths can't be on one clock; equal widths only suggest they are
+	overlapTimestamps = timestamps && familyProperties[queueFamilies.graphics].timestampValidBits == computeBits;
+	timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+	pendingFrame.assign(framesInFlight, -1);
+
+	if (timestamps)
+	{
+		vk::QueryPoolCreateInfo queryPoolInfo = vk::QueryPoolCreateInfo()
+			.setQueryType(vk::QueryType::eTimestamp)
+			.setQueryCount(framesInFlight * 2);
+
+		queryPool = device.createQueryPool(queryPoolInfo);
+	}
+
+	std::cout << "particles: " << particleCount << " on queue family " << queueFamilies.compute
+		<< (queueFamilies.asyncCompute() ? " (async compute)" : " (shared with graphics)") << std::endl;
+}
+
+vk::Buffer ParticleSystem::simulate(uint64_t frame, uint32_t frameIndex, float deltaSeconds)
+{
+	collectTimestamps(frameIndex);
+
+	uint32_t target = static_cast<uint32_t>(frame % 2);
+	vk::CommandBuffer commandBuffer = commandBuffers[frameIndex];
+
+	commandBuffer.reset(vk::CommandBufferResetFlags());
+	commandBuffer.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+	uint32_t firstQuery = frameIndex * 2;
+	if (timestamps)
+	{
+		commandBuffer.resetQueryPool(queryPool, firstQuery, 2);
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool, firstQuery);
+	}
+
+	// The state buffer is updated in place, so this dispatch has to see the previous one's writes
+	vk::MemoryBarrier stateBarrier = vk::MemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eShaderWrite)
+		.setDstAccessMask(vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+	commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), stateBarrier, nullptr, nullptr);
+
+	ParticleParams params;
+	params.deltaTime = deltaSeconds;
+	params.count = particleCount;
+	params.seed = seeded ? 0 : 1;
+	params.size = particleSize;
+	seeded = true;
+
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline.pipeline);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline.layout, 0, descriptorSets[target], nullptr);
+	commandBuffer.pushConstants(pipeline.layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(params), &params);
+	commandBuffer.dispatch(dispatchSize(particleCount, localSize), 1, 1);
+
+	if (timestamps)
+	{
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, firstQuery + 1);
+	}
+
+	commandBuffer.end();
+
+	// Graphics may still be drawing from this buffer two frames back
+	vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eComputeShader;
+
+	vk::SubmitInfo submitInfo = vk::SubmitInfo()
+		.setWaitSemaphoreCount(drawnPending[target] ? 1 : 0)
+		.setPWaitSemaphores(&drawnSemaphores[target])
+		.setPWaitDstStageMask(&waitStage)
+		.setCommandBufferCount(1)
+		.setPCommandBuffers(&commandBuffer)
+		.setSignalSemaphoreCount(1)
+		.setPSignalSemaphores(&simulatedSemaphores[target]);
+
+	computeQueue.submit(submitInfo, vk::Fence());
+
+	drawnPending[target] = true;
+	pendingFrame[frameIndex] = static_cast<int64_t>(frame);
+	++dispatches;
+
+	return outputs[target]->buffer;
+}
+
+void ParticleSystem::collectTimestamps(uint32_t frameIndex)
+{
+	if (!timestamps || pendingFrame[frameIndex] < 0)
+	{
+		return;
+	}
+
+	uint64_t values[2];
+	vk::Result result = device.getQueryPoolResults(queryPool, frameIndex * 2, 2, sizeof(values), values, sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+	if (result == vk::Result::eSuccess)
+	{
+		computeMilliseconds += (values[1] - values[0]) * timestampPeriod / 1e6;
+		++timedDispatches;
+
+		if (overlapTimestamps)
+		{
+			computeIntervals[static_cast<uint64_t>(pendingFrame[frameIndex])] = Interval(values[0], values[1]);
+			matchIntervals();
+		}
+	}
+	pendingFrame[frameIndex] = -1;
+}
+
+void ParticleSystem::noteGraphicsInterval(uint64_t frame, uint64_t begin, uint64_t end)
+{
+	if (!overlapTimestamps)
+	{
+		return;
+	}
+
+	graphicsIntervals[frame] = Interval(begin, end);
+	matchIntervals();
+}
+
+void ParticleSystem::matchIntervals()
+{
+	// Compute for frame N runs while graphics is drawing frame N-1. Vulkan doesn't promise that
+	// timestamps from different queues share a clock, only that each queue's count up at
+	// timestampPeriod, so comparing the intervals is an approximation. On the desktop drivers
+	// we've looked at both queues read the same counter; calibrated timestamps would tell for sure.
+	for (auto compute = computeIntervals.begin(); compute != computeIntervals.end();)
+	{
+		auto graphics = compute->first > 0 ? graphicsIntervals.find(compute->first - 1) : graphicsIntervals.end();
+		if (graphics == graphicsIntervals.end())
+		{
+			++compute;
+			continue;
+		}
+
+		uint64_t overlapBegin = (std::max)(compute->second.first, graphics->second.first);
+		uint64_t overlapEnd = (std::min)(compute->second.second, graphics->second.second);
+
+		pairedComputeMilliseconds += (compute->second.second - compute->second.first) * timestampPeriod / 1e6;
+		if (overlapEnd > overlapBegin)
+		{
+			overlapMilliseconds += (overlapEnd - overlapBegin) * timestampPeriod / 1e6;
+		}
+
+		graphicsIntervals.erase(graphics);
+		compute = computeIntervals.erase(compute);
+	}
+
+	uint64_t newest = 0;
+	if (!computeIntervals.empty())
+	{
+		newest = (std::max)(newest, computeIntervals.rbegin()->first);
+	}
+	if (!graphicsIntervals.empty())
+	{
+		newest = (std::max)(newest, graphicsIntervals.rbegin()->first);
+	}
+
+	while (!computeIntervals.empty() && computeIntervals.begin()->first + intervalHistory < newest)
+	{
+		computeIntervals.erase(computeIntervals.begin());
+	}
+	while (!graphicsIntervals.empty() && graphicsIntervals.begin()->first + intervalHistory < newest)
+	{
+		graphicsIntervals.erase(graphicsIntervals.begin());
+	}
+}
+
+void ParticleSystem::collectAll()
+{
+	for (uint32_t i = 0; i < pendingFrame.size(); ++i)
+	{
+		collectTimestamps(i);
+	}
+}
+
+void ParticleSystem::logStats(double seconds) const
+{
+	double updates = double(particleCount) * double(dispatches);
+	std::cout << "particles: " << dispatches << " dispatches of " << particleCount << " in " << seconds << "s, "
+		<< updates / seconds / 1e6 << "M particle updates/s" << std::endl;
+
+	if (timedDispatches > 0)
+	{
+		double averageMs = computeMilliseconds / timedDispatches;
+		std::cout << "particles: compute " << averageMs << "ms per dispatch on the GPU, "
+			<< particleCount / (averageMs / 1000.0) / 1e6 << "M updates/s while running";
+
+		if (pairedComputeMilliseconds > 0.0)
+		{
+			std::cout << ", ~" << 100.0 * overlapMilliseconds / pairedComputeMilliseconds << "% overlapped with graphics (approximate, cross-queue timestamps)";
+		}
+		std::cout << std::endl;
+	}
+}
+
+void ParticleSystem::destroy()
+{
+	if (queryPool)
+	{
+		device.destroyQueryPool(queryPool);
+	}
+	device.destroyCommandPool(commandPool);
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		device.destroySemaphore(simulatedSemaphores[i]);
+		device.destroySemaphore(drawnSemaphores[i]);
+		allocator.destroyBuffer(outputs[i]);
+	}
+	allocator.destroyBuffer(state);
+
+	destroyComputePipeline(device, pipeline);
+}
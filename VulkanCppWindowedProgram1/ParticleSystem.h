@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "ComputePipeline.h"
+#include "Descriptors.h"
+#include "DeviceSelection.h"
+#include "MemoryAllocator.h"
+#include "PipelineCache.h"
+
+// A particle simulation running on the compute queue. Every frame it writes one of two
+// instance buffers in the QuadInstance layout, which the graphics queue draws directly.
+// While graphics draws frame N from one buffer, compute is already filling the other for
+// N+1, so with an async compute family the two overlap. Ordering is purely GPU side:
+// the graphics submission for a frame waits on simulated(frame) and signals drawn(frame),
+// and compute waits on drawn before overwriting a buffer graphics may still be reading.
+class ParticleSystem
+{
+public:
+	ParticleSystem(vk::PhysicalDevice physicalDevice, vk::Device device, MemoryAllocator& allocator, PipelineCache& pipelineCache, DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors, const QueueFamilies& queueFamilies, vk::Queue computeQueue, vk::ShaderModule shader, uint32_t particleCount, uint32_t framesInFlight);
+
+	// Records and submits the update for frame, reusing frameIndex's command buffer (so wait on
+	// that frame's fence first). Returns the instance buffer to draw this frame. Must be followed
+	// by a graphics submission for the same frame that waits on simulated and signals drawn.
+	vk::Buffer simulate(uint64_t frame, uint32_t frameIndex, float deltaSeconds);
+
+	vk::Semaphore simulated(uint64_t frame) const { return simulatedSemaphores[frame % 2]; }
+	vk::Semaphore drawn(uint64_t frame) const { return drawnSemaphores[frame % 2]; }
+
+	uint32_t count() const { return particleCount; }
+
+	// Raw graphics timestamps for frame, used to estimate how much compute overlapped with it.
+	// Ignored when the graphics and compute families' timestamps have different valid bits.
+	void noteGraphicsInterval(uint64_t frame, uint64_t begin, uint64_t end);
+
+	// Reads back any outstanding timestamps; only call once the device is idle.
+	void collectAll();
+
+	// Particle updates per second over the run, GPU compute time and compute/graphics overlap.
+	void logStats(double seconds) const;
+
+	void destroy();
+
+private:
+	typedef std::pair<uint64_t, uint64_t> Interval;
+
+	void collectTimestamps(uint32_t frameIndex);
+	void matchIntervals();
+
+	vk::Device device;
+	MemoryAllocator& allocator;
+	vk::Queue computeQueue;
+	uint32_t particleCount;
+	float particleSize;
+
+	ComputePipeline pipeline;
+	vk::DescriptorSet descriptorSets[2];
+
+	Allocation* state;
+	Allocation* outputs[2];
+
+	vk::Semaphore simulatedSemaphores[2];
+	vk::Semaphore drawnSemaphores[2];
+	bool drawnPending[2] = { false, false };
+	bool seeded = false;
+
+	vk::CommandPool commandPool;
+	std::vector<vk::CommandBuffer> commandBuffers;
+
+	bool timestamps;
+	bool overlapTimestamps;	// graphics timestamps are comparable enough to estimate overlap
+	double timestampPeriod;
+	vk::QueryPool queryPool;
+	std::vector<int64_t> pendingFrame;
+
+	std::map<uint64_t, Interval> computeIntervals;
+	std::map<uint64_t, Interval> graphicsIntervals;
+
+	uint64_t dispatches = 0;
+	uint64_t timedDispatches = 0;
+	double computeMilliseconds = 0.0;
+	double pairedComputeMilliseconds = 0.0;
+	double overlapMilliseconds = 0.0;
+};
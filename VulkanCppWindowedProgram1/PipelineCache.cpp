@@ -0,0 +1,160 @@
+#include "PipelineCache.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+	// Written in front of the driver's blob. The driver's own header has no driver version,
+	// so we keep everything we validate against in here.
+	struct PipelineCacheFileHeader
+	{
+		uint32_t magic;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+	};
+
+	const uint32_t pipelineCacheMagic = 0x43504B56; // "VKPC"
+}
+
+PipelineCache::PipelineCache(vk::Device device, vk::PhysicalDevice physicalDevice, const std::string& path)
+	: device(device)
+	, properties(physicalDevice.getProperties())
+	, path(path)
+{
+	std::vector<char> initialData;
+
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (file.is_open())
+	{
+		uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+		file.seekg(0);
+
+		PipelineCacheFileHeader header;
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+		// A truncated or corrupt file could claim any size at all
+		bool valid = file.good()
+			&& header.dataSize <= fileSize - sizeof(header)
+			&& header.magic == pipelineCacheMagic
+			&& header.vendorID == properties.vendorID
+			&& header.deviceID == properties.deviceID
+			&& header.driverVersion == properties.driverVersion
+			&& std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+		if (valid)
+		{
+			initialData.resize(static_cast<size_t>(header.dataSize));
+			file.read(initialData.data(), initialData.size());
+			valid = file.good();
+		}
+
+		if (valid)
+		{
+			loadedFromDisk = true;
+		}
+		else
+		{
+			initialData.clear();
+			std::cout << "pipeline cache: ignoring stale or foreign cache " << path << std::endl;
+		}
+	}
+
+	vk::PipelineCacheCreateInfo cacheInfo = vk::PipelineCacheCreateInfo()
+		.setInitialDataSize(initialData.size())
+		.setPInitialData(initialData.empty() ? nullptr : initialData.data());
+
+	cache = device.createPipelineCache(cacheInfo);
+
+	std::cout << "pipeline cache: " << (loadedFromDisk ? "loaded " : "starting empty, ") << initialData.size() << " bytes" << std::endl;
+}
+
+vk::Pipeline PipelineCache::createGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& info)
+{
+	size_t sizeBefore = dataSize();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	vk::Pipeline pipeline = device.createGraphicsPipeline(cache, info);
+	countCompile(sizeBefore, std::chrono::high_resolution_clock::now() - start);
+
+	return pipeline;
+}
+
+vk::Pipeline PipelineCache::createComputePipeline(const vk::ComputePipelineCreateInfo& info)
+{
+	size_t sizeBefore = dataSize();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	vk::Pipeline pipeline = device.createComputePipeline(cache, info);
+	countCompile(sizeBefore, std::chrono::high_resolution_clock::now() - start);
+
+	return pipeline;
+}
+
+void PipelineCache::countCompile(size_t sizeBefore, std::chrono::duration<double, std::milli> elapsed)
+{
+	// Vulkan 1.0 can't tell us directly whether the cache was used, but a miss always
+	// adds the newly compiled pipeline to it. With compiles running in parallel another
+	// thread's miss can make a hit look like one too, so treat the split as approximate.
+	bool grew = dataSize() > sizeBefore;
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	compileMilliseconds += elapsed.count();
+	if (grew)
+	{
+		++misses;
+	}
+	else
+	{
+		++hits;
+	}
+}
+
+void PipelineCache::logStats() const
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+	std::cout << "pipeline cache: " << hits << " hits, " << misses << " misses, "
+		<< compileMilliseconds << "ms creating pipelines" << std::endl;
+}
+
+void PipelineCache::save() const
+{
+	std::vector<uint8_t> data = device.getPipelineCacheData(cache);
+
+	PipelineCacheFileHeader header = {};
+	header.magic = pipelineCacheMagic;
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.dataSize = data.size();
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "pipeline cache: could not write " << path << std::endl;
+		return;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+void PipelineCache::destroy()
+{
+	device.destroyPipelineCache(cache);
+	cache = vk::PipelineCache();
+}
+
+size_t PipelineCache::dataSize() const
+{
+	size_t size = 0;
+	vkGetPipelineCacheData(static_cast<VkDevice>(device), static_cast<VkPipelineCache>(cache), &size, nullptr);
+	return size;
+}
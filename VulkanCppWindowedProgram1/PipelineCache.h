@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+// A VkPipelineCache that is loaded from disk at startup and written back at shutdown.
+// The file is only trusted if it was written by the same vendor, device, driver version
+// and pipelineCacheUUID as the one we are running on.
+//
+// Pipelines may be created from several threads at once; the VkPipelineCache is internally
+// synchronized and the counters are behind a mutex.
+class PipelineCache
+{
+public:
+	PipelineCache(vk::Device device, vk::PhysicalDevice physicalDevice, const std::string& path);
+
+	vk::PipelineCache handle() const { return cache; }
+
+	// Creates the pipeline through the cache and records whether it was served from it.
+	vk::Pipeline createGraphicsPipeline(const vk::GraphicsPipelineCreateInfo& info);
+	vk::Pipeline createComputePipeline(const vk::ComputePipelineCreateInfo& info);
+
+	void logStats() const;
+
+	void save() const;
+	void destroy();
+
+private:
+	size_t dataSize() const;
+	void countCompile(size_t sizeBefore, std::chrono::duration<double, std::milli> elapsed);
+
+	vk::Device device;
+	vk::PhysicalDeviceProperties properties;
+	std::string path;
+	vk::PipelineCache cache;
+
+	bool loadedFromDisk = false;
+
+	mutable std::mutex statsMutex;
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+	double compileMilliseconds = 0.0;
+};
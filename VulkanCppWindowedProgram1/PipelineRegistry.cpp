@@ -0,0 +1,426 @@
+#include "PipelineRegistry.h"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+
+bool parseBlendMode(const std::string& name, BlendMode& mode)
+{
+	if (name == "opaque")
+	{
+		mode = BlendMode::Opaque;
+	}
+	else if (name == "alpha")
+	{
+		mode = BlendMode::Alpha;
+	}
+	else if (name == "additive")
+	{
+		mode = BlendMode::Additive;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+PipelineKey& PipelineKey::specialize(uint32_t constantId, uint32_t value)
+{
+	if (constantId >= maxSpecializationConstants)
+	{
+		throw std::out_of_range("pipeline key: specialization constant id out of range");
+	}
+	specializedMask |= 1u << constantId;
+	specialization[constantId] = value;
+	return *this;
+}
+
+PipelineKey PipelineKey::generic() const
+{
+	PipelineKey key = *this;
+	key.specializedMask = 0;
+	for (uint32_t& value : key.specialization)
+	{
+		value = 0;
+	}
+	return key;
+}
+
+uint64_t PipelineKey::hash() const
+{
+	// FNV-1a over each field, so padding never gets into the hash
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](uint32_t value)
+	{
+		for (int byte = 0; byte < 4; ++byte)
+		{
+			hash ^= (value >> (byte * 8)) & 0xFF;
+			hash *= 1099511628211ull;
+		}
+	};
+
+	mix(static_cast<uint32_t>(topology));
+	mix(static_cast<uint32_t>(polygonMode));
+	mix(static_cast<uint32_t>(cullMode));
+	mix(static_cast<uint32_t>(frontFace));
+	mix(static_cast<uint32_t>(blend));
+	mix(specializedMask);
+	for (uint32_t id = 0; id < maxSpecializationConstants; ++id)
+	{
+		mix((specializedMask & (1u << id)) ? specialization[id] : 0);
+	}
+	return hash;
+}
+
+bool PipelineKey::operator==(const PipelineKey& other) const
+{
+	if (topology != other.topology || polygonMode != other.polygonMode || cullMode != other.cullMode
+		|| frontFace != other.frontFace || blend != other.blend || specializedMask != other.specializedMask)
+	{
+		return false;
+	}
+	for (uint32_t id = 0; id < maxSpecializationConstants; ++id)
+	{
+		if ((specializedMask & (1u << id)) && specialization[id] != other.specialization[id])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+PipelineRegistry::PipelineRegistry(vk::Device device, PipelineCache& pipelineCache, const GraphicsPipelineShared& shared, uint32_t threadCount)
+	: device(device)
+	, pipelineCache(pipelineCache)
+	, shared(shared)
+{
+	for (uint32_t thread = 0; thread < threadCount; ++thread)
+	{
+		workers.emplace_back(&PipelineRegistry::workerMain, this);
+	}
+}
+
+vk::Pipeline PipelineRegistry::get(const PipelineKey& key)
+{
+	PipelineKey fallback = key.generic();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = variants.find(key);
+		if (found != variants.end() && found->second.state == VariantState::Ready)
+		{
+			return found->second.pipeline;
+		}
+
+		if (!(fallback == key))
+		{
+			if (found == variants.end())
+			{
+				variants[key];
+				queue.push_back(key);
+				workReady.notify_one();
+			}
+			++fallbackFrames;
+		}
+	}
+
+	// Usually built long ago; only the first use of a fixed-function combination compiles here
+	return getBlocking(fallback);
+}
+
+void PipelineRegistry::prefetch(const PipelineKey& key)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (variants.find(key) == variants.end())
+	{
+		variants[key];
+		queue.push_back(key);
+		workReady.notify_one();
+	}
+}
+
+vk::Pipeline PipelineRegistry::getBlocking(const PipelineKey& key)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// References into an unordered_map survive rehashing, so this stays valid while unlocked
+	Variant& variant = variants[key];
+	if (variant.state == VariantState::Ready)
+	{
+		return variant.pipeline;
+	}
+	if (variant.state == VariantState::Compiling)
+	{
+		variantReady.wait(lock, [&] { return variant.state != VariantState::Compiling; });
+	}
+	if (variant.state == VariantState::Ready)
+	{
+		return variant.pipeline;
+	}
+	if (variant.state == VariantState::Failed)
+	{
+		std::rethrow_exception(variant.error);
+	}
+
+	// Still queued (or new): build it here, and the worker that pops it will skip it
+	variant.state = VariantState::Compiling;
+	lock.unlock();
+
+	auto start = std::chrono::high_resolution_clock::now();
+	vk::Pipeline pipeline;
+	try
+	{
+		pipeline = build(key);
+	}
+	catch (...)
+	{
+		// Anyone waiting on this variant would otherwise wait forever
+		lock.lock();
+		variant.state = VariantState::Failed;
+		variant.error = std::current_exception();
+		++failedBuilds;
+		variantReady.notify_all();
+		throw;
+	}
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	lock.lock();
+	variant.pipeline = pipeline;
+	variant.state = VariantState::Ready;
+	++blockingBuilds;
+	blockingMilliseconds += milliseconds;
+	variantReady.notify_all();
+
+	return pipeline;
+}
+
+void PipelineRegistry::workerMain()
+{
+	for (;;)
+	{
+		PipelineKey key;
+		Variant* variant = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			workReady.wait(lock, [this] { return quit || !queue.empty(); });
+			if (quit)
+			{
+				return;
+			}
+
+			key = queue.front();
+			queue.pop_front();
+
+			variant = &variants[key];
+			if (variant->state != VariantState::Queued)
+			{
+				continue;
+			}
+			variant->state = VariantState::Compiling;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		vk::Pipeline pipeline;
+		try
+		{
+			pipeline = build(key);
+		}
+		catch (const std::exception& e)
+		{
+			// Nobody is waiting on a background compile; keep the error for getBlocking()
+			std::cout << "pipeline registry: a variant failed to compile, get() keeps using its generic fallback: " << e.what() << std::endl;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				variant->state = VariantState::Failed;
+				variant->error = std::current_exception();
+				++failedBuilds;
+			}
+			variantReady.notify_all();
+			continue;
+		}
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			variant->pipeline = pipeline;
+			variant->state = VariantState::Ready;
+			++backgroundBuilds;
+			backgroundMilliseconds += milliseconds;
+		}
+		variantReady.notify_all();
+	}
+}
+
+vk::Pipeline PipelineRegistry::build(const PipelineKey& key)
+{
+	// Every set constant goes to both stages; a stage ignores ids it doesn't declare
+	std::vector<vk::SpecializationMapEntry> mapEntries;
+	std::vector<uint32_t> values;
+	for (uint32_t id = 0; id < PipelineKey::maxSpecializationConstants; ++id)
+	{
+		if (key.specializedMask & (1u << id))
+		{
+			mapEntries.push_back(vk::SpecializationMapEntry(id, static_cast<uint32_t>(values.size() * sizeof(uint32_t)), sizeof(uint32_t)));
+			values.push_back(key.specialization[id]);
+		}
+	}
+
+	vk::SpecializationInfo specializationInfo = vk::SpecializationInfo()
+		.setMapEntryCount(static_cast<uint32_t>(mapEntries.size()))
+		.setPMapEntries(mapEntries.data())
+		.setDataSize(values.size() * sizeof(uint32_t))
+		.setPData(values.data());
+
+	const vk::SpecializationInfo* specialization = mapEntries.empty() ? nullptr : &specializationInfo;
+
+	vk::PipelineShaderStageCreateInfo shaderStages[] = {
+		vk::PipelineShaderStageCreateInfo()
+			.setStage(vk::ShaderStageFlagBits::eVertex)
+			.setModule(shared.vertexShader)
+			.setPName("main")
+			.setPSpecializationInfo(specialization),
+		vk::PipelineShaderStageCreateInfo()
+			.setStage(vk::ShaderStageFlagBits::eFragment)
+			.setModule(shared.fragmentShader)
+			.setPName("main")
+			.setPSpecializationInfo(specialization),
+	};
+
+	vk::PipelineVertexInputStateCreateInfo vertexInputInfo = vk::PipelineVertexInputStateCreateInfo()
+		.setVertexBindingDescriptionCount(static_cast<uint32_t>(shared.vertexBindings.size()))
+		.setPVertexBindingDescriptions(shared.vertexBindings.data())
+		.setVertexAttributeDescriptionCount(static_cast<uint32_t>(shared.vertexAttributes.size()))
+		.setPVertexAttributeDescriptions(shared.vertexAttributes.data());
+
+	vk::PipelineInputAssemblyStateCreateInfo inputAssemblyInfo = vk::PipelineInputAssemblyStateCreateInfo()
+		.setTopology(key.topology)
+		.setPrimitiveRestartEnable(VK_FALSE);
+
+	// Viewport and scissor are set when recording, so a resize doesn't mean a new pipeline
+	vk::PipelineViewportStateCreateInfo viewportInfo = vk::PipelineViewportStateCreateInfo()
+		.setViewportCount(1)
+		.setPViewports(nullptr)
+		.setScissorCount(1)
+		.setPScissors(nullptr);
+
+	vk::DynamicState dynamicStates[] = { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+
+	vk::PipelineDynamicStateCreateInfo dynamicStateInfo = vk::PipelineDynamicStateCreateInfo()
+		.setDynamicStateCount(2)
+		.setPDynamicStates(dynamicStates);
+
+	vk::PipelineRasterizationStateCreateInfo rasterizerInfo = vk::PipelineRasterizationStateCreateInfo()
+		.setDepthClampEnable(VK_FALSE)
+		.setRasterizerDiscardEnable(VK_FALSE)
+		.setPolygonMode(key.polygonMode)
+		.setLineWidth(1.0f)
+		.setCullMode(key.cullMode)
+		.setFrontFace(key.frontFace)
+		.setDepthBiasEnable(VK_FALSE)
+		.setDepthBiasConstantFactor(0.0f)
+		.setDepthBiasClamp(0.0f)
+		.setDepthBiasSlopeFactor(0.0f);
+
+	vk::PipelineMultisampleStateCreateInfo multisamplingInfo = vk::PipelineMultisampleStateCreateInfo()
+		.setSampleShadingEnable(VK_FALSE)
+		.setRasterizationSamples(vk::SampleCountFlagBits::e1)
+		.setMinSampleShading(1.0f)
+		.setPSampleMask(nullptr)
+		.setAlphaToCoverageEnable(VK_FALSE)
+		.setAlphaToOneEnable(VK_FALSE);
+
+	vk::PipelineColorBlendAttachmentState colorBlendAttachment = vk::PipelineColorBlendAttachmentState()
+		.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)
+		.setBlendEnable(VK_FALSE)
+		.setSrcColorBlendFactor(vk::BlendFactor::eOne)
+		.setDstColorBlendFactor(vk::BlendFactor::eZero)
+		.setColorBlendOp(vk::BlendOp::eAdd)
+		.setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
+		.setDstAlphaBlendFactor(vk::BlendFactor::eZero)
+		.setAlphaBlendOp(vk::BlendOp::eAdd);
+
+	switch (key.blend)
+	{
+	case BlendMode::Opaque:
+		break;
+
+	case BlendMode::Alpha:
+		colorBlendAttachment
+			.setBlendEnable(VK_TRUE)
+			.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+			.setDstColorBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha)
+			.setDstAlphaBlendFactor(vk::BlendFactor::eOneMinusSrcAlpha);
+		break;
+
+	case BlendMode::Additive:
+		colorBlendAttachment
+			.setBlendEnable(VK_TRUE)
+			.setSrcColorBlendFactor(vk::BlendFactor::eSrcAlpha)
+			.setDstColorBlendFactor(vk::BlendFactor::eOne)
+			.setDstAlphaBlendFactor(vk::BlendFactor::eOne);
+		break;
+	}
+
+	vk::PipelineColorBlendStateCreateInfo colorBlendInfo = vk::PipelineColorBlendStateCreateInfo()
+		.setLogicOpEnable(VK_FALSE)
+		.setLogicOp(vk::LogicOp::eCopy)
+		.setAttachmentCount(1)
+		.setPAttachments(&colorBlendAttachment)
+		.setBlendConstants({ 0.0f, 0.0f, 0.0f, 0.0f });
+
+	vk::GraphicsPipelineCreateInfo pipelineInfo = vk::GraphicsPipelineCreateInfo()
+		.setStageCount(2)
+		.setPStages(shaderStages)
+		.setPVertexInputState(&vertexInputInfo)
+		.setPInputAssemblyState(&inputAssemblyInfo)
+		.setPViewportState(&viewportInfo)
+		.setPRasterizationState(&rasterizerInfo)
+		.setPMultisampleState(&multisamplingInfo)
+		.setPDepthStencilState(nullptr)
+		.setPColorBlendState(&colorBlendInfo)
+		.setPDynamicState(&dynamicStateInfo)
+		.setLayout(shared.layout)
+		.setRenderPass(shared.renderPass)
+		.setSubpass(0)
+		.setBasePipelineHandle(VK_NULL_HANDLE)
+		.setBasePipelineIndex(-1);
+
+	return pipelineCache.createGraphicsPipeline(pipelineInfo);
+}
+
+void PipelineRegistry::logStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::cout << "pipeline registry: " << backgroundBuilds << " variants built in the background ("
+		<< backgroundMilliseconds << "ms), " << blockingBuilds << " on demand (" << blockingMilliseconds << "ms), "
+		<< failedBuilds << " failed, " << fallbackFrames << " frames fell back to a generic variant" << std::endl;
+}
+
+void PipelineRegistry::destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+		queue.clear();
+	}
+	workReady.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+
+	for (auto& entry : variants)
+	{
+		if (entry.second.pipeline)
+		{
+			device.destroyPipeline(entry.second.pipeline);
+		}
+	}
+	variants.clear();
+}
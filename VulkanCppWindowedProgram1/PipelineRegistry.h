@@ -0,0 +1,135 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "PipelineCache.h"
+
+enum class BlendMode
+{
+	Opaque,
+	Alpha,		// src over dst by source alpha
+	Additive	// src + dst, for glowing, overlapping things such as particles
+};
+
+// Accepts "opaque", "alpha" or "additive". Returns false for anything else.
+bool parseBlendMode(const std::string& name, BlendMode& mode);
+
+// Everything that distinguishes one graphics pipeline variant from another: the fixed-function
+// state that tends to change between materials, and the values of the shaders' specialization
+// constants. A key with no constants set is the generic variant, which runs the shaders with
+// the defaults they were compiled with.
+struct PipelineKey
+{
+	static const uint32_t maxSpecializationConstants = 4;
+
+	vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+	vk::PolygonMode polygonMode = vk::PolygonMode::eFill;
+	vk::CullModeFlagBits cullMode = vk::CullModeFlagBits::eBack;
+	vk::FrontFace frontFace = vk::FrontFace::eClockwise;
+	BlendMode blend = BlendMode::Opaque;
+
+	// Bit n set means constant_id n is specialized to specialization[n]
+	uint32_t specializedMask = 0;
+	uint32_t specialization[maxSpecializationConstants] = {};
+
+	PipelineKey& specialize(uint32_t constantId, uint32_t value);
+
+	// The same fixed-function state with every constant left at its default
+	PipelineKey generic() const;
+
+	uint64_t hash() const;
+	bool operator==(const PipelineKey& other) const;
+};
+
+struct PipelineKeyHash
+{
+	size_t operator()(const PipelineKey& key) const { return static_cast<size_t>(key.hash()); }
+};
+
+// What every variant has in common. The vertex layout is copied; the modules, layout and
+// render pass must outlive the registry.
+struct GraphicsPipelineShared
+{
+	vk::ShaderModule vertexShader;
+	vk::ShaderModule fragmentShader;
+	std::vector<vk::VertexInputBindingDescription> vertexBindings;
+	std::vector<vk::VertexInputAttributeDescription> vertexAttributes;
+	vk::PipelineLayout layout;
+	vk::RenderPass renderPass;
+};
+
+// Builds graphics pipelines by key, once each, through the pipeline cache. Specialized variants
+// compile on a pool of background threads; until one is ready, asking for it returns the generic
+// variant with the same fixed-function state, so a new permutation never stalls a frame. Only a
+// fixed-function combination nobody has asked for before is compiled on the calling thread.
+class PipelineRegistry
+{
+public:
+	PipelineRegistry(vk::Device device, PipelineCache& pipelineCache, const GraphicsPipelineShared& shared, uint32_t threadCount);
+
+	// The variant for key if it's built, otherwise its generic fallback. Call every frame;
+	// the result changes once the background compile finishes.
+	vk::Pipeline get(const PipelineKey& key);
+
+	// Starts compiling key in the background without waiting for it.
+	void prefetch(const PipelineKey& key);
+
+	// Returns the variant for key, compiling it here (or waiting for a worker) if it isn't built yet.
+	// Throws what the compile threw if it failed, here or in the background.
+	vk::Pipeline getBlocking(const PipelineKey& key);
+
+	void logStats() const;
+
+	// Waits for any compile in progress, then destroys every pipeline built.
+	void destroy();
+
+private:
+	enum class VariantState
+	{
+		Queued,
+		Compiling,
+		Ready,
+		Failed		// build() threw; getBlocking() rethrows, get() keeps falling back
+	};
+
+	struct Variant
+	{
+		VariantState state = VariantState::Queued;
+		vk::Pipeline pipeline;
+		std::exception_ptr error;
+	};
+
+	vk::Pipeline build(const PipelineKey& key);
+	void workerMain();
+
+	vk::Device device;
+	PipelineCache& pipelineCache;
+	GraphicsPipelineShared shared;
+
+	std::vector<std::thread> workers;
+
+	mutable std::mutex mutex;
+	std::condition_variable workReady;
+	std::condition_variable variantReady;
+	std::deque<PipelineKey> queue;
+	std::unordered_map<PipelineKey, Variant, PipelineKeyHash> variants;
+	bool quit = false;
+
+	uint32_t backgroundBuilds = 0;
+	uint32_t blockingBuilds = 0;
+	uint32_t failedBuilds = 0;
+	uint64_t fallbackFrames = 0;
+	double backgroundMilliseconds = 0.0;
+	double blockingMilliseconds = 0.0;
+};
@@ -0,0 +1,170 @@
+#include "PresentPolicy.h"
+
+#include <algorithm>
+#include <thread>
+
+bool parsePresentPolicy(const std::string& name, PresentPolicy& policy)
+{
+	if (name == "low-latency")
+	{
+		policy = PresentPolicy::LowLatency;
+	}
+	else if (name == "vsync")
+	{
+		policy = PresentPolicy::Vsync;
+	}
+	else if (name == "uncapped")
+	{
+		policy = PresentPolicy::Uncapped;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+const char* presentPolicyName(PresentPolicy policy)
+{
+	switch (policy)
+	{
+	case PresentPolicy::LowLatency:
+		return "low-latency";
+	case PresentPolicy::Vsync:
+		return "vsync";
+	case PresentPolicy::Uncapped:
+		return "uncapped";
+	}
+	return "unknown";
+}
+
+vk::PresentModeKHR choosePresentMode(PresentPolicy policy, const std::vector<vk::PresentModeKHR>& available)
+{
+	auto supported = [&](vk::PresentModeKHR mode)
+	{
+		return std::find(available.begin(), available.end(), mode) != available.end();
+	};
+
+	switch (policy)
+	{
+	case PresentPolicy::LowLatency:
+		// Mailbox always shows the newest finished frame without tearing; the pacer keeps us from
+		// rendering frames that get thrown away. Without it FIFO plus the pacer is the next best thing.
+		if (supported(vk::PresentModeKHR::eMailbox))
+		{
+			return vk::PresentModeKHR::eMailbox;
+		}
+		break;
+
+	case PresentPolicy::Vsync:
+		break;
+
+	case PresentPolicy::Uncapped:
+		if (supported(vk::PresentModeKHR::eImmediate))
+		{
+			return vk::PresentModeKHR::eImmediate;
+		}
+		if (supported(vk::PresentModeKHR::eMailbox))
+		{
+			return vk::PresentModeKHR::eMailbox;
+		}
+		break;
+	}
+
+	return vk::PresentModeKHR::eFifo;
+}
+
+vk::SurfaceFormatKHR chooseSurfaceFormat(const std::vector<vk::SurfaceFormatKHR>& available)
+{
+	vk::SurfaceFormatKHR preferred;
+	preferred.format = vk::Format::eB8G8R8A8Unorm;
+	preferred.colorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
+
+	// A single undefined entry means the surface takes whatever we give it
+	if (available.empty() || (available.size() == 1 && available[0].format == vk::Format::eUndefined))
+	{
+		return preferred;
+	}
+
+	for (vk::Format format : { vk::Format::eB8G8R8A8Unorm, vk::Format::eR8G8B8A8Unorm })
+	{
+		for (const auto& candidate : available)
+		{
+			if (candidate.format == format && candidate.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear)
+			{
+				return candidate;
+			}
+		}
+	}
+
+	return available[0];
+}
+
+uint32_t chooseImageCount(PresentPolicy policy, vk::PresentModeKHR presentMode, const vk::SurfaceCapabilitiesKHR& capabilities)
+{
+	uint32_t imageCount = capabilities.minImageCount;
+
+	if (presentMode == vk::PresentModeKHR::eMailbox)
+	{
+		// One on screen, one queued, one to render into
+		imageCount = (std::max)(imageCount, 3u);
+	}
+	else if (policy != PresentPolicy::LowLatency)
+	{
+		// Keep one image queued so acquire doesn't wait on scanout
+		imageCount = imageCount + 1;
+	}
+
+	if (capabilities.maxImageCount > 0 && imageCount > capabilities.maxImageCount)
+	{
+		imageCount = capabilities.maxImageCount;
+	}
+
+	return imageCount;
+}
+
+FramePacer::FramePacer(double targetFps)
+{
+	setTargetFps(targetFps);
+}
+
+void FramePacer::setTargetFps(double targetFps)
+{
+	target = targetFps;
+	interval = target > 0.0
+		? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / target))
+		: Clock::duration::zero();
+	nextFrame = Clock::now();
+}
+
+void FramePacer::wait()
+{
+	lastWait = 0.0;
+	if (interval == Clock::duration::zero())
+	{
+		return;
+	}
+
+	Clock::time_point now = Clock::now();
+	if (now < nextFrame)
+	{
+		// The OS sleep overshoots by up to a scheduler tick, so sleep short and spin the rest
+		Clock::time_point sleepUntil = nextFrame - std::chrono::milliseconds(1);
+		if (now < sleepUntil)
+		{
+			std::this_thread::sleep_until(sleepUntil);
+		}
+		while (Clock::now() < nextFrame)
+		{
+			std::this_thread::yield();
+		}
+
+		lastWait = std::chrono::duration<double, std::milli>(Clock::now() - now).count();
+		nextFrame += interval;
+	}
+	else
+	{
+		// Fell behind; start a fresh schedule from here rather than rushing to catch up
+		nextFrame = now + interval;
+	}
+}
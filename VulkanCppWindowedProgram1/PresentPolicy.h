@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What we want out of presentation. Each policy maps onto whichever present mode the surface
+// actually supports, and decides how many swapchain images and how much CPU pacing we use.
+enum class PresentPolicy
+{
+	LowLatency,	// newest frame on screen as soon as possible, no tearing, CPU paced to the display
+	Vsync,		// FIFO with a deep queue, for smooth throughput
+	Uncapped	// as many frames as the GPU can render, tearing allowed; for benchmarking
+};
+
+// Accepts "low-latency", "vsync" or "uncapped". Returns false for anything else.
+bool parsePresentPolicy(const std::string& name, PresentPolicy& policy);
+const char* presentPolicyName(PresentPolicy policy);
+
+// FIFO is the only mode the spec guarantees, so this always returns something usable.
+vk::PresentModeKHR choosePresentMode(PresentPolicy policy, const std::vector<vk::PresentModeKHR>& available);
+
+// Prefers 8-bit BGRA/RGBA UNORM in sRGB nonlinear space; falls back to the first format offered.
+vk::SurfaceFormatKHR chooseSurfaceFormat(const std::vector<vk::SurfaceFormatKHR>& available);
+
+// Mailbox needs a spare image to replace, FIFO throughput wants one queued behind the one being
+// scanned out, and low-latency FIFO wants as few images between the CPU and the display as we can get.
+uint32_t chooseImageCount(PresentPolicy policy, vk::PresentModeKHR presentMode, const vk::SurfaceCapabilitiesKHR& capabilities);
+
+// Keeps the CPU from running ahead of the display. wait() sleeps until the next frame slot, so
+// input is sampled as late as possible instead of frames piling up behind a blocking present.
+class FramePacer
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// A target of 0 fps disables pacing.
+	explicit FramePacer(double targetFps = 0.0);
+
+	void setTargetFps(double targetFps);
+	double targetFps() const { return target; }
+
+	// Call at the start of a frame, before polling input.
+	void wait();
+
+	// Milliseconds spent sleeping in the last wait().
+	double lastWaitMilliseconds() const { return lastWait; }
+
+private:
+	double target;
+	Clock::duration interval;
+	Clock::time_point nextFrame;
+	double lastWait = 0.0;
+};
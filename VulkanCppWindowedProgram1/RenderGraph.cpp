@@ -0,0 +1,778 @@
+#include "RenderGraph.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	struct UsageInfo
+	{
+		vk::PipelineStageFlags stages;
+		vk::AccessFlags access;
+		vk::ImageLayout layout;
+	};
+
+	UsageInfo usageInfo(ResourceUsage usage)
+	{
+		switch (usage)
+		{
+		case ResourceUsage::ColorAttachment:
+			return { vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal };
+		case ResourceUsage::DepthAttachment:
+			return { vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests, vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite, vk::ImageLayout::eDepthStencilAttachmentOptimal };
+		case ResourceUsage::SampledFragment:
+			return { vk::PipelineStageFlagBits::eFragmentShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eShaderReadOnlyOptimal };
+		case ResourceUsage::StorageRead:
+			return { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral };
+		case ResourceUsage::StorageWrite:
+			return { vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite, vk::ImageLayout::eGeneral };
+		case ResourceUsage::VertexStorageRead:
+			return { vk::PipelineStageFlagBits::eVertexShader, vk::AccessFlagBits::eShaderRead, vk::ImageLayout::eGeneral };
+		case ResourceUsage::VertexBuffer:
+			return { vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead, vk::ImageLayout::eUndefined };
+		case ResourceUsage::IndirectBuffer:
+			return { vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead, vk::ImageLayout::eUndefined };
+		case ResourceUsage::TransferSource:
+			return { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead, vk::ImageLayout::eTransferSrcOptimal };
+		case ResourceUsage::TransferDestination:
+			return { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferWrite, vk::ImageLayout::eTransferDstOptimal };
+		case ResourceUsage::None:
+			break;
+		}
+		return { vk::PipelineStageFlags(), vk::AccessFlags(), vk::ImageLayout::eUndefined };
+	}
+
+	const vk::AccessFlags writeAccessMask = vk::AccessFlagBits::eShaderWrite | vk::AccessFlagBits::eColorAttachmentWrite
+		| vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eTransferWrite
+		| vk::AccessFlagBits::eHostWrite | vk::AccessFlagBits::eMemoryWrite;
+
+	bool isAttachment(ResourceUsage usage)
+	{
+		return usage == ResourceUsage::ColorAttachment || usage == ResourceUsage::DepthAttachment;
+	}
+
+	bool isDepthFormat(vk::Format format)
+	{
+		switch (format)
+		{
+		case vk::Format::eD16Unorm:
+		case vk::Format::eX8D24UnormPack32:
+		case vk::Format::eD32Sfloat:
+		case vk::Format::eD16UnormS8Uint:
+		case vk::Format::eD24UnormS8Uint:
+		case vk::Format::eD32SfloatS8Uint:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	vk::ImageAspectFlags aspectFor(vk::Format format)
+	{
+		return isDepthFormat(format) ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor;
+	}
+
+	// Where, and how, whoever takes an imported image after us will use it
+	UsageInfo finalUsage(vk::ImageLayout layout)
+	{
+		switch (layout)
+		{
+		case vk::ImageLayout::ePresentSrcKHR:
+			// The present semaphore takes care of visibility
+			return { vk::PipelineStageFlagBits::eBottomOfPipe, vk::AccessFlags(), layout };
+		case vk::ImageLayout::eTransferSrcOptimal:
+			return { vk::PipelineStageFlagBits::eTransfer, vk::AccessFlagBits::eTransferRead, layout };
+		case vk::ImageLayout::eShaderReadOnlyOptimal:
+			return { vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead, layout };
+		default:
+			return { vk::PipelineStageFlagBits::eAllCommands, vk::AccessFlagBits::eMemoryRead, layout };
+		}
+	}
+}
+
+RenderGraphPass& RenderGraphPass::read(RenderResource resource, ResourceUsage usage)
+{
+	accesses.push_back({ resource, usage, false, false, vk::ClearValue() });
+	return *this;
+}
+
+RenderGraphPass& RenderGraphPass::write(RenderResource resource, ResourceUsage usage)
+{
+	accesses.push_back({ resource, usage, true, false, vk::ClearValue() });
+	return *this;
+}
+
+RenderGraphPass& RenderGraphPass::clear(RenderResource resource, ResourceUsage usage, vk::ClearValue value)
+{
+	accesses.push_back({ resource, usage, true, true, value });
+	return *this;
+}
+
+RenderGraph::RenderGraph(vk::Device device, MemoryAllocator& allocator)
+	: device(device), allocator(allocator)
+{
+}
+
+RenderResource RenderGraph::importImage(const std::string& name, vk::Format format, vk::Extent2D extent, vk::ImageLayout initialLayout, vk::ImageLayout finalLayout, vk::PipelineStageFlags initialStage)
+{
+	Resource resource;
+	resource.name = name;
+	resource.isImage = true;
+	resource.imported = true;
+	resource.format = format;
+	resource.extent = extent;
+	resource.finalLayout = finalLayout;
+	resource.initialState.writeStages = initialStage;
+	resource.initialState.layout = initialLayout;
+
+	resources.push_back(resource);
+	return static_cast<RenderResource>(resources.size() - 1);
+}
+
+void RenderGraph::bindImage(RenderResource resource, vk::Image image, vk::ImageView view)
+{
+	resources[resource].image = image;
+	resources[resource].view = view;
+}
+
+RenderResource RenderGraph::importBuffer(const std::string& name, ResourceUsage lastUsage)
+{
+	Resource resource;
+	resource.name = name;
+	resource.imported = true;
+
+	UsageInfo last = usageInfo(lastUsage);
+	if (last.access & writeAccessMask)
+	{
+		resource.initialState.writeStages = last.stages;
+		resource.initialState.writeAccess = last.access & writeAccessMask;
+	}
+	else
+	{
+		resource.initialState.readStages = last.stages;
+	}
+
+	resources.push_back(resource);
+	return static_cast<RenderResource>(resources.size() - 1);
+}
+
+RenderResource RenderGraph::createImage(const std::string& name, const TransientImageDesc& desc)
+{
+	Resource resource;
+	resource.name = name;
+	resource.isImage = true;
+	resource.format = desc.format;
+	resource.extent = desc.extent;
+	resource.usage = desc.usage;
+
+	resources.push_back(resource);
+	return static_cast<RenderResource>(resources.size() - 1);
+}
+
+RenderGraphPass& RenderGraph::addGraphicsPass(const std::string& name, RenderGraphPass::Record record)
+{
+	passes.push_back(RenderGraphPass());
+	passes.back().name = name;
+	passes.back().graphics = true;
+	passes.back().record = record;
+	return passes.back();
+}
+
+RenderGraphPass& RenderGraph::addComputePass(const std::string& name, RenderGraphPass::Record record)
+{
+	passes.push_back(RenderGraphPass());
+	passes.back().name = name;
+	passes.back().record = record;
+	return passes.back();
+}
+
+void RenderGraph::cullPasses(std::vector<bool>& kept) const
+{
+	// Walk backwards from what leaves the graph: imported resources and side effects. A pass
+	// survives if it writes something a surviving pass (or the outside world) needs.
+	std::vector<bool> needed(resources.size());
+	for (size_t r = 0; r < resources.size(); ++r)
+	{
+		needed[r] = resources[r].imported;
+	}
+
+	kept.assign(passes.size(), false);
+	for (size_t p = passes.size(); p-- > 0;)
+	{
+		const RenderGraphPass& pass = passes[p];
+
+		bool keep = pass.keepAlways;
+		for (const auto& access : pass.accesses)
+		{
+			keep = keep || (access.write && needed[access.resource]);
+		}
+
+		if (!keep)
+		{
+			continue;
+		}
+
+		kept[p] = true;
+		for (const auto& access : pass.accesses)
+		{
+			// Anything but a clear depends on whatever was there before
+			if (!access.cleared)
+			{
+				needed[access.resource] = true;
+			}
+		}
+	}
+}
+
+void RenderGraph::allocateTransients()
+{
+	std::vector<RenderResource> transients;
+	for (RenderResource r = 0; r < resources.size(); ++r)
+	{
+		Resource& resource = resources[r];
+		if (resource.imported || !resource.isImage || resource.firstPass == UINT32_MAX)
+		{
+			continue;
+		}
+
+		// Attachments that never leave the render passes can live in lazily allocated memory
+		vk::ImageUsageFlags attachmentUsage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eInputAttachment;
+		bool attachmentOnly = !(resource.usage & ~attachmentUsage);
+
+		vk::ImageCreateInfo imageInfo = vk::ImageCreateInfo()
+			.setImageType(vk::ImageType::e2D)
+			.setFormat(resource.format)
+			.setExtent(vk::Extent3D(resource.extent.width, resource.extent.height, 1))
+			.setMipLevels(1)
+			.setArrayLayers(1)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setTiling(vk::ImageTiling::eOptimal)
+			.setUsage(attachmentOnly ? resource.usage | vk::ImageUsageFlagBits::eTransientAttachment : resource.usage)
+			.setSharingMode(vk::SharingMode::eExclusive)
+			.setInitialLayout(vk::ImageLayout::eUndefined);
+
+		resource.image = device.createImage(imageInfo);
+		resource.usage = imageInfo.usage;
+		transients.push_back(r);
+	}
+
+	// Place the biggest images first, so smaller ones fill in around them
+	std::vector<vk::MemoryRequirements> requirements(resources.size());
+	for (RenderResource r : transients)
+	{
+		requirements[r] = device.getImageMemoryRequirements(resources[r].image);
+		transientBytes += requirements[r].size;
+	}
+	std::sort(transients.begin(), transients.end(), [&](RenderResource a, RenderResource b) { return requirements[a].size > requirements[b].size; });
+
+	for (RenderResource r : transients)
+	{
+		Resource& resource = resources[r];
+		const vk::MemoryRequirements& required = requirements[r];
+		bool lazy = (resource.usage & vk::ImageUsageFlagBits::eTransientAttachment) == vk::ImageUsageFlagBits::eTransientAttachment;
+
+		int32_t chosen = -1;
+		for (size_t s = 0; s < memorySlots.size() && chosen < 0; ++s)
+		{
+			MemorySlot& slot = memorySlots[s];
+			if (!(slot.requirements.memoryTypeBits & required.memoryTypeBits) || slot.lazy != lazy)
+			{
+				continue;
+			}
+
+			bool overlaps = false;
+			for (const auto& lifetime : slot.lifetimes)
+			{
+				overlaps = overlaps || (resource.firstPass <= lifetime.second && lifetime.first <= resource.lastPass);
+			}
+			if (!overlaps)
+			{
+				chosen = static_cast<int32_t>(s);
+			}
+		}
+
+		if (chosen < 0)
+		{
+			MemorySlot slot;
+			slot.requirements = required;
+			slot.lazy = lazy;
+			memorySlots.push_back(slot);
+			chosen = static_cast<int32_t>(memorySlots.size() - 1);
+		}
+		else
+		{
+			MemorySlot& slot = memorySlots[chosen];
+			slot.requirements.size = (std::max)(slot.requirements.size, required.size);
+			slot.requirements.alignment = (std::max)(slot.requirements.alignment, required.alignment);
+			slot.requirements.memoryTypeBits &= required.memoryTypeBits;
+		}
+
+		memorySlots[chosen].lifetimes.push_back(std::make_pair(resource.firstPass, resource.lastPass));
+		resource.memorySlot = chosen;
+	}
+
+	for (auto& slot : memorySlots)
+	{
+		slot.allocation = allocator.allocate(slot.requirements, slot.lazy ? MemoryUsage::GpuLazy : MemoryUsage::GpuOnly, false);
+		aliasedBytes += slot.requirements.size;
+	}
+
+	for (RenderResource r : transients)
+	{
+		Resource& resource = resources[r];
+		Allocation* allocation = memorySlots[resource.memorySlot].allocation;
+		device.bindImageMemory(resource.image, allocation->memory, allocation->offset);
+
+		vk::ImageViewCreateInfo viewInfo = vk::ImageViewCreateInfo()
+			.setImage(resource.image)
+			.setViewType(vk::ImageViewType::e2D)
+			.setFormat(resource.format)
+			.setSubresourceRange(vk::ImageSubresourceRange(aspectFor(resource.format), 0, 1, 0, 1));
+
+		resource.view = device.createImageView(viewInfo);
+	}
+}
+
+void RenderGraph::addBarrier(BarrierBatch& batch, RenderResource resource, ResourceState& state, vk::PipelineStageFlags stages, vk::AccessFlags access, vk::ImageLayout layout, bool write)
+{
+	bool isImage = resources[resource].isImage;
+	bool layoutChange = isImage && state.layout != layout;
+
+	if (write || layoutChange)
+	{
+		// Wait for every earlier write and read (write-after-read only needs the execution dependency)
+		vk::PipelineStageFlags srcStages = state.writeStages | state.readStages;
+		if (srcStages || layoutChange)
+		{
+			batch.srcStages |= srcStages ? srcStages : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe);
+			batch.dstStages |= stages;
+
+			if (isImage)
+			{
+				batch.imageBarriers.push_back({ resource, state.writeAccess, access, state.layout, layout });
+			}
+			else if (state.writeAccess)
+			{
+				batch.memorySrcAccess |= state.writeAccess;
+				batch.memoryDstAccess |= access;
+			}
+		}
+
+		ResourceState next;
+		next.layout = layout;
+		if (write)
+		{
+			next.writeStages = stages;
+			next.writeAccess = access & writeAccessMask;
+		}
+		else
+		{
+			// The transition itself is the last write. This read has already seen it, but a read
+			// in any other stage still has to wait for it, and a write after it for this read.
+			next.writeStages = stages;
+			next.readStages = stages;
+			next.visibleStages = stages;
+			next.visibleAccess = access;
+		}
+		state = next;
+		return;
+	}
+
+	// A read: only needs a barrier if the last write hasn't been made visible to this stage yet
+	bool unseenStages = static_cast<bool>(stages & ~state.visibleStages);
+	bool unseenAccess = static_cast<bool>(state.writeAccess) && static_cast<bool>(access & ~state.visibleAccess);
+	if (state.writeStages && (unseenStages || unseenAccess))
+	{
+		batch.srcStages |= state.writeStages;
+		batch.dstStages |= stages;
+
+		if (isImage)
+		{
+			batch.imageBarriers.push_back({ resource, state.writeAccess, access, state.layout, layout });
+		}
+		else if (state.writeAccess)
+		{
+			batch.memorySrcAccess |= state.writeAccess;
+			batch.memoryDstAccess |= access;
+		}
+
+		state.visibleStages |= stages;
+		state.visibleAccess |= access;
+	}
+	state.readStages |= stages;
+}
+
+void RenderGraph::compile()
+{
+	std::vector<bool> kept;
+	cullPasses(kept);
+
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		if (!kept[p])
+		{
+			++culledPasses;
+			continue;
+		}
+
+		for (const auto& access : passes[p].accesses)
+		{
+			Resource& resource = resources[access.resource];
+			if (resource.firstPass == UINT32_MAX && !resource.imported && !access.write)
+			{
+				throw std::runtime_error("render graph: pass " + passes[p].name + " reads " + resource.name + " before anything writes it!");
+			}
+			resource.firstPass = (std::min)(resource.firstPass, p);
+			resource.lastPass = (std::max)(resource.lastPass, p);
+		}
+	}
+
+	allocateTransients();
+
+	std::vector<ResourceState> states(resources.size());
+	for (size_t r = 0; r < resources.size(); ++r)
+	{
+		states[r] = resources[r].initialState;
+	}
+
+	// Where each memory slot's previous occupant was last used; the next one has to wait for it.
+	// Executions overlap on the GPU, so the first occupant of a slot also waits for how the last
+	// one used it in the previous execution, submitted earlier on the same queue.
+	std::vector<ResourceState> slotStates(memorySlots.size());
+	std::vector<RenderResource> lastOccupant(memorySlots.size(), UINT32_MAX);
+	for (RenderResource r = 0; r < resources.size(); ++r)
+	{
+		int32_t slot = resources[r].memorySlot;
+		if (slot >= 0 && (lastOccupant[slot] == UINT32_MAX || resources[r].firstPass > resources[lastOccupant[slot]].firstPass))
+		{
+			lastOccupant[slot] = r;
+		}
+	}
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		for (const auto& access : passes[p].accesses)
+		{
+			int32_t slot = resources[access.resource].memorySlot;
+			if (!kept[p] || slot < 0 || lastOccupant[slot] != access.resource)
+			{
+				continue;
+			}
+
+			UsageInfo info = usageInfo(access.usage);
+			slotStates[slot].readStages |= info.stages;
+			if (access.write)
+			{
+				slotStates[slot].writeStages |= info.stages;
+				slotStates[slot].writeAccess |= info.access & writeAccessMask;
+			}
+		}
+	}
+
+	for (uint32_t p = 0; p < passes.size(); ++p)
+	{
+		if (!kept[p])
+		{
+			continue;
+		}
+
+		const RenderGraphPass& pass = passes[p];
+		CompiledPass compiledPass;
+		compiledPass.pass = p;
+
+		// A pass may touch a resource more than once (e.g. written by a copy and a shader); merge them
+		std::vector<RenderResource> touched;
+		std::map<RenderResource, UsageInfo> combined;
+		std::map<RenderResource, bool> written;
+		for (const auto& access : pass.accesses)
+		{
+			UsageInfo info = usageInfo(access.usage);
+			auto found = combined.find(access.resource);
+			if (found == combined.end())
+			{
+				touched.push_back(access.resource);
+				combined[access.resource] = info;
+				written[access.resource] = access.write;
+			}
+			else
+			{
+				found->second.stages |= info.stages;
+				found->second.access |= info.access;
+				if (found->second.layout != info.layout)
+				{
+					found->second.layout = vk::ImageLayout::eGeneral;
+				}
+				written[access.resource] = written[access.resource] || access.write;
+			}
+		}
+
+		// What each attachment held going in decides its load op
+		std::vector<ResourceState> before = states;
+
+		for (RenderResource r : touched)
+		{
+			Resource& resource = resources[r];
+			if (resource.memorySlot >= 0 && resource.firstPass == p)
+			{
+				// Aliased memory: discard whatever the previous occupant left, but only after it is done
+				states[r].writeStages = slotStates[resource.memorySlot].writeStages | slotStates[resource.memorySlot].readStages;
+				states[r].writeAccess = slotStates[resource.memorySlot].writeAccess;
+				states[r].layout = vk::ImageLayout::eUndefined;
+				before[r].layout = vk::ImageLayout::eUndefined;
+			}
+
+			addBarrier(compiledPass.barriers, r, states[r], combined[r].stages, combined[r].access, combined[r].layout, written[r]);
+
+			if (resource.memorySlot >= 0)
+			{
+				slotStates[resource.memorySlot] = states[r];
+			}
+		}
+
+		if (!compiledPass.barriers.empty())
+		{
+			barrierCount += 1;
+		}
+
+		if (pass.graphics)
+		{
+			// Stored only if someone looks at it later
+			std::vector<bool> readLater(resources.size(), false);
+			for (size_t r = 0; r < resources.size(); ++r)
+			{
+				readLater[r] = resources[r].imported || resources[r].lastPass > p;
+			}
+
+			compiledPass.renderPass = createRenderPass(pass, compiledPass, before, readLater);
+		}
+
+		compiled.push_back(compiledPass);
+	}
+
+	// Leave imported images the way their owner expects them
+	for (RenderResource r = 0; r < resources.size(); ++r)
+	{
+		const Resource& resource = resources[r];
+		if (!resource.imported || !resource.isImage || resource.finalLayout == vk::ImageLayout::eUndefined || states[r].layout == resource.finalLayout)
+		{
+			continue;
+		}
+
+		UsageInfo info = finalUsage(resource.finalLayout);
+		addBarrier(finalBarriers, r, states[r], info.stages, info.access, info.layout, false);
+	}
+
+	if (!finalBarriers.empty())
+	{
+		barrierCount += 1;
+	}
+}
+
+vk::RenderPass RenderGraph::createRenderPass(const RenderGraphPass& pass, CompiledPass& compiledPass, const std::vector<ResourceState>& before, const std::vector<bool>& readLater)
+{
+	std::vector<vk::AttachmentDescription> attachments;
+	std::vector<vk::AttachmentReference> colorReferences;
+	vk::AttachmentReference depthReference;
+	bool hasDepth = false;
+
+	for (const auto& access : pass.accesses)
+	{
+		if (!isAttachment(access.usage))
+		{
+			continue;
+		}
+
+		const Resource& resource = resources[access.resource];
+		vk::ImageLayout layout = usageInfo(access.usage).layout;
+
+		vk::AttachmentLoadOp loadOp = access.cleared ? vk::AttachmentLoadOp::eClear
+			: before[access.resource].layout == vk::ImageLayout::eUndefined ? vk::AttachmentLoadOp::eDontCare
+			: vk::AttachmentLoadOp::eLoad;
+		vk::AttachmentStoreOp storeOp = readLater[access.resource] ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+
+		// Layout transitions happen in the graph's barriers, so the render pass leaves layouts alone
+		attachments.push_back(vk::AttachmentDescription()
+			.setFormat(resource.format)
+			.setSamples(vk::SampleCountFlagBits::e1)
+			.setLoadOp(loadOp)
+			.setStoreOp(storeOp)
+			.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
+			.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
+			.setInitialLayout(layout)
+			.setFinalLayout(layout));
+
+		vk::AttachmentReference reference(static_cast<uint32_t>(attachments.size() - 1), layout);
+		if (access.usage == ResourceUsage::DepthAttachment)
+		{
+			depthReference = reference;
+			hasDepth = true;
+		}
+		else
+		{
+			colorReferences.push_back(reference);
+		}
+
+		compiledPass.attachments.push_back(access.resource);
+		compiledPass.clearValues.push_back(access.clearValue);
+		compiledPass.extent = resource.extent;
+	}
+
+	if (attachments.empty())
+	{
+		throw std::runtime_error("render graph: graphics pass " + pass.name + " has no attachments!");
+	}
+
+	vk::SubpassDescription subpass = vk::SubpassDescription()
+		.setPipelineBindPoint(vk::PipelineBindPoint::eGraphics)
+		.setColorAttachmentCount(static_cast<uint32_t>(colorReferences.size()))
+		.setPColorAttachments(colorReferences.data())
+		.setPDepthStencilAttachment(hasDepth ? &depthReference : nullptr);
+
+	vk::RenderPassCreateInfo renderPassInfo = vk::RenderPassCreateInfo()
+		.setAttachmentCount(static_cast<uint32_t>(attachments.size()))
+		.setPAttachments(attachments.data())
+		.setSubpassCount(1)
+		.setPSubpasses(&subpass);
+
+	return device.createRenderPass(renderPassInfo);
+}
+
+vk::Framebuffer RenderGraph::framebufferFor(const CompiledPass& compiledPass)
+{
+	std::vector<VkImageView> views;
+	for (RenderResource r : compiledPass.attachments)
+	{
+		views.push_back(static_cast<VkImageView>(resources[r].view));
+	}
+
+	auto key = std::make_pair(static_cast<VkRenderPass>(compiledPass.renderPass), views);
+	auto found = framebuffers.find(key);
+	if (found != framebuffers.end())
+	{
+		return found->second;
+	}
+
+	std::vector<vk::ImageView> attachments(views.begin(), views.end());
+
+	vk::FramebufferCreateInfo framebufferInfo = vk::FramebufferCreateInfo()
+		.setRenderPass(compiledPass.renderPass)
+		.setAttachmentCount(static_cast<uint32_t>(attachments.size()))
+		.setPAttachments(attachments.data())
+		.setWidth(compiledPass.extent.width)
+		.setHeight(compiledPass.extent.height)
+		.setLayers(1);
+
+	vk::Framebuffer framebuffer = device.createFramebuffer(framebufferInfo);
+	framebuffers[key] = framebuffer;
+	return framebuffer;
+}
+
+void RenderGraph::recordBarriers(vk::CommandBuffer commandBuffer, const BarrierBatch& batch) const
+{
+	if (batch.empty())
+	{
+		return;
+	}
+
+	std::vector<vk::MemoryBarrier> memoryBarriers;
+	if (batch.memorySrcAccess || batch.memoryDstAccess)
+	{
+		memoryBarriers.push_back(vk::MemoryBarrier(batch.memorySrcAccess, batch.memoryDstAccess));
+	}
+
+	std::vector<vk::ImageMemoryBarrier> imageBarriers;
+	for (const auto& barrier : batch.imageBarriers)
+	{
+		const Resource& resource = resources[barrier.resource];
+		imageBarriers.push_back(vk::ImageMemoryBarrier()
+			.setSrcAccessMask(barrier.srcAccess)
+			.setDstAccessMask(barrier.dstAccess)
+			.setOldLayout(barrier.oldLayout)
+			.setNewLayout(barrier.newLayout)
+			.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+			.setImage(resource.image)
+			.setSubresourceRange(vk::ImageSubresourceRange(aspectFor(resource.format), 0, 1, 0, 1)));
+	}
+
+	commandBuffer.pipelineBarrier(batch.srcStages ? batch.srcStages : vk::PipelineStageFlags(vk::PipelineStageFlagBits::eTopOfPipe), batch.dstStages, vk::DependencyFlags(), memoryBarriers, nullptr, imageBarriers);
+}
+
+void RenderGraph::execute(vk::CommandBuffer commandBuffer)
+{
+	for (const auto& compiledPass : compiled)
+	{
+		const RenderGraphPass& pass = passes[compiledPass.pass];
+
+		recordBarriers(commandBuffer, compiledPass.barriers);
+
+		RenderPassContext context;
+		if (!pass.graphics)
+		{
+			pass.record(commandBuffer, context);
+			continue;
+		}
+
+		context.renderPass = compiledPass.renderPass;
+		context.framebuffer = framebufferFor(compiledPass);
+		context.extent = compiledPass.extent;
+		if (renderArea.width && renderArea.height)
+		{
+			context.extent.width = (std::min)(renderArea.width, context.extent.width);
+			context.extent.height = (std::min)(renderArea.height, context.extent.height);
+		}
+
+		vk::RenderPassBeginInfo beginInfo = vk::RenderPassBeginInfo()
+			.setRenderPass(context.renderPass)
+			.setFramebuffer(context.framebuffer)
+			.setRenderArea(vk::Rect2D(vk::Offset2D(0, 0), context.extent))
+			.setClearValueCount(static_cast<uint32_t>(compiledPass.clearValues.size()))
+			.setPClearValues(compiledPass.clearValues.data());
+
+		commandBuffer.beginRenderPass(beginInfo, pass.secondaries ? vk::SubpassContents::eSecondaryCommandBuffers : vk::SubpassContents::eInline);
+		pass.record(commandBuffer, context);
+		commandBuffer.endRenderPass();
+	}
+
+	recordBarriers(commandBuffer, finalBarriers);
+}
+
+void RenderGraph::logStats() const
+{
+	std::cout << "render graph: " << compiled.size() << " passes (" << culledPasses << " culled), "
+		<< barrierCount << " barrier batches, " << memorySlots.size() << " transient memory slots, "
+		<< transientBytes / 1024 << "KB of transient images in " << aliasedBytes / 1024 << "KB" << std::endl;
+}
+
+void RenderGraph::destroy()
+{
+	for (const auto& framebuffer : framebuffers)
+	{
+		device.destroyFramebuffer(framebuffer.second);
+	}
+	framebuffers.clear();
+
+	for (auto& compiledPass : compiled)
+	{
+		if (compiledPass.renderPass)
+		{
+			device.destroyRenderPass(compiledPass.renderPass);
+		}
+	}
+	compiled.clear();
+
+	for (auto& resource : resources)
+	{
+		if (!resource.imported && resource.image)
+		{
+			device.destroyImageView(resource.view);
+			device.destroyImage(resource.image);
+		}
+	}
+
+	for (auto& slot : memorySlots)
+	{
+		allocator.free(slot.allocation);
+	}
+	memorySlots.clear();
+}
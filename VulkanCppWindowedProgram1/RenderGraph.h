@@ -0,0 +1,233 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MemoryAllocator.h"
+
+typedef uint32_t RenderResource;
+
+// How a pass touches a resource. Each one maps onto a pipeline stage, access mask and,
+// for images, a layout; the graph derives every barrier from these.
+enum class ResourceUsage
+{
+	None,					// not touched yet
+	ColorAttachment,		// rendered to
+	DepthAttachment,
+	SampledFragment,		// sampled in a fragment shader
+	StorageRead,			// read by a compute shader
+	StorageWrite,			// written (and maybe read) by a compute shader
+	VertexStorageRead,		// read by a vertex shader, e.g. instances fetched through a bindless index
+	VertexBuffer,
+	IndirectBuffer,
+	TransferSource,
+	TransferDestination
+};
+
+// Handed to a pass when it records. Graphics passes are recorded inside the render pass
+// the graph began for them; compute passes get an empty render pass and framebuffer.
+struct RenderPassContext
+{
+	vk::RenderPass renderPass;
+	vk::Framebuffer framebuffer;
+	vk::Extent2D extent;	// the area rendered to, see RenderGraph::setRenderArea
+};
+
+// An image the graph owns. It only exists between the first and last pass that use it,
+// and shares memory with any other transient image whose lifetime doesn't overlap.
+struct TransientImageDesc
+{
+	vk::Format format;
+	vk::Extent2D extent;
+	vk::ImageUsageFlags usage;
+};
+
+// One pass in a RenderGraph. Declare everything it reads and writes before compiling.
+class RenderGraphPass
+{
+public:
+	typedef std::function<void(vk::CommandBuffer, const RenderPassContext&)> Record;
+
+	RenderGraphPass& read(RenderResource resource, ResourceUsage usage);
+	RenderGraphPass& write(RenderResource resource, ResourceUsage usage);
+
+	// Writes a color or depth attachment, clearing it first
+	RenderGraphPass& clear(RenderResource resource, ResourceUsage usage, vk::ClearValue value);
+
+	// Kept even if nothing reads what it writes
+	RenderGraphPass& sideEffect() { keepAlways = true; return *this; }
+
+	// Draws come from executeCommands rather than being recorded inline
+	RenderGraphPass& secondaryCommandBuffers() { secondaries = true; return *this; }
+
+private:
+	friend class RenderGraph;
+
+	struct Access
+	{
+		RenderResource resource;
+		ResourceUsage usage;
+		bool write;
+		bool cleared;
+		vk::ClearValue clearValue;
+	};
+
+	std::string name;
+	bool graphics = false;
+	bool keepAlways = false;
+	bool secondaries = false;
+	Record record;
+	std::vector<Access> accesses;
+};
+
+// A declarative frame: passes say what they read and write, and compile() works out the rest.
+// Passes whose output nobody consumes are culled, the remaining ones run in the order they
+// were added, and between them the graph records only the barriers and layout transitions
+// the declared accesses actually need (one vkCmdPipelineBarrier per pass at most). Graphics
+// passes get a render pass and framebuffer made for their attachments. Transient images are
+// created at compile time and alias each other's memory where their lifetimes allow.
+//
+// A graph is compiled once and executed every frame; rebuild it when its inputs change shape
+// (e.g. a swapchain resize).
+class RenderGraph
+{
+public:
+	RenderGraph(vk::Device device, MemoryAllocator& allocator);
+
+	// An image owned by someone else, such as a swapchain image. An undefined initialLayout
+	// discards its contents; it is left in finalLayout once the graph has run. initialStage is
+	// where the previous user's work (or a semaphore wait) is known to have finished.
+	RenderResource importImage(const std::string& name, vk::Format format, vk::Extent2D extent, vk::ImageLayout initialLayout, vk::ImageLayout finalLayout, vk::PipelineStageFlags initialStage = vk::PipelineStageFlagBits::eTopOfPipe);
+
+	// The actual image behind an imported resource may change between executions
+	void bindImage(RenderResource resource, vk::Image image, vk::ImageView view);
+
+	// A buffer owned by someone else. lastUsage is how the previous execution left it, so the
+	// first write of the next frame waits for the last frame's reads.
+	RenderResource importBuffer(const std::string& name, ResourceUsage lastUsage = ResourceUsage::None);
+
+	RenderResource createImage(const std::string& name, const TransientImageDesc& desc);
+
+	// Passes must be added in an order where every resource is written before it is read.
+	// The returned reference stays valid for the lifetime of the graph.
+	RenderGraphPass& addGraphicsPass(const std::string& name, RenderGraphPass::Record record);
+	RenderGraphPass& addComputePass(const std::string& name, RenderGraphPass::Record record);
+
+	void compile();
+	void execute(vk::CommandBuffer commandBuffer);
+
+	// Confines graphics passes to the top-left area of their attachments from the next
+	// execute() on, so a full-size target can be rendered at a lower resolution without
+	// recompiling. Clears only touch the area. An empty extent means the whole attachment.
+	void setRenderArea(vk::Extent2D area) { renderArea = area; }
+
+	vk::ImageView imageView(RenderResource resource) const { return resources[resource].view; }
+	vk::Image image(RenderResource resource) const { return resources[resource].image; }
+
+	void logStats() const;
+	void destroy();
+
+private:
+	struct ResourceState
+	{
+		vk::PipelineStageFlags writeStages;
+		vk::AccessFlags writeAccess;
+		vk::PipelineStageFlags readStages;
+		vk::PipelineStageFlags visibleStages;	// where the last write has been made visible
+		vk::AccessFlags visibleAccess;
+		vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+	};
+
+	struct Resource
+	{
+		std::string name;
+		bool isImage = false;
+		bool imported = false;
+
+		// Images
+		vk::Format format = vk::Format::eUndefined;
+		vk::Extent2D extent;
+		vk::ImageUsageFlags usage;
+		vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined;
+		vk::Image image;
+		vk::ImageView view;
+		int32_t memorySlot = -1;
+
+		ResourceState initialState;
+
+		// Filled in by compile()
+		uint32_t firstPass = UINT32_MAX;
+		uint32_t lastPass = 0;
+	};
+
+	struct ImageBarrier
+	{
+		RenderResource resource;
+		vk::AccessFlags srcAccess;
+		vk::AccessFlags dstAccess;
+		vk::ImageLayout oldLayout;
+		vk::ImageLayout newLayout;
+	};
+
+	struct BarrierBatch
+	{
+		vk::PipelineStageFlags srcStages;
+		vk::PipelineStageFlags dstStages;
+		vk::AccessFlags memorySrcAccess;
+		vk::AccessFlags memoryDstAccess;
+		std::vector<ImageBarrier> imageBarriers;
+
+		bool empty() const { return !srcStages && imageBarriers.empty(); }
+	};
+
+	struct CompiledPass
+	{
+		uint32_t pass;
+		BarrierBatch barriers;
+		vk::RenderPass renderPass;
+		std::vector<RenderResource> attachments;
+		std::vector<vk::ClearValue> clearValues;
+		vk::Extent2D extent;
+	};
+
+	// Memory shared by transient images with disjoint lifetimes
+	struct MemorySlot
+	{
+		vk::MemoryRequirements requirements;
+		std::vector<std::pair<uint32_t, uint32_t>> lifetimes;
+		bool lazy = true;
+		Allocation* allocation = nullptr;
+	};
+
+	void cullPasses(std::vector<bool>& kept) const;
+	void allocateTransients();
+	void addBarrier(BarrierBatch& batch, RenderResource resource, ResourceState& state, vk::PipelineStageFlags stages, vk::AccessFlags access, vk::ImageLayout layout, bool write);
+	vk::RenderPass createRenderPass(const RenderGraphPass& pass, CompiledPass& compiledPass, const std::vector<ResourceState>& before, const std::vector<bool>& readLater);
+	vk::Framebuffer framebufferFor(const CompiledPass& compiledPass);
+	void recordBarriers(vk::CommandBuffer commandBuffer, const BarrierBatch& batch) const;
+
+	vk::Device device;
+	MemoryAllocator& allocator;
+
+	std::vector<Resource> resources;
+	std::deque<RenderGraphPass> passes;
+
+	std::vector<CompiledPass> compiled;
+	BarrierBatch finalBarriers;
+	std::vector<MemorySlot> memorySlots;
+	std::map<std::pair<VkRenderPass, std::vector<VkImageView>>, vk::Framebuffer> framebuffers;
+
+	vk::Extent2D renderArea;
+
+	uint32_t culledPasses = 0;
+	uint32_t barrierCount = 0;
+	vk::DeviceSize transientBytes = 0;
+	vk::DeviceSize aliasedBytes = 0;
+};
@@ -0,0 +1,279 @@
+#include "ResidencyManager.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+	// Pressure at which cold buffers start leaving a heap, and under which evicted ones may return
+	const double evictPressure = 0.9;
+	const double restorePressure = 0.75;
+
+	vk::DeviceSize usedBytes(const HeapBudget& heap)
+	{
+		return heap.usage - (std::min)(heap.usage, heap.unusedBytes);
+	}
+}
+
+ResidencyManager::ResidencyManager(vk::Device device, MemoryAllocator& allocator, vk::Queue queue, uint32_t queueFamilyIndex, uint32_t framesInFlight, uint32_t coldFrames)
+	: device(device)
+	, allocator(allocator)
+	, queue(queue)
+	, framesInFlight(framesInFlight)
+	, coldFrames((std::max)(coldFrames, framesInFlight + 1))
+{
+	vk::CommandPoolCreateInfo poolInfo = vk::CommandPoolCreateInfo()
+		.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+		.setQueueFamilyIndex(queueFamilyIndex);
+
+	commandPool = device.createCommandPool(poolInfo);
+}
+
+ResidencyManager::Handle ResidencyManager::track(Allocation* allocation, const std::string& name)
+{
+	uint32_t typeBits = device.getBufferMemoryRequirements(allocation->buffer).memoryTypeBits;
+
+	Entry entry;
+	entry.allocation = allocation;
+	entry.name = name;
+	entry.deviceHeap = allocator.memoryProperties().memoryTypes[allocator.findMemoryType(typeBits, MemoryUsage::GpuOnly)].heapIndex;
+	entry.lastUsed = currentFrame;
+
+	// With host memory on the same heap (integrated GPUs, or no host memory the buffer can use)
+	// evicting it would free nothing
+	try
+	{
+		uint32_t hostHeap = allocator.memoryProperties().memoryTypes[allocator.findMemoryType(typeBits, MemoryUsage::CpuOnly)].heapIndex;
+		entry.evictable = hostHeap != entry.deviceHeap;
+	}
+	catch (const std::exception&)
+	{
+		entry.evictable = false;
+	}
+	entries.push_back(entry);
+	return static_cast<Handle>(entries.size() - 1);
+}
+
+void ResidencyManager::forget(Handle handle)
+{
+	entries[handle].allocation = nullptr;
+}
+
+void ResidencyManager::touch(Handle handle, uint64_t frame)
+{
+	entries[handle].lastUsed = (std::max)(entries[handle].lastUsed, frame);
+}
+
+bool ResidencyManager::update(uint64_t frame)
+{
+	currentFrame = frame;
+	retire(frame, false);
+
+	std::vector<HeapBudget> budgets = allocator.heapBudgets();
+	const vk::PhysicalDeviceMemoryProperties& properties = allocator.memoryProperties();
+
+	// Ranges that earlier moves are about to give back count as free already
+	for (const Batch& batch : batches)
+	{
+		for (const auto& range : batch.leaving)
+		{
+			budgets[range.first].unusedBytes += range.second;
+		}
+	}
+
+	// Least recently used first
+	std::vector<Handle> order;
+	for (Handle handle = 0; handle < entries.size(); ++handle)
+	{
+		if (entries[handle].allocation && entries[handle].evictable)
+		{
+			order.push_back(handle);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [this](Handle a, Handle b) { return entries[a].lastUsed < entries[b].lastUsed; });
+
+	Batch batch;
+	auto move = [&](Entry& entry, MemoryUsage usage) -> bool
+	{
+		if (!batch.commandBuffer)
+		{
+			vk::CommandBufferAllocateInfo allocateInfo = vk::CommandBufferAllocateInfo()
+				.setCommandPool(commandPool)
+				.setLevel(vk::CommandBufferLevel::ePrimary)
+				.setCommandBufferCount(1);
+
+			batch.commandBuffer = device.allocateCommandBuffers(allocateInfo)[0];
+			batch.commandBuffer.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+		}
+
+		uint32_t oldHeap = allocator.heapOf(entry.allocation);
+		DefragmentationMove moved;
+		if (!allocator.migrate(entry.allocation, usage, batch.commandBuffer, moved))
+		{
+			return false;
+		}
+
+		batch.moves.push_back(moved);
+		batch.leaving.push_back(std::make_pair(oldHeap, entry.allocation->size));
+		return true;
+	};
+
+	bool overBudget = false;
+	for (uint32_t heap = 0; heap < properties.memoryHeapCount; ++heap)
+	{
+		HeapBudget& budget = budgets[heap];
+		if (!(properties.memoryHeaps[heap].flags & vk::MemoryHeapFlagBits::eDeviceLocal) || budget.pressure() <= evictPressure)
+		{
+			continue;
+		}
+
+		for (Handle handle : order)
+		{
+			Entry& entry = entries[handle];
+			if (budget.pressure() <= evictPressure)
+			{
+				break;
+			}
+			if (allocator.heapOf(entry.allocation) != heap || frame < entry.lastUsed + coldFrames)
+			{
+				continue;
+			}
+
+			if (move(entry, MemoryUsage::CpuOnly))
+			{
+				budget.unusedBytes += entry.allocation->size;
+				++evictions;
+				evictionBytes += entry.allocation->size;
+			}
+		}
+
+		overBudget = overBudget || budget.pressure() > evictPressure;
+	}
+	if (overBudget)
+	{
+		++overBudgetFrames;
+	}
+
+	// Most recently used first, and only into room that leaves the heap comfortably under budget
+	for (auto it = order.rbegin(); it != order.rend(); ++it)
+	{
+		Entry& entry = entries[*it];
+		if (allocator.heapOf(entry.allocation) == entry.deviceHeap || frame >= entry.lastUsed + coldFrames)
+		{
+			continue;
+		}
+
+		HeapBudget& budget = budgets[entry.deviceHeap];
+		vk::DeviceSize size = entry.allocation->size;
+		if (!budget.budget || double(usedBytes(budget) + size) / double(budget.budget) > restorePressure)
+		{
+			continue;
+		}
+
+		if (move(entry, MemoryUsage::GpuOnly) && allocator.heapOf(entry.allocation) == entry.deviceHeap)
+		{
+			if (budget.unusedBytes >= size)
+			{
+				budget.unusedBytes -= size;
+			}
+			else
+			{
+				budget.usage += size;
+			}
+			++restores;
+			restoreBytes += size;
+		}
+	}
+
+	if (!batch.commandBuffer)
+	{
+		return false;
+	}
+
+	batch.commandBuffer.end();
+	if (batch.moves.empty())
+	{
+		// Every move was refused, e.g. the other heap had no room either
+		device.freeCommandBuffers(commandPool, batch.commandBuffer);
+		return false;
+	}
+
+	batch.frame = frame;
+	batch.done = device.createFence(vk::FenceCreateInfo());
+
+	vk::SubmitInfo submitInfo = vk::SubmitInfo()
+		.setCommandBufferCount(1)
+		.setPCommandBuffers(&batch.commandBuffer);
+	queue.submit(submitInfo, batch.done);
+
+	batches.push_back(batch);
+	return true;
+}
+
+void ResidencyManager::retire(uint64_t frame, bool wait)
+{
+	while (!batches.empty())
+	{
+		Batch& batch = batches.front();
+		if (!wait && (frame < batch.frame + framesInFlight || device.getFenceStatus(batch.done) != vk::Result::eSuccess))
+		{
+			break;
+		}
+
+		device.waitForFences(batch.done, VK_TRUE, (std::numeric_limits<uint64_t>::max)());
+		allocator.finishDefragmentation(batch.moves);
+		device.destroyFence(batch.done);
+		device.freeCommandBuffers(commandPool, batch.commandBuffer);
+		batches.pop_front();
+	}
+}
+
+uint32_t ResidencyManager::evictedCount() const
+{
+	uint32_t count = 0;
+	for (const Entry& entry : entries)
+	{
+		if (entry.allocation && allocator.heapOf(entry.allocation) != entry.deviceHeap)
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+vk::DeviceSize ResidencyManager::evictedBytes() const
+{
+	vk::DeviceSize bytes = 0;
+	for (const Entry& entry : entries)
+	{
+		if (entry.allocation && allocator.heapOf(entry.allocation) != entry.deviceHeap)
+		{
+			bytes += entry.allocation->size;
+		}
+	}
+	return bytes;
+}
+
+void ResidencyManager::logStats() const
+{
+	std::cout << "residency: " << evictions << " buffers (" << (evictionBytes >> 10) << "KB) evicted to host memory, "
+		<< restores << " (" << (restoreBytes >> 10) << "KB) brought back, " << overBudgetFrames
+		<< " frames over budget with nothing cold to evict" << std::endl;
+
+	for (const Entry& entry : entries)
+	{
+		if (entry.allocation && allocator.heapOf(entry.allocation) != entry.deviceHeap)
+		{
+			std::cout << "\t" << entry.name << " (" << (entry.allocation->size >> 10) << "KB) is in host memory, last used in frame " << entry.lastUsed << std::endl;
+		}
+	}
+}
+
+void ResidencyManager::destroy()
+{
+	retire(currentFrame, true);
+	device.destroyCommandPool(commandPool);
+	entries.clear();
+}
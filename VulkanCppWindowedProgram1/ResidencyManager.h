@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MemoryAllocator.h"
+
+// Keeps device local heaps inside their budget by moving the buffers it tracks between device
+// and host memory. Once a frame, a heap whose pressure (see HeapBudget) is over 90% gives up
+// its least recently used buffers, as long as they haven't been used for coldFrames frames, to
+// host memory the GPU can still read, only more slowly. Once the pressure would stay under 75%,
+// evicted buffers that are in use again move back, the most recently used first; the gap keeps
+// a buffer from bouncing between the two.
+//
+// The copies go out on queue and are ordered before the frames submitted after them. A moved
+// buffer's allocation->buffer changes right away: when update() reports a move, re-read the
+// tracked buffers and re-record anything that recorded the old ones. The old buffers stay valid
+// until the frames in flight are done with them.
+class ResidencyManager
+{
+public:
+	typedef uint32_t Handle;
+
+	ResidencyManager(vk::Device device, MemoryAllocator& allocator, vk::Queue queue, uint32_t queueFamilyIndex, uint32_t framesInFlight, uint32_t coldFrames = 120);
+
+	// allocation must be a buffer made by MemoryAllocator::createBuffer that belongs in device memory
+	Handle track(Allocation* allocation, const std::string& name);
+
+	// Stops tracking the buffer, before destroying it
+	void forget(Handle handle);
+
+	// The buffer is used by frame
+	void touch(Handle handle, uint64_t frame);
+
+	// Call once a frame, before recording it, with the frame numbers touch() gets. Returns true
+	// when a buffer moved.
+	bool update(uint64_t frame);
+
+	// Tracked buffers currently evicted to host memory, and their bytes
+	uint32_t evictedCount() const;
+	vk::DeviceSize evictedBytes() const;
+
+	void logStats() const;
+
+	// Finishes the moves in progress; call once the device is idle
+	void destroy();
+
+private:
+	struct Entry
+	{
+		Allocation* allocation = nullptr;	// null once forgotten
+		std::string name;
+		uint32_t deviceHeap = 0;			// the heap it belongs on
+		bool evictable = false;				// host memory it can use is on another heap
+		uint64_t lastUsed = 0;
+	};
+
+	// Moves submitted together, retired once their fence has signaled and the frames in flight
+	// at the time are done with the old buffers
+	struct Batch
+	{
+		uint64_t frame = 0;
+		vk::CommandBuffer commandBuffer;
+		vk::Fence done;
+		std::vector<DefragmentationMove> moves;
+		std::vector<std::pair<uint32_t, vk::DeviceSize>> leaving;	// heap and bytes of each old range
+	};
+
+	void retire(uint64_t frame, bool wait);
+
+	vk::Device device;
+	MemoryAllocator& allocator;
+	vk::Queue queue;
+	uint32_t framesInFlight;
+	uint32_t coldFrames;
+	vk::CommandPool commandPool;
+
+	std::vector<Entry> entries;
+	std::deque<Batch> batches;
+	uint64_t currentFrame = 0;
+
+	uint64_t evictions = 0;
+	uint64_t restores = 0;
+	vk::DeviceSize evictionBytes = 0;
+	vk::DeviceSize restoreBytes = 0;
+	uint64_t overBudgetFrames = 0;	// frames a heap stayed over budget with nothing cold left to evict
+};
@@ -0,0 +1,320 @@
+#include "ShaderArchive.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct ArchiveHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t reserved;
+	};
+
+	struct ArchiveEntry
+	{
+		uint64_t hash;
+		uint64_t dataOffset;
+		uint64_t dataSize;
+		uint32_t nameOffset;
+		uint32_t nameSize;
+	};
+
+	const uint32_t archiveMagic = 0x41565053; // "SPVA"
+	const uint32_t archiveVersion = 1;
+	const uint32_t spirvMagic = 0x07230203;
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+uint64_t hashShaderCode(const void* data, size_t size)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool isSpirv(const void* data, size_t size)
+{
+	if (size < sizeof(uint32_t) || size % sizeof(uint32_t) != 0)
+	{
+		return false;
+	}
+
+	uint32_t magic;
+	std::memcpy(&magic, data, sizeof(magic));
+	return magic == spirvMagic;
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	HANDLE fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(fileHandle);
+		return false;
+	}
+
+	HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mappingHandle == nullptr)
+	{
+		CloseHandle(fileHandle);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr)
+	{
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		return false;
+	}
+
+	file = fileHandle;
+	mapping = mappingHandle;
+	bytes = static_cast<const uint8_t*>(view);
+	length = static_cast<size_t>(fileSize.QuadPart);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes != nullptr)
+	{
+		UnmapViewOfFile(bytes);
+		CloseHandle(mapping);
+		CloseHandle(file);
+	}
+	bytes = nullptr;
+	length = 0;
+	file = nullptr;
+	mapping = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+	int descriptor = ::open(path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+	{
+		return false;
+	}
+
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+	{
+		::close(descriptor);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+	// The mapping holds its own reference to the file
+	::close(descriptor);
+
+	if (view == MAP_FAILED)
+	{
+		return false;
+	}
+
+	bytes = static_cast<const uint8_t*>(view);
+	length = static_cast<size_t>(status.st_size);
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes != nullptr)
+	{
+		munmap(const_cast<uint8_t*>(bytes), length);
+	}
+	bytes = nullptr;
+	length = 0;
+}
+
+#endif
+
+bool ShaderArchive::open(const std::string& path)
+{
+	close();
+
+	if (!file.open(path))
+	{
+		return false;
+	}
+
+	const uint8_t* base = file.data();
+	uint64_t size = file.size();
+
+	ArchiveHeader header;
+	if (size < sizeof(header))
+	{
+		close();
+		return false;
+	}
+	std::memcpy(&header, base, sizeof(header));
+
+	if (header.magic != archiveMagic || header.version != archiveVersion
+		|| header.entryCount > (size - sizeof(header)) / sizeof(ArchiveEntry))
+	{
+		close();
+		return false;
+	}
+
+	// Check every entry up front so find() can hand out pointers without looking again
+	for (uint32_t i = 0; i < header.entryCount; ++i)
+	{
+		ArchiveEntry entry;
+		std::memcpy(&entry, base + sizeof(header) + i * sizeof(ArchiveEntry), sizeof(entry));
+
+		bool valid = entry.nameOffset <= size && entry.nameSize <= size - entry.nameOffset
+			&& entry.dataOffset <= size && entry.dataSize <= size - entry.dataOffset
+			&& entry.dataOffset % sizeof(uint32_t) == 0
+			&& isSpirv(base + entry.dataOffset, static_cast<size_t>(entry.dataSize));
+		if (!valid)
+		{
+			close();
+			return false;
+		}
+
+		ShaderBlob blob;
+		blob.code = reinterpret_cast<const uint32_t*>(base + entry.dataOffset);
+		blob.size = static_cast<size_t>(entry.dataSize);
+		blob.hash = entry.hash;
+
+		entries[std::string(reinterpret_cast<const char*>(base + entry.nameOffset), entry.nameSize)] = blob;
+	}
+
+	return true;
+}
+
+void ShaderArchive::close()
+{
+	entries.clear();
+	file.close();
+}
+
+bool ShaderArchive::find(const std::string& name, ShaderBlob& blob) const
+{
+	auto found = entries.find(name);
+	if (found == entries.end())
+	{
+		return false;
+	}
+	blob = found->second;
+	return true;
+}
+
+void writeShaderArchive(const std::string& path, const std::vector<std::pair<std::string, std::vector<char>>>& shaders)
+{
+	ArchiveHeader header = {};
+	header.magic = archiveMagic;
+	header.version = archiveVersion;
+	header.entryCount = static_cast<uint32_t>(shaders.size());
+
+	std::vector<ArchiveEntry> entries(shaders.size());
+	std::string names;
+
+	uint64_t namesOffset = sizeof(ArchiveHeader) + entries.size() * sizeof(ArchiveEntry);
+	for (size_t i = 0; i < shaders.size(); ++i)
+	{
+		entries[i].nameOffset = static_cast<uint32_t>(namesOffset + names.size());
+		entries[i].nameSize = static_cast<uint32_t>(shaders[i].first.size());
+		names += shaders[i].first;
+	}
+
+	// Lay out the blobs, storing each distinct one once
+	std::vector<const std::vector<char>*> blobs;
+	std::map<std::pair<uint64_t, size_t>, uint64_t> offsetByContent;
+	uint64_t dataEnd = alignUp(namesOffset + names.size(), 8);
+	for (size_t i = 0; i < shaders.size(); ++i)
+	{
+		const std::vector<char>& code = shaders[i].second;
+		if (!isSpirv(code.data(), code.size()))
+		{
+			throw std::runtime_error("shader archive: " + shaders[i].first + " is not SPIR-V");
+		}
+
+		uint64_t hash = hashShaderCode(code.data(), code.size());
+		auto key = std::make_pair(hash, code.size());
+
+		auto existing = offsetByContent.find(key);
+		if (existing == offsetByContent.end())
+		{
+			existing = offsetByContent.insert(std::make_pair(key, dataEnd)).first;
+			blobs.push_back(&code);
+			dataEnd = alignUp(dataEnd + code.size(), 8);
+		}
+
+		entries[i].hash = hash;
+		entries[i].dataOffset = existing->second;
+		entries[i].dataSize = code.size();
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		throw std::runtime_error("shader archive: cannot write " + path);
+	}
+
+	const char padding[8] = {};
+	auto pad = [&]()
+	{
+		uint64_t position = static_cast<uint64_t>(file.tellp());
+		file.write(padding, static_cast<std::streamsize>(alignUp(position, 8) - position));
+	};
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ArchiveEntry));
+	file.write(names.data(), names.size());
+	for (const std::vector<char>* code : blobs)
+	{
+		pad();
+		file.write(code->data(), code->size());
+	}
+
+	if (!file.good())
+	{
+		throw std::runtime_error("shader archive: failed writing " + path);
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Nothing in here touches Vulkan, so the offline packer (shaders/pack_shaders.cpp) builds
+// against it without the SDK.
+
+// 64-bit FNV-1a over the blob. Shaders are keyed by this, so identical SPIR-V found under
+// two names (or in an archive and loose on disk) is only ever turned into one module.
+uint64_t hashShaderCode(const void* data, size_t size);
+
+// A read-only memory mapping of a whole file. The mapping is page aligned, which is more
+// than the 4-byte alignment vkCreateShaderModule wants for pCode.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& path);
+	void close();
+
+	const uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+	bool isOpen() const { return bytes != nullptr; }
+
+private:
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
+
+// SPIR-V living somewhere in a mapping. Valid for as long as the mapping is.
+struct ShaderBlob
+{
+	const uint32_t* code = nullptr;
+	size_t size = 0;	// bytes
+	uint64_t hash = 0;
+};
+
+// True if size is a whole number of words and the blob starts with the SPIR-V magic number
+bool isSpirv(const void* data, size_t size);
+
+// A packed file of SPIR-V blobs, looked up by name:
+//
+//   header   magic "SPVA", version, entry count
+//   entries  content hash, data offset and size, name offset and size
+//   names    not null terminated
+//   data     each blob 8-byte aligned; entries with the same content share one blob
+//
+// The whole file is mapped once and blobs are handed out in place.
+class ShaderArchive
+{
+public:
+	// Returns false if the file is missing or isn't a valid archive.
+	bool open(const std::string& path);
+	void close();
+
+	bool isOpen() const { return file.isOpen(); }
+	bool find(const std::string& name, ShaderBlob& blob) const;
+
+	size_t entryCount() const { return entries.size(); }
+	size_t mappedBytes() const { return file.size(); }
+
+private:
+	MappedFile file;
+	std::map<std::string, ShaderBlob> entries;
+};
+
+// Writes shaders (name, SPIR-V) to path in the format ShaderArchive reads. Throws on I/O errors
+// or if a blob isn't SPIR-V.
+void writeShaderArchive(const std::string& path, const std::vector<std::pair<std::string, std::vector<char>>>& shaders);
@@ -0,0 +1,97 @@
+#include "ShaderLibrary.h"
+
+#include <iostream>
+#include <stdexcept>
+
+ShaderLibrary::ShaderLibrary(vk::Device device, const std::string& directory)
+	: device(device)
+	, directory(directory)
+{
+	if (archive.open(directory + "/shaders.spvpack"))
+	{
+		std::cout << "shader library: mapped " << archive.entryCount() << " shaders, "
+			<< archive.mappedBytes() << " bytes" << std::endl;
+	}
+	else
+	{
+		std::cout << "shader library: no archive in " << directory << ", loading loose .spv files" << std::endl;
+	}
+}
+
+vk::ShaderModule ShaderLibrary::module(const std::string& name)
+{
+	auto known = byName.find(name);
+	if (known != byName.end())
+	{
+		return known->second;
+	}
+
+	vk::ShaderModule shaderModule;
+
+	ShaderBlob blob;
+	if (archive.find(name, blob))
+	{
+		shaderModule = createModule(blob);
+		++archiveLoads;
+	}
+	else
+	{
+		// Only needed until the module exists; the driver copies the code
+		MappedFile file;
+		std::string path = directory + "/" + name;
+		if (!file.open(path))
+		{
+			throw std::runtime_error("shader library: cannot open " + path);
+		}
+		if (!isSpirv(file.data(), file.size()))
+		{
+			throw std::runtime_error("shader library: " + path + " is not SPIR-V");
+		}
+
+		blob.code = reinterpret_cast<const uint32_t*>(file.data());
+		blob.size = file.size();
+		blob.hash = hashShaderCode(file.data(), file.size());
+		shaderModule = createModule(blob);
+		++fileLoads;
+	}
+
+	byName[name] = shaderModule;
+	return shaderModule;
+}
+
+vk::ShaderModule ShaderLibrary::createModule(const ShaderBlob& blob)
+{
+	auto key = std::make_pair(blob.hash, blob.size);
+
+	auto existing = byContent.find(key);
+	if (existing != byContent.end())
+	{
+		++sharedModules;
+		return existing->second;
+	}
+
+	vk::ShaderModuleCreateInfo moduleInfo = vk::ShaderModuleCreateInfo()
+		.setCodeSize(blob.size)
+		.setPCode(blob.code);
+
+	vk::ShaderModule shaderModule = device.createShaderModule(moduleInfo);
+	byContent[key] = shaderModule;
+	return shaderModule;
+}
+
+void ShaderLibrary::logStats() const
+{
+	std::cout << "shader library: " << byContent.size() << " modules, " << archiveLoads << " from the archive, "
+		<< fileLoads << " from loose files, " << sharedModules << " shared by identical code" << std::endl;
+}
+
+void ShaderLibrary::destroy()
+{
+	for (auto& entry : byContent)
+	{
+		device.destroyShaderModule(entry.second);
+	}
+	byContent.clear();
+	byName.clear();
+	archive.close();
+}
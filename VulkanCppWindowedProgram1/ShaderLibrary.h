@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "ShaderArchive.h"
+
+// Hands out shader modules by file name. If directory/shaders.spvpack exists it is mapped once
+// and every shader comes from there; a shader it doesn't have (or every shader, without an
+// archive) is mapped from directory/<name> instead. Modules are keyed by the content hash of
+// their SPIR-V, so the same code under two names is only created once. The library owns every
+// module it returns.
+class ShaderLibrary
+{
+public:
+	ShaderLibrary(vk::Device device, const std::string& directory);
+
+	// Throws if the shader can't be found or isn't SPIR-V.
+	vk::ShaderModule module(const std::string& name);
+
+	void logStats() const;
+	void destroy();
+
+private:
+	vk::ShaderModule createModule(const ShaderBlob& blob);
+
+	vk::Device device;
+	std::string directory;
+	ShaderArchive archive;
+
+	std::map<std::string, vk::ShaderModule> byName;
+	std::map<std::pair<uint64_t, size_t>, vk::ShaderModule> byContent;
+
+	uint32_t archiveLoads = 0;
+	uint32_t fileLoads = 0;
+	uint32_t sharedModules = 0;
+};
@@ -0,0 +1,98 @@
+#include "UniformRing.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+	vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+UniformRing::UniformRing(vk::PhysicalDevice physicalDevice, vk::Device device, MemoryAllocator& allocator, DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors,
+	uint32_t framesInFlight, vk::DeviceSize bytesPerFrame, uint32_t range, vk::DeviceSize persistentBytes)
+	: allocator(allocator)
+{
+	vk::PhysicalDeviceLimits limits = physicalDevice.getProperties().limits;
+	if (range > limits.maxUniformBufferRange)
+	{
+		throw std::runtime_error("uniform ring: range of " + std::to_string(range) + " bytes is over the device's maxUniformBufferRange");
+	}
+
+	// Both limits are powers of two, so the larger is a multiple of the smaller
+	alignment = (std::max)(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+	this->bytesPerFrame = alignUp(bytesPerFrame, alignment);
+
+	persistentBegin = this->bytesPerFrame * framesInFlight;
+	persistentEnd = persistentBegin + alignUp(persistentBytes, alignment);
+	persistentCursor = persistentBegin;
+
+	// A slice at the very end of a partition is still read through the full range, so keep
+	// that much past the last partition
+	ring = allocator.createBuffer(persistentEnd + range, vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer, MemoryUsage::CpuToGpu);
+
+	setLayout = layouts.get(vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment | vk::ShaderStageFlagBits::eCompute);
+	descriptorSet = descriptors.allocate(setLayout);
+
+	vk::DescriptorBufferInfo bufferInfo(ring->buffer, 0, range);
+
+	vk::WriteDescriptorSet write = vk::WriteDescriptorSet()
+		.setDstSet(descriptorSet)
+		.setDstBinding(0)
+		.setDescriptorCount(1)
+		.setDescriptorType(vk::DescriptorType::eUniformBufferDynamic)
+		.setPBufferInfo(&bufferInfo);
+
+	device.updateDescriptorSets(write, nullptr);
+}
+
+void UniformRing::beginFrame(uint32_t frameIndex)
+{
+	peakFrameBytes = (std::max)(peakFrameBytes, frameCursor - frameBegin);
+	++frames;
+
+	frameBegin = bytesPerFrame * frameIndex;
+	frameCursor = frameBegin;
+}
+
+UniformSlice UniformRing::allocate(vk::DeviceSize size)
+{
+	return take(frameCursor, frameBegin + bytesPerFrame, size, "frame");
+}
+
+UniformSlice UniformRing::allocatePersistent(vk::DeviceSize size)
+{
+	return take(persistentCursor, persistentEnd, size, "persistent");
+}
+
+UniformSlice UniformRing::take(vk::DeviceSize& cursor, vk::DeviceSize end, vk::DeviceSize size, const char* partition)
+{
+	if (cursor + size > end)
+	{
+		throw std::runtime_error(std::string("uniform ring: ") + partition + " partition is full");
+	}
+
+	UniformSlice slice;
+	slice.data = static_cast<uint8_t*>(ring->mapped) + cursor;
+	slice.offset = static_cast<uint32_t>(cursor);
+
+	cursor = alignUp(cursor + size, alignment);
+	return slice;
+}
+
+void UniformRing::logStats() const
+{
+	std::cout << "uniform ring: " << frames << " frames, peak " << peakFrameBytes << " of " << bytesPerFrame << " bytes per frame, "
+		<< persistentCursor - persistentBegin << " of " << persistentEnd - persistentBegin << " persistent bytes, "
+		<< alignment << " byte alignment" << std::endl;
+}
+
+void UniformRing::destroy()
+{
+	// The layout belongs to the layout cache and the set to the descriptor allocator
+	allocator.destroyBuffer(ring);
+}
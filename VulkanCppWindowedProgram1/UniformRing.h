@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <cstring>
+
+#include "Descriptors.h"
+#include "MemoryAllocator.h"
+
+// A piece of the ring: where to write, and the dynamic offset to bind set() with to read it
+struct UniformSlice
+{
+	void* data;
+	uint32_t offset;
+};
+
+// Per-frame uniform data in one persistently mapped buffer, split into a partition per frame
+// in flight plus one for data that never changes. Allocation is a bump of the current
+// partition's cursor, aligned for uniform and storage buffer offsets; beginFrame() takes the
+// whole partition back once the frame's fence has signaled. The buffer is bound through a
+// single dynamic uniform buffer descriptor, written once, so the only thing a draw needs to
+// read its data is the dynamic offset. Nothing is mapped, allocated or written to a
+// descriptor after construction.
+//
+// Anything small and per draw belongs in push constants instead.
+class UniformRing
+{
+public:
+	// range is how much of the buffer set() exposes from each dynamic offset, so the largest
+	// struct a shader reads through it.
+	UniformRing(vk::PhysicalDevice physicalDevice, vk::Device device, MemoryAllocator& allocator, DescriptorLayoutCache& layouts, DescriptorAllocator& descriptors,
+		uint32_t framesInFlight, vk::DeviceSize bytesPerFrame, uint32_t range, vk::DeviceSize persistentBytes = 4096);
+
+	// Rewinds frameIndex's partition. Only once that frame's fence has signaled.
+	void beginFrame(uint32_t frameIndex);
+
+	// From the current frame's partition. Throws if the partition is full.
+	UniformSlice allocate(vk::DeviceSize size);
+
+	// From the partition that is never rewound, for data that is written once, such as what
+	// pre-recorded command buffers read.
+	UniformSlice allocatePersistent(vk::DeviceSize size);
+
+	// Copies value into the current frame's partition and returns its dynamic offset
+	template<typename T>
+	uint32_t push(const T& value)
+	{
+		UniformSlice slice = allocate(sizeof(T));
+		std::memcpy(slice.data, &value, sizeof(T));
+		return slice.offset;
+	}
+
+	template<typename T>
+	uint32_t pushPersistent(const T& value)
+	{
+		UniformSlice slice = allocatePersistent(sizeof(T));
+		std::memcpy(slice.data, &value, sizeof(T));
+		return slice.offset;
+	}
+
+	// One binding, 0, a dynamic uniform buffer
+	vk::DescriptorSetLayout layout() const { return setLayout; }
+	vk::DescriptorSet set() const { return descriptorSet; }
+
+	vk::Buffer buffer() const { return ring->buffer; }
+
+	void logStats() const;
+	void destroy();
+
+private:
+	UniformSlice take(vk::DeviceSize& cursor, vk::DeviceSize end, vk::DeviceSize size, const char* partition);
+
+	MemoryAllocator& allocator;
+	Allocation* ring;
+
+	vk::DeviceSize alignment;
+	vk::DeviceSize bytesPerFrame;
+	vk::DeviceSize persistentBegin;
+	vk::DeviceSize persistentEnd;
+
+	vk::DeviceSize frameBegin = 0;
+	vk::DeviceSize frameCursor = 0;
+	vk::DeviceSize persistentCursor;
+
+	vk::DescriptorSetLayout setLayout;
+	vk::DescriptorSet descriptorSet;
+
+	uint64_t frames = 0;
+	vk::DeviceSize peakFrameBytes = 0;
+};
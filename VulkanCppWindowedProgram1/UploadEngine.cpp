@@ -0,0 +1,407 @@
+#include "UploadEngine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+	vk::DeviceSize gcd(vk::DeviceSize a, vk::DeviceSize b)
+	{
+		while (b)
+		{
+			vk::DeviceSize r = a % b;
+			a = b;
+			b = r;
+		}
+		return a;
+	}
+
+	vk::DeviceSize lcm(vk::DeviceSize a, vk::DeviceSize b)
+	{
+		return a / gcd(a, b) * b;
+	}
+
+	// Bytes per texel of the uncompressed color formats uploadImage takes
+	vk::DeviceSize texelSize(vk::Format format)
+	{
+		switch (format)
+		{
+		case vk::Format::eR8Unorm:
+		case vk::Format::eR8Srgb:
+			return 1;
+		case vk::Format::eR8G8Unorm:
+		case vk::Format::eR16Sfloat:
+			return 2;
+		case vk::Format::eR8G8B8Unorm:
+		case vk::Format::eR8G8B8Srgb:
+		case vk::Format::eB8G8R8Unorm:
+		case vk::Format::eB8G8R8Srgb:
+			return 3;
+		case vk::Format::eR8G8B8A8Unorm:
+		case vk::Format::eR8G8B8A8Srgb:
+		case vk::Format::eB8G8R8A8Unorm:
+		case vk::Format::eB8G8R8A8Srgb:
+		case vk::Format::eA2B10G10R10UnormPack32:
+		case vk::Format::eR16G16Sfloat:
+		case vk::Format::eR32Sfloat:
+			return 4;
+		case vk::Format::eR16G16B16A16Sfloat:
+		case vk::Format::eR32G32Sfloat:
+			return 8;
+		case vk::Format::eR32G32B32Sfloat:
+			return 12;
+		case vk::Format::eR32G32B32A32Sfloat:
+			return 16;
+		default:
+			throw std::runtime_error("uploadImage does not know the texel size of this format!");
+		}
+	}
+}
+
+UploadEngine::UploadEngine(vk::Device device, vk::PhysicalDevice physicalDevice, MemoryAllocator& allocator, vk::Queue transferQueue, uint32_t transferFamily, vk::Queue graphicsQueue, uint32_t graphicsFamily, vk::DeviceSize ringSize)
+	: device(device)
+	, allocator(allocator)
+	, transferQueue(transferQueue)
+	, graphicsQueue(graphicsQueue)
+	, transferFamily(transferFamily)
+	, graphicsFamily(graphicsFamily)
+	, ownershipTransfer(transferFamily != graphicsFamily)
+	, ringSize(ringSize)
+{
+	// Buffer copies need no particular offset, but the driver copies fastest from its optimal
+	// alignment, and image copies also need a multiple of 4 and of the texel size (see uploadImage)
+	copyAlignment = lcm(4, (std::max)(physicalDevice.getProperties().limits.optimalBufferCopyOffsetAlignment, vk::DeviceSize(1)));
+
+	ring = allocator.createBuffer(ringSize, vk::BufferUsageFlagBits::eTransferSrc, MemoryUsage::CpuOnly);
+
+	transferPool = device.createCommandPool(vk::CommandPoolCreateInfo()
+		.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+		.setQueueFamilyIndex(transferFamily));
+
+	if (ownershipTransfer)
+	{
+		graphicsPool = device.createCommandPool(vk::CommandPoolCreateInfo()
+			.setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer)
+			.setQueueFamilyIndex(graphicsFamily));
+	}
+}
+
+bool UploadEngine::tryAllocateStaging(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& offset)
+{
+	// Not necessarily a power of two: three byte texels make for a multiple of 12
+	vk::DeviceSize aligned = (head + alignment - 1) / alignment * alignment;
+
+	// In use is [tail, head) when head >= tail, otherwise it has wrapped and is [tail, end) + [0, head).
+	// The wrapped cases use a strict comparison so head never catches up with tail.
+	if (head >= tail)
+	{
+		if (aligned + size <= ringSize)
+		{
+			offset = aligned;
+		}
+		else if (size < tail)
+		{
+			offset = 0;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else
+	{
+		if (aligned + size < tail)
+		{
+			offset = aligned;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	head = offset + size;
+	return true;
+}
+
+vk::DeviceSize UploadEngine::allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+	if (size > ringSize)
+	{
+		throw std::runtime_error("upload is larger than the staging ring!");
+	}
+
+	vk::DeviceSize offset;
+	while (!tryAllocateStaging(size, alignment, offset))
+	{
+		if (recording)
+		{
+			flush();
+		}
+		else if (!inFlight.empty())
+		{
+			waitOldest();
+		}
+		else
+		{
+			throw std::runtime_error("staging ring is empty but the upload does not fit!");
+		}
+	}
+
+	return offset;
+}
+
+void UploadEngine::beginBatch()
+{
+	if (!freeBatches.empty())
+	{
+		current = freeBatches.back();
+		freeBatches.pop_back();
+		device.resetFences(current.done);
+	}
+	else
+	{
+		current = Batch();
+
+		vk::CommandBufferAllocateInfo allocateInfo = vk::CommandBufferAllocateInfo()
+			.setCommandPool(transferPool)
+			.setLevel(vk::CommandBufferLevel::ePrimary)
+			.setCommandBufferCount(1);
+		current.transferCommands = device.allocateCommandBuffers(allocateInfo)[0];
+
+		if (ownershipTransfer)
+		{
+			allocateInfo.setCommandPool(graphicsPool);
+			current.acquireCommands = device.allocateCommandBuffers(allocateInfo)[0];
+			current.released = device.createSemaphore(vk::SemaphoreCreateInfo());
+		}
+
+		current.done = device.createFence(vk::FenceCreateInfo());
+	}
+
+	current.ticket = nextTicket++;
+	current.transferCommands.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+	recording = true;
+}
+
+UploadTicket UploadEngine::uploadBuffer(vk::Buffer destination, vk::DeviceSize destinationOffset, const void* data, vk::DeviceSize size)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	vk::DeviceSize chunkSize = ringSize / 2;
+
+	for (vk::DeviceSize done = 0; done < size;)
+	{
+		vk::DeviceSize chunk = (std::min)(chunkSize, size - done);
+		vk::DeviceSize offset = allocateStaging(chunk, copyAlignment);
+		if (!recording)
+		{
+			beginBatch();
+		}
+
+		std::memcpy(static_cast<uint8_t*>(ring->mapped) + offset, bytes + done, static_cast<size_t>(chunk));
+		current.transferCommands.copyBuffer(ring->buffer, destination, vk::BufferCopy(offset, destinationOffset + done, chunk));
+
+		pendingBufferBarriers.push_back(vk::BufferMemoryBarrier()
+			.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+			.setSrcQueueFamilyIndex(ownershipTransfer ? transferFamily : VK_QUEUE_FAMILY_IGNORED)
+			.setDstQueueFamilyIndex(ownershipTransfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED)
+			.setBuffer(destination)
+			.setOffset(destinationOffset + done)
+			.setSize(chunk));
+
+		done += chunk;
+	}
+
+	return current.ticket;
+}
+
+UploadTicket UploadEngine::uploadImage(vk::Image destination, vk::Format format, vk::Extent3D extent, const void* data, vk::DeviceSize size, vk::ImageLayout finalLayout)
+{
+	vk::DeviceSize offset = allocateStaging(size, lcm(copyAlignment, texelSize(format)));
+	if (!recording)
+	{
+		beginBatch();
+	}
+
+	std::memcpy(static_cast<uint8_t*>(ring->mapped) + offset, data, static_cast<size_t>(size));
+
+	vk::ImageSubresourceRange range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+
+	vk::ImageMemoryBarrier toTransfer = vk::ImageMemoryBarrier()
+		.setDstAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setOldLayout(vk::ImageLayout::eUndefined)
+		.setNewLayout(vk::ImageLayout::eTransferDstOptimal)
+		.setSrcQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+		.setDstQueueFamilyIndex(VK_QUEUE_FAMILY_IGNORED)
+		.setImage(destination)
+		.setSubresourceRange(range);
+	current.transferCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, toTransfer);
+
+	vk::BufferImageCopy region = vk::BufferImageCopy()
+		.setBufferOffset(offset)
+		.setImageSubresource(vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, 0, 0, 1))
+		.setImageExtent(extent);
+	current.transferCommands.copyBufferToImage(ring->buffer, destination, vk::ImageLayout::eTransferDstOptimal, region);
+
+	pendingImageBarriers.push_back(vk::ImageMemoryBarrier()
+		.setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+		.setOldLayout(vk::ImageLayout::eTransferDstOptimal)
+		.setNewLayout(finalLayout)
+		.setSrcQueueFamilyIndex(ownershipTransfer ? transferFamily : VK_QUEUE_FAMILY_IGNORED)
+		.setDstQueueFamilyIndex(ownershipTransfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED)
+		.setImage(destination)
+		.setSubresourceRange(range));
+
+	return current.ticket;
+}
+
+UploadTicket UploadEngine::flush()
+{
+	if (!recording)
+	{
+		return nextTicket - 1;
+	}
+
+	if (ownershipTransfer)
+	{
+		// Release on the transfer queue; the matching acquire below has the same barriers
+		// with the access masks moved to the destination side.
+		current.transferCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlags(), nullptr, pendingBufferBarriers, pendingImageBarriers);
+		current.transferCommands.end();
+
+		for (auto& barrier : pendingBufferBarriers)
+		{
+			barrier.setSrcAccessMask(vk::AccessFlags()).setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+		}
+		for (auto& barrier : pendingImageBarriers)
+		{
+			barrier.setSrcAccessMask(vk::AccessFlags()).setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+		}
+
+		current.acquireCommands.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+		current.acquireCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), nullptr, pendingBufferBarriers, pendingImageBarriers);
+		current.acquireCommands.end();
+
+		vk::SubmitInfo releaseSubmit = vk::SubmitInfo()
+			.setCommandBufferCount(1)
+			.setPCommandBuffers(&current.transferCommands)
+			.setSignalSemaphoreCount(1)
+			.setPSignalSemaphores(&current.released);
+		transferQueue.submit(releaseSubmit, VK_NULL_HANDLE);
+
+		vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+		vk::SubmitInfo acquireSubmit = vk::SubmitInfo()
+			.setWaitSemaphoreCount(1)
+			.setPWaitSemaphores(&current.released)
+			.setPWaitDstStageMask(&waitStage)
+			.setCommandBufferCount(1)
+			.setPCommandBuffers(&current.acquireCommands);
+		graphicsQueue.submit(acquireSubmit, current.done);
+	}
+	else
+	{
+		for (auto& barrier : pendingBufferBarriers)
+		{
+			barrier.setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+		}
+		for (auto& barrier : pendingImageBarriers)
+		{
+			barrier.setDstAccessMask(vk::AccessFlagBits::eMemoryRead);
+		}
+
+		current.transferCommands.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlags(), nullptr, pendingBufferBarriers, pendingImageBarriers);
+		current.transferCommands.end();
+
+		vk::SubmitInfo submitInfo = vk::SubmitInfo()
+			.setCommandBufferCount(1)
+			.setPCommandBuffers(&current.transferCommands);
+		transferQueue.submit(submitInfo, current.done);
+	}
+
+	pendingBufferBarriers.clear();
+	pendingImageBarriers.clear();
+
+	current.ringEnd = head;
+	inFlight.push_back(current);
+	recording = false;
+
+	return current.ticket;
+}
+
+void UploadEngine::retire(Batch& batch)
+{
+	tail = batch.ringEnd;
+	completed = batch.ticket;
+	freeBatches.push_back(batch);
+
+	// Nothing left in use, start from the front again to keep big uploads contiguous
+	if (head == tail)
+	{
+		head = tail = 0;
+	}
+}
+
+void UploadEngine::waitOldest()
+{
+	Batch batch = inFlight.front();
+	device.waitForFences(batch.done, VK_TRUE, (std::numeric_limits<uint64_t>::max)());
+	inFlight.pop_front();
+	retire(batch);
+}
+
+void UploadEngine::poll()
+{
+	while (!inFlight.empty() && device.getFenceStatus(inFlight.front().done) == vk::Result::eSuccess)
+	{
+		Batch batch = inFlight.front();
+		inFlight.pop_front();
+		retire(batch);
+	}
+}
+
+bool UploadEngine::isComplete(UploadTicket ticket)
+{
+	poll();
+	return ticket <= completed;
+}
+
+void UploadEngine::wait(UploadTicket ticket)
+{
+	if (recording && ticket >= current.ticket)
+	{
+		flush();
+	}
+
+	while (completed < ticket && !inFlight.empty())
+	{
+		waitOldest();
+	}
+}
+
+void UploadEngine::destroy()
+{
+	flush();
+	while (!inFlight.empty())
+	{
+		waitOldest();
+	}
+
+	for (const auto& batch : freeBatches)
+	{
+		device.destroyFence(batch.done);
+		if (batch.released)
+		{
+			device.destroySemaphore(batch.released);
+		}
+	}
+	freeBatches.clear();
+
+	device.destroyCommandPool(transferPool);
+	if (graphicsPool)
+	{
+		device.destroyCommandPool(graphicsPool);
+	}
+
+	allocator.destroyBuffer(ring);
+}
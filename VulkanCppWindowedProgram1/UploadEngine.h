@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "MemoryAllocator.h"
+
+// Identifies the batch an upload went out in; compare against completedTicket() or pass to wait().
+typedef uint64_t UploadTicket;
+
+// Streams data to the GPU through a persistently mapped staging ring. Uploads are batched
+// until flush(), then go out as a single submission on the transfer queue. When that queue
+// belongs to a different family than graphics, ownership is released on the transfer queue
+// and acquired on the graphics queue (ordered by a semaphore), so the render loop never has
+// to know about it. Completion is tracked with one fence per batch.
+class UploadEngine
+{
+public:
+	UploadEngine(vk::Device device, vk::PhysicalDevice physicalDevice, MemoryAllocator& allocator, vk::Queue transferQueue, uint32_t transferFamily, vk::Queue graphicsQueue, uint32_t graphicsFamily, vk::DeviceSize ringSize = 32 * 1024 * 1024);
+
+	// Buffer uploads larger than the ring are split across several batches.
+	UploadTicket uploadBuffer(vk::Buffer destination, vk::DeviceSize destinationOffset, const void* data, vk::DeviceSize size);
+
+	// Uploads mip 0, layer 0 of a 2D color image and leaves it in finalLayout. format is the
+	// image's, which must be an uncompressed color format.
+	UploadTicket uploadImage(vk::Image destination, vk::Format format, vk::Extent3D extent, const void* data, vk::DeviceSize size, vk::ImageLayout finalLayout);
+
+	// Submits everything recorded since the last flush. Returns the ticket of that batch.
+	UploadTicket flush();
+
+	// Retires finished batches without blocking. Call once a frame.
+	void poll();
+
+	bool isComplete(UploadTicket ticket);
+	void wait(UploadTicket ticket);
+
+	UploadTicket completedTicket() const { return completed; }
+
+	void destroy();
+
+private:
+	struct Batch
+	{
+		UploadTicket ticket = 0;
+		vk::CommandBuffer transferCommands;
+		vk::CommandBuffer acquireCommands;
+		vk::Semaphore released;
+		vk::Fence done;
+		vk::DeviceSize ringEnd = 0;
+	};
+
+	// Reserves size bytes in the ring, flushing and waiting on old batches if it is full
+	vk::DeviceSize allocateStaging(vk::DeviceSize size, vk::DeviceSize alignment);
+	bool tryAllocateStaging(vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& offset);
+	void beginBatch();
+	void waitOldest();
+	void retire(Batch& batch);
+
+	vk::Device device;
+	MemoryAllocator& allocator;
+	vk::Queue transferQueue;
+	vk::Queue graphicsQueue;
+	uint32_t transferFamily;
+	uint32_t graphicsFamily;
+	bool ownershipTransfer;
+
+	Allocation* ring;
+	vk::DeviceSize ringSize;
+	vk::DeviceSize copyAlignment;	// lcm of 4 and optimalBufferCopyOffsetAlignment
+	vk::DeviceSize head = 0;
+	vk::DeviceSize tail = 0;
+
+	vk::CommandPool transferPool;
+	vk::CommandPool graphicsPool;
+
+	bool recording = false;
+	Batch current;
+	std::vector<vk::BufferMemoryBarrier> pendingBufferBarriers;
+	std::vector<vk::ImageMemoryBarrier> pendingImageBarriers;
+
+	std::deque<Batch> inFlight;
+	std::vector<Batch> freeBatches;
+
+	UploadTicket nextTicket = 1;
+	UploadTicket completed = 0;
+};
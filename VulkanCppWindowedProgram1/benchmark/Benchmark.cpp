@@ -0,0 +1,562 @@
+// Runs the renderer over a matrix of scene and presentation settings, a fixed number of frames
+// each, and collects the JSON report every run writes (--report) into one results file. Given
+// the results of an earlier run as a baseline, flags every configuration that got slower.
+//
+//   VulkanBenchmark --renderer ./VulkanCppWindowedProgram1 --software --output results.json
+//   VulkanBenchmark --renderer ./VulkanCppWindowedProgram1 --baseline results.json
+//
+// Exits with 0 when every run succeeded and nothing regressed, 2 when something regressed and
+// 1 when a run failed or the arguments were wrong.
+
+#include "Json.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#include <stdlib.h>
+#else
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct Resolution
+	{
+		uint32_t width;
+		uint32_t height;
+	};
+
+	struct Options
+	{
+		std::string renderer = "./VulkanCppWindowedProgram1";
+		std::string workingDirectory;
+		uint32_t frames = 300;
+		uint32_t instances = 16384;
+		std::vector<Resolution> resolutions = { { 1280, 720 }, { 1920, 1080 } };
+		std::vector<uint32_t> drawCounts = { 1, 64 };
+		std::vector<std::string> presentModes = { "headless" };
+		std::vector<uint32_t> framesInFlight = { 1, 2, 3 };
+		std::string output = "benchmark_results.json";
+		std::string baseline;
+		double threshold = 0.10;
+		bool software = false;
+		std::string icd;
+		std::vector<std::string> rendererArgs;
+	};
+
+	struct Run
+	{
+		Resolution resolution;
+		uint32_t drawCount;
+		std::string presentMode;
+		uint32_t framesInFlight;
+
+		std::string name() const
+		{
+			std::ostringstream out;
+			out << resolution.width << "x" << resolution.height << " draws=" << drawCount << " present=" << presentMode << " fif=" << framesInFlight;
+			return out.str();
+		}
+	};
+
+	// What is compared against the baseline, and which direction is better
+	struct Metric
+	{
+		const char* path;
+		bool higherIsBetter;
+	};
+
+	const Metric metrics[] = {
+		{ "fps", true },
+		{ "stages.frame.p50", false },
+		{ "stages.gpu.p50", false },
+	};
+
+	std::vector<std::string> split(const std::string& list)
+	{
+		std::vector<std::string> items;
+		std::stringstream stream(list);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			if (!item.empty())
+			{
+				items.push_back(item);
+			}
+		}
+		return items;
+	}
+
+	std::vector<uint32_t> splitNumbers(const std::string& list)
+	{
+		std::vector<uint32_t> numbers;
+		for (const auto& item : split(list))
+		{
+			numbers.push_back(static_cast<uint32_t>(std::stoul(item)));
+		}
+		return numbers;
+	}
+
+	std::vector<Resolution> splitResolutions(const std::string& list)
+	{
+		std::vector<Resolution> resolutions;
+		for (const auto& item : split(list))
+		{
+			size_t x = item.find('x');
+			if (x == std::string::npos)
+			{
+				throw std::invalid_argument("resolution " + item + " is not WIDTHxHEIGHT");
+			}
+			resolutions.push_back({ static_cast<uint32_t>(std::stoul(item.substr(0, x))), static_cast<uint32_t>(std::stoul(item.substr(x + 1))) });
+		}
+		return resolutions;
+	}
+
+	void usage()
+	{
+		std::cout << "usage: VulkanBenchmark [options] [-- renderer arguments]\n"
+			"  --renderer PATH            renderer executable (default ./VulkanCppWindowedProgram1)\n"
+			"  --working-directory DIR    run it from DIR, which must hold its shaders/ (default: here)\n"
+			"  --frames N                 frames per run (default 300)\n"
+			"  --instances N              quads drawn per frame (default 16384)\n"
+			"  --resolutions WxH,...      default 1280x720,1920x1080\n"
+			"  --draws N,...              draw calls the quads are split over (default 1,64)\n"
+			"  --present MODE,...         headless, low-latency, vsync or uncapped (default headless)\n"
+			"  --frames-in-flight N,...   default 1,2,3\n"
+			"  --output PATH              results file (default benchmark_results.json)\n"
+			"  --baseline PATH            earlier results to compare against\n"
+			"  --threshold F              relative change counted as a regression (default 0.10)\n"
+			"  --software                 run on a software Vulkan driver (lavapipe or SwiftShader)\n"
+			"  --icd PATH                 the software driver's ICD manifest, if it isn't found\n";
+	}
+
+	bool fileExists(const std::string& path)
+	{
+		std::ifstream file(path);
+		return file.is_open();
+	}
+
+	void setEnvironment(const char* name, const std::string& value)
+	{
+#if defined(_WIN32)
+		_putenv_s(name, value.c_str());
+#else
+		setenv(name, value.c_str(), 1);
+#endif
+	}
+
+	// The usual install locations of the lavapipe and SwiftShader ICD manifests
+	std::string findSoftwareIcd()
+	{
+		const char* directories[] = { "/usr/share/vulkan/icd.d/", "/usr/local/share/vulkan/icd.d/", "/etc/vulkan/icd.d/" };
+		const char* manifests[] = { "lvp_icd.x86_64.json", "lvp_icd.aarch64.json", "lvp_icd.i686.json", "lvp_icd.json", "vk_swiftshader_icd.json" };
+
+		for (const char* directory : directories)
+		{
+			for (const char* manifest : manifests)
+			{
+				std::string path = std::string(directory) + manifest;
+				if (fileExists(path))
+				{
+					return path;
+				}
+			}
+		}
+		return std::string();
+	}
+
+	bool haveDisplay()
+	{
+#if defined(_WIN32)
+		return true;
+#else
+		return std::getenv("DISPLAY") || std::getenv("WAYLAND_DISPLAY");
+#endif
+	}
+
+	std::string absolutePath(const std::string& path)
+	{
+#if defined(_WIN32)
+		char resolved[_MAX_PATH];
+		return _fullpath(resolved, path.c_str(), _MAX_PATH) ? std::string(resolved) : path;
+#else
+		// Unlike realpath(), fine for files that don't exist yet
+		char directory[PATH_MAX];
+		if (path.empty() || path[0] == '/' || !getcwd(directory, sizeof(directory)))
+		{
+			return path;
+		}
+		return std::string(directory) + "/" + path;
+#endif
+	}
+
+	bool changeDirectory(const std::string& path)
+	{
+#if defined(_WIN32)
+		return _chdir(path.c_str()) == 0;
+#else
+		return chdir(path.c_str()) == 0;
+#endif
+	}
+
+	std::string quote(const std::string& argument)
+	{
+		return "\"" + argument + "\"";
+	}
+
+	// Runs command through the shell and returns its exit code, or -1 if it didn't exit normally
+	int runCommand(const std::string& command)
+	{
+		std::cout.flush();
+#if defined(_WIN32)
+		// cmd.exe strips the first and last quote of the line, so give it a pair to strip
+		return std::system(("\"" + command + "\"").c_str());
+#else
+		int status = std::system(command.c_str());
+		return status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+	}
+
+	std::string fileSafe(const std::string& name)
+	{
+		std::string safe;
+		for (char c : name)
+		{
+			bool plain = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-';
+			safe += plain ? c : '_';
+		}
+		return safe;
+	}
+
+	bool parseOptions(int argc, char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			bool hasValue = i + 1 < argc;
+
+			if (arg == "--")
+			{
+				options.rendererArgs.assign(argv + i + 1, argv + argc);
+				break;
+			}
+			else if (arg == "--renderer" && hasValue)
+			{
+				options.renderer = argv[++i];
+			}
+			else if (arg == "--working-directory" && hasValue)
+			{
+				options.workingDirectory = argv[++i];
+			}
+			else if (arg == "--frames" && hasValue)
+			{
+				options.frames = static_cast<uint32_t>(std::stoul(argv[++i]));
+			}
+			else if (arg == "--instances" && hasValue)
+			{
+				options.instances = static_cast<uint32_t>(std::stoul(argv[++i]));
+			}
+			else if (arg == "--resolutions" && hasValue)
+			{
+				options.resolutions = splitResolutions(argv[++i]);
+			}
+			else if (arg == "--draws" && hasValue)
+			{
+				options.drawCounts = splitNumbers(argv[++i]);
+			}
+			else if (arg == "--present" && hasValue)
+			{
+				options.presentModes = split(argv[++i]);
+			}
+			else if (arg == "--frames-in-flight" && hasValue)
+			{
+				options.framesInFlight = splitNumbers(argv[++i]);
+			}
+			else if (arg == "--output" && hasValue)
+			{
+				options.output = argv[++i];
+			}
+			else if (arg == "--baseline" && hasValue)
+			{
+				options.baseline = argv[++i];
+			}
+			else if (arg == "--threshold" && hasValue)
+			{
+				options.threshold = std::stod(argv[++i]);
+			}
+			else if (arg == "--software")
+			{
+				options.software = true;
+			}
+			else if (arg == "--icd" && hasValue)
+			{
+				options.icd = argv[++i];
+			}
+			else
+			{
+				std::cout << "Unknown option " << arg << std::endl;
+				return false;
+			}
+		}
+
+		return !options.resolutions.empty() && !options.drawCounts.empty() && !options.presentModes.empty() && !options.framesInFlight.empty();
+	}
+
+	// Appends a description of every metric that got worse than the baseline by more than threshold
+	void compare(const JsonValue& report, const JsonValue& baseline, double threshold, JsonValue& regressions)
+	{
+		for (const auto& metric : metrics)
+		{
+			double before = baseline.numberAt(metric.path, -1.0);
+			double after = report.numberAt(metric.path, -1.0);
+			if (before <= 0.0 || after < 0.0)
+			{
+				continue;
+			}
+
+			double change = (after - before) / before;
+			bool worse = metric.higherIsBetter ? change < -threshold : change > threshold;
+			if (worse)
+			{
+				std::ostringstream description;
+				description.precision(2);
+				description << std::fixed << metric.path << " " << before << " -> " << after << " (" << (change >= 0.0 ? "+" : "") << change * 100.0 << "%)";
+				regressions.array.push_back(JsonValue::makeString(description.str()));
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	try
+	{
+		if (!parseOptions(argc, argv, options))
+		{
+			usage();
+			return 1;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Bad argument: " << e.what() << std::endl;
+		usage();
+		return 1;
+	}
+
+	// Everything given relative to where we were started stays valid after changing directory
+	options.renderer = absolutePath(options.renderer);
+	options.output = absolutePath(options.output);
+	if (!options.baseline.empty())
+	{
+		options.baseline = absolutePath(options.baseline);
+	}
+
+	JsonValue baseline;
+	std::map<std::string, const JsonValue*> baselineRuns;
+	if (!options.baseline.empty())
+	{
+		std::string error;
+		if (!readJsonFile(options.baseline, baseline, error))
+		{
+			std::cout << "Could not read the baseline: " << error << std::endl;
+			return 1;
+		}
+
+		const JsonValue* runs = baseline.find("runs");
+		if (runs)
+		{
+			for (const auto& run : runs->array)
+			{
+				const JsonValue* name = run.find("name");
+				const JsonValue* report = run.find("report");
+				if (name && report)
+				{
+					baselineRuns[name->string] = report;
+				}
+			}
+		}
+	}
+
+	if (options.software)
+	{
+		// The loader only looks at the drivers listed here, so the run can't land on a real GPU
+		std::string icd = options.icd;
+		if (icd.empty() && std::getenv("VK_ICD_FILENAMES"))
+		{
+			icd = std::getenv("VK_ICD_FILENAMES");
+		}
+		if (icd.empty())
+		{
+			icd = findSoftwareIcd();
+		}
+		if (icd.empty())
+		{
+			std::cout << "No software Vulkan driver found; install lavapipe (mesa-vulkan-drivers) or pass --icd" << std::endl;
+			return 1;
+		}
+
+		setEnvironment("VK_ICD_FILENAMES", icd);
+		setEnvironment("VK_DRIVER_FILES", icd);
+		std::cout << "using the software driver " << icd << std::endl;
+	}
+
+	if (!options.workingDirectory.empty() && !changeDirectory(options.workingDirectory))
+	{
+		std::cout << "Could not change to " << options.workingDirectory << std::endl;
+		return 1;
+	}
+
+	std::vector<Run> runs;
+	for (const auto& resolution : options.resolutions)
+	{
+		for (uint32_t drawCount : options.drawCounts)
+		{
+			for (const auto& presentMode : options.presentModes)
+			{
+				for (uint32_t framesInFlight : options.framesInFlight)
+				{
+					runs.push_back({ resolution, drawCount, presentMode, framesInFlight });
+				}
+			}
+		}
+	}
+
+	JsonValue results = JsonValue::makeObject();
+	results.set("renderer", JsonValue::makeString(options.renderer));
+	results.set("frames", JsonValue::makeNumber(options.frames));
+	results.set("instances", JsonValue::makeNumber(options.instances));
+	results.set("software", JsonValue::makeBool(options.software));
+	JsonValue& resultRuns = results.set("runs", JsonValue::makeArray());
+
+	uint32_t failed = 0;
+	uint32_t regressed = 0;
+	std::string reportPath = options.output + ".run.json";
+
+	for (size_t r = 0; r < runs.size(); ++r)
+	{
+		const Run& run = runs[r];
+		std::string name = run.name();
+		std::cout << "[" << r + 1 << "/" << runs.size() << "] " << name << ": ";
+
+		JsonValue entry = JsonValue::makeObject();
+		entry.set("name", JsonValue::makeString(name));
+		entry.set("width", JsonValue::makeNumber(run.resolution.width));
+		entry.set("height", JsonValue::makeNumber(run.resolution.height));
+		entry.set("draws", JsonValue::makeNumber(run.drawCount));
+		entry.set("present", JsonValue::makeString(run.presentMode));
+		entry.set("framesInFlight", JsonValue::makeNumber(run.framesInFlight));
+
+		bool headless = run.presentMode == "headless";
+		if (!headless && !haveDisplay())
+		{
+			std::cout << "skipped, no display to present to" << std::endl;
+			entry.set("skipped", JsonValue::makeString("no display"));
+			resultRuns.array.push_back(entry);
+			continue;
+		}
+
+		std::ostringstream command;
+		command << quote(options.renderer)
+			<< (headless ? " --headless" : " --present " + run.presentMode)
+			<< " --size " << run.resolution.width << " " << run.resolution.height
+			<< " --frames " << options.frames
+			<< " --instances " << options.instances
+			<< " --draws " << run.drawCount
+			<< " --frames-in-flight " << run.framesInFlight
+			<< " --log-level warning"
+			<< " --report " << quote(reportPath);
+		for (const auto& arg : options.rendererArgs)
+		{
+			command << " " << quote(arg);
+		}
+
+		std::string logPath = options.output + "." + fileSafe(name) + ".log";
+		command << " > " << quote(logPath) << " 2>&1";
+
+		std::remove(reportPath.c_str());
+		int exitCode = runCommand(command.str());
+
+		JsonValue report;
+		std::string error;
+		if (exitCode != 0 || !readJsonFile(reportPath, report, error))
+		{
+			std::cout << "FAILED (exit code " << exitCode << "), see " << logPath << std::endl;
+			entry.set("error", JsonValue::makeString(exitCode != 0 ? "exit code " + std::to_string(exitCode) : error));
+			entry.set("log", JsonValue::makeString(logPath));
+			resultRuns.array.push_back(entry);
+			++failed;
+			continue;
+		}
+		std::remove(reportPath.c_str());
+		std::remove(logPath.c_str());
+
+		std::ostringstream summary;
+		summary.precision(2);
+		summary << std::fixed << report.numberAt("fps", 0.0) << " fps, cpu frame p50 " << report.numberAt("stages.frame.p50", 0.0) << "ms";
+		double gpu = report.numberAt("stages.gpu.p50", -1.0);
+		if (gpu >= 0.0)
+		{
+			summary << ", gpu p50 " << gpu << "ms";
+		}
+		std::cout << summary.str();
+
+		auto base = baselineRuns.find(name);
+		if (base != baselineRuns.end())
+		{
+			JsonValue regressions = JsonValue::makeArray();
+			compare(report, *base->second, options.threshold, regressions);
+			entry.set("regressions", regressions);
+
+			if (!regressions.array.empty())
+			{
+				++regressed;
+				std::cout << "  REGRESSED";
+				for (const auto& regression : regressions.array)
+				{
+					std::cout << "\n\t" << regression.string;
+				}
+			}
+		}
+		std::cout << std::endl;
+
+		entry.set("report", report);
+		resultRuns.array.push_back(entry);
+	}
+
+	std::ofstream file(options.output, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "Could not write " << options.output << std::endl;
+		return 1;
+	}
+	writeJson(file, results);
+	file << "\n";
+	std::cout << "wrote " << runs.size() << " runs to " << options.output << std::endl;
+
+	if (failed > 0)
+	{
+		std::cout << failed << " runs failed" << std::endl;
+		return 1;
+	}
+	if (regressed > 0)
+	{
+		std::cout << regressed << " runs regressed by more than " << options.threshold * 100.0 << "% against " << options.baseline << std::endl;
+		return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,468 @@
+#include "Json.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+	class Parser
+	{
+	public:
+		explicit Parser(const std::string& text)
+			: text(text)
+		{
+		}
+
+		bool parse(JsonValue& value, std::string& error)
+		{
+			if (!parseValue(value, 0))
+			{
+				error = message + " at offset " + std::to_string(position);
+				return false;
+			}
+
+			skipSpace();
+			if (position != text.size())
+			{
+				error = "trailing characters at offset " + std::to_string(position);
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		static const int maxDepth = 64;
+
+		bool fail(const char* what)
+		{
+			message = what;
+			return false;
+		}
+
+		void skipSpace()
+		{
+			while (position < text.size() && std::strchr(" \t\r\n", text[position]))
+			{
+				++position;
+			}
+		}
+
+		bool consume(const char* literal)
+		{
+			size_t length = std::strlen(literal);
+			if (text.compare(position, length, literal) != 0)
+			{
+				return false;
+			}
+			position += length;
+			return true;
+		}
+
+		bool parseValue(JsonValue& value, int depth)
+		{
+			if (depth > maxDepth)
+			{
+				return fail("nested too deeply");
+			}
+
+			skipSpace();
+			if (position == text.size())
+			{
+				return fail("unexpected end");
+			}
+
+			char c = text[position];
+			if (c == '{')
+			{
+				return parseObject(value, depth);
+			}
+			if (c == '[')
+			{
+				return parseArray(value, depth);
+			}
+			if (c == '"')
+			{
+				value = JsonValue();
+				value.type = JsonValue::Type::String;
+				return parseString(value.string);
+			}
+			if (consume("true"))
+			{
+				value = JsonValue::makeBool(true);
+				return true;
+			}
+			if (consume("false"))
+			{
+				value = JsonValue::makeBool(false);
+				return true;
+			}
+			if (consume("null"))
+			{
+				value = JsonValue();
+				return true;
+			}
+			return parseNumber(value);
+		}
+
+		bool parseObject(JsonValue& value, int depth)
+		{
+			value = JsonValue::makeObject();
+			++position;
+
+			skipSpace();
+			if (position < text.size() && text[position] == '}')
+			{
+				++position;
+				return true;
+			}
+
+			for (;;)
+			{
+				skipSpace();
+				std::string key;
+				if (position == text.size() || text[position] != '"' || !parseString(key))
+				{
+					return fail("expected a member name");
+				}
+
+				skipSpace();
+				if (position == text.size() || text[position] != ':')
+				{
+					return fail("expected ':'");
+				}
+				++position;
+
+				JsonValue member;
+				if (!parseValue(member, depth + 1))
+				{
+					return false;
+				}
+				value.object.push_back(std::make_pair(key, member));
+
+				skipSpace();
+				if (position < text.size() && text[position] == ',')
+				{
+					++position;
+					continue;
+				}
+				if (position < text.size() && text[position] == '}')
+				{
+					++position;
+					return true;
+				}
+				return fail("expected ',' or '}'");
+			}
+		}
+
+		bool parseArray(JsonValue& value, int depth)
+		{
+			value = JsonValue::makeArray();
+			++position;
+
+			skipSpace();
+			if (position < text.size() && text[position] == ']')
+			{
+				++position;
+				return true;
+			}
+
+			for (;;)
+			{
+				JsonValue element;
+				if (!parseValue(element, depth + 1))
+				{
+					return false;
+				}
+				value.array.push_back(element);
+
+				skipSpace();
+				if (position < text.size() && text[position] == ',')
+				{
+					++position;
+					continue;
+				}
+				if (position < text.size() && text[position] == ']')
+				{
+					++position;
+					return true;
+				}
+				return fail("expected ',' or ']'");
+			}
+		}
+
+		// Escapes are kept to what we write ourselves; \u is passed through for ASCII only
+		bool parseString(std::string& out)
+		{
+			++position;
+			while (position < text.size())
+			{
+				char c = text[position++];
+				if (c == '"')
+				{
+					return true;
+				}
+				if (c != '\\')
+				{
+					out += c;
+					continue;
+				}
+
+				if (position == text.size())
+				{
+					break;
+				}
+				char escaped = text[position++];
+				switch (escaped)
+				{
+				case 'n': out += '\n'; break;
+				case 't': out += '\t'; break;
+				case 'r': out += '\r'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u':
+				{
+					if (position + 4 > text.size())
+					{
+						return fail("truncated \\u escape");
+					}
+					unsigned long code = std::strtoul(text.substr(position, 4).c_str(), nullptr, 16);
+					out += code < 0x80 ? static_cast<char>(code) : '?';
+					position += 4;
+					break;
+				}
+				default: out += escaped; break;
+				}
+			}
+			return fail("unterminated string");
+		}
+
+		bool parseNumber(JsonValue& value)
+		{
+			const char* begin = text.c_str() + position;
+			char* end = nullptr;
+			double number = std::strtod(begin, &end);
+			if (end == begin)
+			{
+				return fail("unexpected character");
+			}
+
+			position += static_cast<size_t>(end - begin);
+			value = JsonValue::makeNumber(number);
+			return true;
+		}
+
+		const std::string& text;
+		size_t position = 0;
+		std::string message;
+	};
+
+	void writeString(std::ostream& out, const std::string& text)
+	{
+		out << '"';
+		for (char c : text)
+		{
+			switch (c)
+			{
+			case '"': out << "\\\""; break;
+			case '\\': out << "\\\\"; break;
+			case '\n': out << "\\n"; break;
+			case '\t': out << "\\t"; break;
+			case '\r': out << "\\r"; break;
+			default:
+				if (static_cast<unsigned char>(c) >= 0x20)
+				{
+					out << c;
+				}
+			}
+		}
+		out << '"';
+	}
+}
+
+JsonValue JsonValue::makeNumber(double value)
+{
+	JsonValue result;
+	result.type = Type::Number;
+	result.number = value;
+	return result;
+}
+
+JsonValue JsonValue::makeString(const std::string& value)
+{
+	JsonValue result;
+	result.type = Type::String;
+	result.string = value;
+	return result;
+}
+
+JsonValue JsonValue::makeBool(bool value)
+{
+	JsonValue result;
+	result.type = Type::Bool;
+	result.boolean = value;
+	return result;
+}
+
+JsonValue JsonValue::makeArray()
+{
+	JsonValue result;
+	result.type = Type::Array;
+	return result;
+}
+
+JsonValue JsonValue::makeObject()
+{
+	JsonValue result;
+	result.type = Type::Object;
+	return result;
+}
+
+JsonValue& JsonValue::set(const std::string& key, const JsonValue& value)
+{
+	type = Type::Object;
+	for (auto& member : object)
+	{
+		if (member.first == key)
+		{
+			member.second = value;
+			return member.second;
+		}
+	}
+
+	object.push_back(std::make_pair(key, value));
+	return object.back().second;
+}
+
+const JsonValue* JsonValue::find(const std::string& key) const
+{
+	if (type != Type::Object)
+	{
+		return nullptr;
+	}
+
+	for (const auto& member : object)
+	{
+		if (member.first == key)
+		{
+			return &member.second;
+		}
+	}
+	return nullptr;
+}
+
+double JsonValue::numberAt(const std::string& path, double fallback) const
+{
+	const JsonValue* value = this;
+	size_t begin = 0;
+	while (value && begin <= path.size())
+	{
+		size_t end = path.find('.', begin);
+		if (end == std::string::npos)
+		{
+			end = path.size();
+		}
+
+		value = value->find(path.substr(begin, end - begin));
+		begin = end + 1;
+	}
+
+	return value && value->type == Type::Number ? value->number : fallback;
+}
+
+bool parseJson(const std::string& text, JsonValue& value, std::string& error)
+{
+	Parser parser(text);
+	return parser.parse(value, error);
+}
+
+bool readJsonFile(const std::string& path, JsonValue& value, std::string& error)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		error = "cannot open " + path;
+		return false;
+	}
+
+	std::stringstream contents;
+	contents << file.rdbuf();
+	if (!parseJson(contents.str(), value, error))
+	{
+		error = path + ": " + error;
+		return false;
+	}
+	return true;
+}
+
+void writeJson(std::ostream& out, const JsonValue& value, int indent)
+{
+	std::string padding(static_cast<size_t>(indent + 1) * 2, ' ');
+	std::string closing(static_cast<size_t>(indent) * 2, ' ');
+
+	switch (value.type)
+	{
+	case JsonValue::Type::Null:
+		out << "null";
+		break;
+
+	case JsonValue::Type::Bool:
+		out << (value.boolean ? "true" : "false");
+		break;
+
+	case JsonValue::Type::Number:
+	{
+		// JSON has no infinities or NaN
+		if (value.number != value.number || value.number > (std::numeric_limits<double>::max)() || value.number < -(std::numeric_limits<double>::max)())
+		{
+			out << "null";
+			break;
+		}
+		std::ostringstream number;
+		number.precision(std::numeric_limits<double>::digits10);
+		number << value.number;
+		out << number.str();
+		break;
+	}
+
+	case JsonValue::Type::String:
+		writeString(out, value.string);
+		break;
+
+	case JsonValue::Type::Array:
+		if (value.array.empty())
+		{
+			out << "[]";
+			break;
+		}
+		out << "[\n";
+		for (size_t i = 0; i < value.array.size(); ++i)
+		{
+			out << padding;
+			writeJson(out, value.array[i], indent + 1);
+			out << (i + 1 < value.array.size() ? ",\n" : "\n");
+		}
+		out << closing << "]";
+		break;
+
+	case JsonValue::Type::Object:
+		if (value.object.empty())
+		{
+			out << "{}";
+			break;
+		}
+		out << "{\n";
+		for (size_t i = 0; i < value.object.size(); ++i)
+		{
+			out << padding;
+			writeString(out, value.object[i].first);
+			out << ": ";
+			writeJson(out, value.object[i].second, indent + 1);
+			out << (i + 1 < value.object.size() ? ",\n" : "\n");
+		}
+		out << closing << "}";
+		break;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough JSON for the benchmark: reading the renderer's run reports and an earlier
+// results file, and writing results. Object members keep their order.
+struct JsonValue
+{
+	enum class Type
+	{
+		Null,
+		Bool,
+		Number,
+		String,
+		Array,
+		Object
+	};
+
+	Type type = Type::Null;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> array;
+	std::vector<std::pair<std::string, JsonValue>> object;
+
+	static JsonValue makeNumber(double value);
+	static JsonValue makeString(const std::string& value);
+	static JsonValue makeBool(bool value);
+	static JsonValue makeArray();
+	static JsonValue makeObject();
+
+	// Adds or replaces a member of an object
+	JsonValue& set(const std::string& key, const JsonValue& value);
+
+	// nullptr if this isn't an object or has no such member
+	const JsonValue* find(const std::string& key) const;
+
+	// Follows a path of object members, such as "stages.gpu.p50"; fallback if any step is missing
+	// or the value there isn't a number
+	double numberAt(const std::string& path, double fallback) const;
+};
+
+// Returns false, with a message in error, if text isn't a single JSON value
+bool parseJson(const std::string& text, JsonValue& value, std::string& error);
+
+bool readJsonFile(const std::string& path, JsonValue& value, std::string& error);
+
+void writeJson(std::ostream& out, const JsonValue& value, int indent = 0);
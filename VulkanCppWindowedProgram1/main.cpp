@@ -12,109 +12,479 @@
 #define SDL_MAIN_HANDLED
 
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_syswm.h>
 #include <SDL2/SDL_vulkan.h>
 #include <vulkan/vulkan.hpp>
 
+#include "Descriptors.h"
+#include "DeviceSelection.h"
+#include "DynamicResolution.h"
+#include "FrameCapture.h"
+#include "FrameProfiler.h"
+#include "GpuCulling.h"
+#include "JobSystem.h"
+#include "Log.h"
+#include "MemoryAllocator.h"
+#include "ParallelRecorder.h"
+#include "ParticleSystem.h"
+#include "UploadEngine.h"
+#include "PipelineCache.h"
+#include "PipelineRegistry.h"
+#include "PresentPolicy.h"
+#include "RenderGraph.h"
+#include "ResidencyManager.h"
+#include "ShaderLibrary.h"
+#include "UniformRing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <deque>
 #include <limits>
-#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
-static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-	VkDebugUtilsMessageSeverityFlagBitsEXT           messageSeverity,
-	VkDebugUtilsMessageTypeFlagsEXT                  messageType,
-	const VkDebugUtilsMessengerCallbackDataEXT*      pCallbackData,
-	void*                                            pUserData)
+struct Vertex
 {
-	std::cerr << "DEBUG: " << pCallbackData->pMessage << std::endl;
+	glm::vec2 position;
+	glm::vec3 color;
+};
 
-	return VK_FALSE;
-}
+// Per-instance data for the quad renderer
+struct QuadInstance
+{
+	glm::vec4 transform;	// xy offset, z scale, w rotation in radians
+	glm::vec4 color;
+};
 
-static std::vector<char> readFile(const std::string& filename) {
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+// Everything the quad shaders read once per frame, from the uniform ring
+struct FrameUniforms
+{
+	glm::mat4 viewProjection;
+};
 
-	if (!file.is_open()) {
-		throw std::runtime_error("failed to open file!");
-	}
+// constant_id of shader.vert's instanceRotation
+const uint32_t instanceRotationConstant = 0;
+
+// One entry in the draw list: a contiguous run of instances drawn with one drawIndexed
+struct DrawItem
+{
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+// Lays count quads out on a square grid covering the whole viewport, so the number of
+// pixels shaded stays roughly the same however many instances there are.
+static std::vector<QuadInstance> makeQuadGrid(uint32_t count)
+{
+	uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+	float cell = 2.0f / side;
 
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
+	std::vector<QuadInstance> instances(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t x = i % side;
+		uint32_t y = i / side;
 
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-	file.close();
+		// A lone quad keeps the original half-screen size and white tint
+		float scale = count == 1 ? 1.0f : cell * 0.9f;
+		glm::vec2 offset = count == 1 ? glm::vec2(0.0f) : glm::vec2(-1.0f + cell * (x + 0.5f), -1.0f + cell * (y + 0.5f));
+		glm::vec4 color = count == 1 ? glm::vec4(1.0f) : glm::vec4(0.5f + 0.5f * x / side, 0.5f + 0.5f * y / side, 1.0f, 1.0f);
 
-	return buffer;
+		instances[i].transform = glm::vec4(offset, scale, 0.0f);
+		instances[i].color = color;
+	}
+	return instances;
 }
 
-auto vertexShader = readFile("shaders/vert.spv");
-auto fragmentShader = readFile("shaders/frag.spv");
+// Everything a single frame in flight needs to itself, so the CPU can record
+// frame N+1 while the GPU is still working on frame N.
+struct FrameContext
+{
+	vk::Fence inFlight;
+	vk::Semaphore imageAvailable;
+	vk::Semaphore renderFinished;
+
+	// Only used when command buffers are recorded every frame
+	vk::CommandPool commandPool;
+	vk::CommandBuffer commandBuffer;
 
-int main()
+	// The frame inFlight was last submitted with, -1 before the first
+	int64_t submittedFrame = -1;
+};
+
+// Swapchain resources that were replaced by a resize, kept alive until the frames that used them finish.
+// Also retires just the pre-recorded command buffers when they are re-recorded for a new pipeline.
+struct RetiredSwapchain
+{
+	vk::SwapchainKHR swapchain;
+	std::vector<vk::ImageView> imageViews;
+	std::shared_ptr<RenderGraph> frameGraph;
+	std::vector<vk::CommandBuffer> commandBuffers;
+	std::shared_ptr<DescriptorAllocator> descriptors;	// sets the command buffers were recorded with
+	uint64_t retiredAtFrame;
+};
+
+// Upper bound on swapchain images, so per-image query slots survive a swapchain recreation
+const uint32_t maxSwapchainImages = 16;
+
+int main(int argc, char* argv[])
 {
-	// Create an SDL window that supports Vulkan rendering.
-	if (SDL_Init(SDL_INIT_VIDEO) != 0)
+	// How many frames the CPU is allowed to get ahead of the GPU.
+	uint32_t framesInFlight = 2;
+
+	// Headless mode renders a fixed number of frames into our own images, with no window or swapchain.
+	// A window runs until it is closed, unless --frames is given. --size sets either's size.
+	bool headless = false;
+	uint32_t frameCount = 1000;	// also the length of each --sweep-instances step
+	bool frameCountGiven = false;
+	vk::Extent2D requestedExtent = vk::Extent2D(1280, 720);
+
+	// Frame timing: --stats prints rolling percentiles every second, --trace writes every frame to CSV/JSON,
+	// --report writes a JSON summary of the run (what the benchmark harness reads)
+	bool printStats = false;
+	std::string tracePath;
+	std::string reportPath;
+
+	// Number of quads drawn in the single instanced draw. --sweep-instances instead steps through
+	// increasing counts, spending --frames frames on each, to find where we turn vertex or fill bound.
+	uint32_t instanceCount = 1;
+	bool sweepInstances = false;
+
+	// --draws splits the instances into that many draw calls. --record-threads N re-records
+	// every frame, splitting the draws into N slices that the job system records into secondary
+	// command buffers in parallel; without it the command buffers are recorded once up front.
+	uint32_t drawCount = 1;
+	uint32_t recordThreads = 0;
+
+	// Startup and the per-frame recording run as jobs on a work-stealing pool. --job-threads N sets
+	// its worker count (default one per core, less the main thread's), --job-trace out.json records
+	// every job for chrome://tracing or Perfetto.
+	uint32_t jobThreads = 0;
+	std::string jobTracePath;
+
+	// --particles N simulates N particles on the compute queue and draws them instead of the grid
+	uint32_t particleCount = 0;
+
+	// --gpu-culling culls the instances against the view in a compute pass and draws the survivors
+	// with one indirect draw. --zoom Z magnifies the view so there is something to cull.
+	bool gpuCulling = false;
+	float zoom = 1.0f;
+
+	// --gpu N skips device scoring and uses physical device N
+	int forcedDeviceIndex = -1;
+
+	// --present low-latency|vsync|uncapped picks the present mode, image count and pacing.
+	// --fps N caps the frame rate; low-latency defaults to the display's refresh rate.
+	PresentPolicy presentPolicy = PresentPolicy::LowLatency;
+	double targetFps = -1.0;
+
+	// --blend opaque|alpha|additive picks the color blend state of the quad pipeline
+	BlendMode blendMode = BlendMode::Opaque;
+
+	// --bindless puts the instance buffers in one descriptor indexing heap and has the vertex
+	// shader fetch instances by an index pushed per draw, instead of binding vertex buffers
+	bool bindless = false;
+
+	// --dynamic-resolution MS renders into an offscreen target whose resolution follows the GPU
+	// frame time, aiming to stay under MS milliseconds, and scales it up into the swapchain image.
+	// --min-resolution-scale S is the lowest it may go, per axis.
+	double resolutionTargetMs = 0.0;
+	float minResolutionScale = 0.5f;
+
+	// --capture out.png|out.y4m|out.raw copies every frame into a ring of host buffers and writes
+	// it out on a worker thread, a numbered file per frame for PNG and one stream otherwise.
+	// --capture-ring N sets how many frames can be in flight to the encoder before frames are
+	// skipped rather than waited for.
+	std::string capturePath;
+	CaptureFormat captureFormat = CaptureFormat::Raw;
+	uint32_t captureRing = 0;
+
+	// Device memory is budgeted from VK_EXT_memory_budget where the driver has it, from the heap
+	// sizes otherwise; cold buffers move to host memory when the device heap nears its budget.
+	// --memory-budget MB caps the device heaps' budget, to see how a scene would fare on a smaller GPU.
+	uint32_t memoryBudgetMb = 0;
+
+	// Validation messages and the startup device dumps go through the logger, which writes them on
+	// a thread of its own. --log-level error|warning|info|verbose sets how much (the dumps are
+	// verbose), --log-sources program,general,validation,performance which kinds, and --log-rate N
+	// how many messages with the same ID a second get through.
+	Logger logger;
+
+	for (int i = 1; i < argc; ++i)
 	{
-		std::cout << "Could not initialize SDL." << std::endl;
-		return 1;
+		std::string arg = argv[i];
+		if (arg == "--frames-in-flight" && i + 1 < argc)
+		{
+			framesInFlight = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+		else if (arg == "--headless")
+		{
+			headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc)
+		{
+			frameCount = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+			frameCountGiven = true;
+		}
+		else if (arg == "--stats")
+		{
+			printStats = true;
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+		}
+		else if (arg == "--report" && i + 1 < argc)
+		{
+			reportPath = argv[++i];
+		}
+		else if (arg == "--instances" && i + 1 < argc)
+		{
+			instanceCount = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+		else if (arg == "--draws" && i + 1 < argc)
+		{
+			drawCount = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+		else if (arg == "--record-threads" && i + 1 < argc)
+		{
+			recordThreads = static_cast<uint32_t>((std::max)(0, std::stoi(argv[++i])));
+		}
+		else if (arg == "--job-threads" && i + 1 < argc)
+		{
+			jobThreads = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+		else if (arg == "--job-trace" && i + 1 < argc)
+		{
+			jobTracePath = argv[++i];
+		}
+		else if (arg == "--particles" && i + 1 < argc)
+		{
+			particleCount = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+		else if (arg == "--bindless")
+		{
+			bindless = true;
+		}
+		else if (arg == "--gpu-culling")
+		{
+			gpuCulling = true;
+		}
+		else if (arg == "--zoom" && i + 1 < argc)
+		{
+			zoom = (std::max)(0.001f, std::stof(argv[++i]));
+		}
+		else if (arg == "--gpu" && i + 1 < argc)
+		{
+			forcedDeviceIndex = std::stoi(argv[++i]);
+		}
+		else if (arg == "--present" && i + 1 < argc)
+		{
+			if (!parsePresentPolicy(argv[++i], presentPolicy))
+			{
+				std::cout << "Unknown present policy " << argv[i] << ", expected low-latency, vsync or uncapped." << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--blend" && i + 1 < argc)
+		{
+			if (!parseBlendMode(argv[++i], blendMode))
+			{
+				std::cout << "Unknown blend mode " << argv[i] << ", expected opaque, alpha or additive." << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--log-level" && i + 1 < argc)
+		{
+			LogLevel level;
+			if (!parseLogLevel(argv[++i], level))
+			{
+				std::cout << "Unknown log level " << argv[i] << ", expected error, warning, info or verbose." << std::endl;
+				return 1;
+			}
+			logger.setLevel(level);
+		}
+		else if (arg == "--log-sources" && i + 1 < argc)
+		{
+			uint32_t sources;
+			if (!parseLogSources(argv[++i], sources))
+			{
+				std::cout << "Unknown log sources " << argv[i] << ", expected a comma separated list of program, general, validation and performance." << std::endl;
+				return 1;
+			}
+			logger.setSources(sources);
+		}
+		else if (arg == "--log-rate" && i + 1 < argc)
+		{
+			logger.setRateLimit(static_cast<uint32_t>((std::max)(0, std::stoi(argv[++i]))));
+		}
+		else if (arg == "--dynamic-resolution" && i + 1 < argc)
+		{
+			resolutionTargetMs = (std::max)(0.0, std::stod(argv[++i]));
+		}
+		else if (arg == "--min-resolution-scale" && i + 1 < argc)
+		{
+			minResolutionScale = (std::max)(0.1f, (std::min)(1.0f, std::stof(argv[++i])));
+		}
+		else if (arg == "--capture" && i + 1 < argc)
+		{
+			capturePath = argv[++i];
+			if (!captureFormatFromPath(capturePath, captureFormat))
+			{
+				std::cout << "Unknown capture format " << capturePath << ", expected a .png, .y4m or .raw file." << std::endl;
+				return 1;
+			}
+		}
+		else if (arg == "--memory-budget" && i + 1 < argc)
+		{
+			memoryBudgetMb = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+		else if (arg == "--capture-ring" && i + 1 < argc)
+		{
+			captureRing = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+		else if (arg == "--fps" && i + 1 < argc)
+		{
+			targetFps = (std::max)(0.0, std::stod(argv[++i]));
+		}
+		else if (arg == "--sweep-instances")
+		{
+			sweepInstances = true;
+		}
+		else if (arg == "--size" && i + 2 < argc)
+		{
+			requestedExtent.width = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+			requestedExtent.height = static_cast<uint32_t>((std::max)(1, std::stoi(argv[++i])));
+		}
+	}
+
+	if (particleCount > 0 && sweepInstances)
+	{
+		std::cout << "--sweep-instances does not apply to --particles, ignoring it" << std::endl;
+		sweepInstances = false;
 	}
 
-	SDL_Window* window = SDL_CreateWindow("Vulkan Window", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1280, 720, SDL_WINDOW_VULKAN);
+	SDL_Window* window = NULL;
+	std::vector<const char*> instanceExtensions;
 
-	if (window == NULL)
+	if (!headless)
 	{
-		std::cout << "Could not create SDL window." << std::endl;
-		return 1;
+		// Create an SDL window that supports Vulkan rendering.
+		if (SDL_Init(SDL_INIT_VIDEO) != 0)
+		{
+			std::cout << "Could not initialize SDL." << std::endl;
+			return 1;
+		}
+
+		window = SDL_CreateWindow("Vulkan Window", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, static_cast<int>(requestedExtent.width), static_cast<int>(requestedExtent.height), SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+
+		if (window == NULL)
+		{
+			std::cout << "Could not create SDL window." << std::endl;
+			return 1;
+		}
+
+
+		// Get WSI extensions from SDL (we can add more if we like - we just can't remove these)
+		unsigned extensionCount;
+		if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, NULL)) 
+		{
+			std::cout << "Could not get the number of required instance extensions from SDL." << std::endl;
+			return 1;
+		}
+
+		instanceExtensions.resize(extensionCount);
+		if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, instanceExtensions.data())) 
+		{
+			std::cout << "Could not get the names of required instance extensions from SDL." << std::endl;
+			return 1;
+		}
 	}
 
+	LogLine(logger, LogLevel::Verbose) << "required instance extensions: ";
+	for (const auto& extension : instanceExtensions)
+	{
+		LogLine(logger, LogLevel::Verbose) << "\t" << extension;
+	}
 
-	// Get WSI extensions from SDL (we can add more if we like - we just can't remove these)
-	unsigned extensionCount;
-	if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, NULL)) 
+	auto availableInstanceExtensions = vk::enumerateInstanceExtensionProperties();
+	LogLine(logger, LogLevel::Verbose) << "available instance extensions: ";
+	for (const auto& extension : availableInstanceExtensions)
 	{
-		std::cout << "Could not get the number of required instance extensions from SDL." << std::endl;
-		return 1;
+		LogLine(logger, LogLevel::Verbose) << "\t" << extension.extensionName;
 	}
 
-	std::vector<const char*> instanceExtensions(extensionCount);
-	if (!SDL_Vulkan_GetInstanceExtensions(window, &extensionCount, instanceExtensions.data())) 
+	// Enabled whenever the instance offers it, so --log-level can show validation and driver
+	// messages in any build. Without it there is no debug messenger.
+	bool debugUtils = false;
+	for (const auto& extension : availableInstanceExtensions)
 	{
-		std::cout << "Could not get the names of required instance extensions from SDL." << std::endl;
-		return 1;
+		debugUtils = debugUtils || std::strcmp(extension.extensionName, VK_EXT_DEBUG_UTILS_EXTENSION_NAME) == 0;
 	}
 
-	std::cout << "required instance extensions: " << std::endl;
-	for (const auto& extension : instanceExtensions)
+	if (debugUtils)
 	{
-		std::cout << "\t" << extension << std::endl;
+		instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 	}
 
-	auto availableInstanceExtensions = vk::enumerateInstanceExtensionProperties();
-	std::cout << "available instance extensions: " << std::endl;
+	// Descriptor indexing features and memory budgets can only be queried through the
+	// vkGetPhysicalDevice*2 functions
+	bool properties2 = false;
 	for (const auto& extension : availableInstanceExtensions)
 	{
-		std::cout << "\t" << extension.extensionName << std::endl;
+		properties2 = properties2 || std::strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0;
 	}
 
-#if defined(_DEBUG)
-	instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-#endif
+	if (properties2)
+	{
+		instanceExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	}
+	else if (bindless)
+	{
+		std::cout << "bindless: " << VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME << " not available, binding vertex buffers instead" << std::endl;
+		bindless = false;
+	}
 
 
 	auto availableInstanceLayers = vk::enumerateInstanceLayerProperties();
-	std::cout << "available instance layers: " << std::endl;
+	LogLine(logger, LogLevel::Verbose) << "available instance layers: ";
 	for (const auto& layer : availableInstanceLayers)
 	{
-		std::cout << "\t" << layer.layerName << ": " << layer.description << std::endl;
+		LogLine(logger, LogLevel::Verbose) << "\t" << layer.layerName << ": " << layer.description;
 	}
 
-	// Use validation layers if this is a debug build
+	// Use validation layers if this is a debug build, the current one or the meta layer older SDKs
+	// shipped instead, and run without them if neither is installed
 	std::vector<const char*> instanceLayers;
 #if defined(_DEBUG)
-	instanceLayers.push_back("VK_LAYER_LUNARG_standard_validation");
+	const char* validationLayers[] = { "VK_LAYER_KHRONOS_validation", "VK_LAYER_LUNARG_standard_validation" };
+	for (const char* validationLayer : validationLayers)
+	{
+		bool found = std::any_of(availableInstanceLayers.begin(), availableInstanceLayers.end(), [validationLayer](const vk::LayerProperties& layer)
+		{
+			return std::strcmp(layer.layerName, validationLayer) == 0;
+		});
+
+		if (found)
+		{
+			instanceLayers.push_back(validationLayer);
+			break;
+		}
+	}
+
+	if (instanceLayers.empty())
+	{
+		std::cout << "No validation layers installed, running without them" << std::endl;
+	}
 #endif
 
 
@@ -145,251 +515,380 @@ int main()
 		return 1;
 	}
 
-	vk::DebugUtilsMessengerCreateInfoEXT debugInfo = vk::DebugUtilsMessengerCreateInfoEXT()
-		.setMessageSeverity(vk::DebugUtilsMessageSeverityFlagBitsEXT::eError | vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo | vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose | vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning)
-		.setMessageType(vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral | vk::DebugUtilsMessageTypeFlagBitsEXT::ePerformance | vk::DebugUtilsMessageTypeFlagBitsEXT::eValidation)
-		.setPfnUserCallback(debugCallback)
-		.setPUserData(nullptr);
-
-	auto debugUtilsMessenger = instance.createDebugUtilsMessengerEXT(debugInfo, nullptr, vk::DispatchLoaderDynamic(instance));
-
-	vk::DebugUtilsMessengerCallbackDataEXT testMessage = vk::DebugUtilsMessengerCallbackDataEXT().setPMessage("Hey");
-	instance.submitDebugUtilsMessageEXT(vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose, vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral, testMessage, vk::DispatchLoaderDynamic(instance));
-	
+	// Asks for the severities --log-level lets through; change the level with debugMessenger.setLevel()
+	DebugMessenger debugMessenger(instance, logger, debugUtils);
 
 	//
 	auto physicalDevices = instance.enumeratePhysicalDevices();
-	std::cout << "available physical devices: " << std::endl;
-	std::cout << "\tDeviceID\tDeviceName" << std::endl;
+	LogLine(logger, LogLevel::Verbose) << "available physical devices: ";
+	LogLine(logger, LogLevel::Verbose) << "\tDeviceID\tDeviceName";
 	for (const auto& physicalDevice : physicalDevices)
 	{
 		auto properties = physicalDevice.getProperties();
-		std::cout << "\t" << properties.deviceID << "\t" << properties.deviceName << "\t with queue properties:" << std::endl;
+		LogLine(logger, LogLevel::Verbose) << "\t" << properties.deviceID << "\t" << properties.deviceName << "\t with queue properties:";
 		unsigned int family = 0;
 		for (const auto& queueProperty : physicalDevice.getQueueFamilyProperties())
 		{
-			std::cout << "\tFamily " << family << " Queue Count: " << queueProperty.queueCount << std::endl;
+			LogLine(logger, LogLevel::Verbose) << "\tFamily " << family << " Queue Count: " << queueProperty.queueCount;
 
 			auto flags = queueProperty.queueFlags;
-			std::cout << "\t\tCompute: " << (bool)(flags & vk::QueueFlagBits::eCompute) << std::endl;
-			std::cout << "\t\tGraphics: " << (bool)(flags & vk::QueueFlagBits::eGraphics) << std::endl;
-			std::cout << "\t\tProtected: " << (bool)(flags & vk::QueueFlagBits::eProtected) << std::endl;
-			std::cout << "\t\tSparseBinding: " << (bool)(flags & vk::QueueFlagBits::eSparseBinding) << std::endl;
-			std::cout << "\t\tTransfer: " << (bool)(flags & vk::QueueFlagBits::eTransfer) << std::endl;
+			LogLine(logger, LogLevel::Verbose) << "\t\tCompute: " << (bool)(flags & vk::QueueFlagBits::eCompute);
+			LogLine(logger, LogLevel::Verbose) << "\t\tGraphics: " << (bool)(flags & vk::QueueFlagBits::eGraphics);
+			LogLine(logger, LogLevel::Verbose) << "\t\tProtected: " << (bool)(flags & vk::QueueFlagBits::eProtected);
+			LogLine(logger, LogLevel::Verbose) << "\t\tSparseBinding: " << (bool)(flags & vk::QueueFlagBits::eSparseBinding);
+			LogLine(logger, LogLevel::Verbose) << "\t\tTransfer: " << (bool)(flags & vk::QueueFlagBits::eTransfer);
 
 			++family;
 		}
 	}
 
-	// Just select the first one for now
-	vk::PhysicalDevice physicalDevice = physicalDevices.at(0);
+	vk::SurfaceKHR surface;
+	if (!headless)
+	{
+		// Create a Vulkan surface for rendering. We need it before picking a device, to check present support.
+		VkSurfaceKHR c_surface;
+		if (!SDL_Vulkan_CreateSurface(window, static_cast<VkInstance>(instance), &c_surface))
+		{
+			std::cout << "Could not create a Vulkan surface." << std::endl;
+			return 1;
+		}
+		surface = vk::SurfaceKHR(c_surface);
+	}
+
+	std::vector<const char*> deviceExtensions;
+	if (!headless)
+	{
+		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
+
+	vk::PhysicalDeviceFeatures requiredFeatures = vk::PhysicalDeviceFeatures();
+
+	// Device selection still prints straight to stdout, so let the dumps above come out first
+	logger.flush();
+
+	std::cout << "physical device scores: " << std::endl;
+	vk::PhysicalDevice physicalDevice;
+	try
+	{
+		physicalDevice = selectPhysicalDevice(physicalDevices, surface, deviceExtensions, requiredFeatures, forcedDeviceIndex);
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "Could not select a physical device: " << e.what() << std::endl;
+		return 1;
+	}
+
+	QueueFamilies queueFamilies = findQueueFamilies(physicalDevice, surface);
+	std::cout << "selected " << physicalDevice.getProperties().deviceName << " with queue families graphics " << queueFamilies.graphics
+		<< ", present " << (int)queueFamilies.present << ", compute " << queueFamilies.compute << ", transfer " << queueFamilies.transfer << std::endl;
 
 	auto availableDeviceExtensions = physicalDevice.enumerateDeviceExtensionProperties();
-	std::cout << "available device extensions: " << std::endl;
+	LogLine(logger, LogLevel::Verbose) << "available device extensions: ";
 	for (const auto& extension : availableDeviceExtensions)
 	{
-		std::cout << "\t" << extension.extensionName << std::endl;
+		LogLine(logger, LogLevel::Verbose) << "\t" << extension.extensionName;
 	}
 
-	std::vector<const char*> deviceExtensions;
-	deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
-
 	auto availableDeviceLayers = physicalDevice.enumerateDeviceLayerProperties();
-	std::cout << "available device layers: " << std::endl;
+	LogLine(logger, LogLevel::Verbose) << "available device layers: ";
 	for (const auto& layer : availableDeviceLayers)
 	{
-		std::cout << "\t" << layer.layerName << ": " << layer.description << std::endl;
+		LogLine(logger, LogLevel::Verbose) << "\t" << layer.layerName << ": " << layer.description;
 	}
+	logger.flush();
 	
+	// One queue from each distinct family we picked
 	float priority = 1.0f;
-	vk::DeviceQueueCreateInfo deviceQueueInfo = vk::DeviceQueueCreateInfo()
-		.setQueueFamilyIndex(0)
-		.setQueueCount(1)
-		.setPQueuePriorities(&priority);
+	std::vector<vk::DeviceQueueCreateInfo> deviceQueueInfos;
+	for (uint32_t family : queueFamilies.unique())
+	{
+		deviceQueueInfos.push_back(vk::DeviceQueueCreateInfo()
+			.setQueueFamilyIndex(family)
+			.setQueueCount(1)
+			.setPQueuePriorities(&priority));
+	}
+
+	BindlessSupport bindlessSupport;
+	if (bindless)
+	{
+		bindlessSupport = queryBindlessSupport(physicalDevice, vk::DispatchLoaderDynamic(instance));
+		if (bindlessSupport.supported)
+		{
+			deviceExtensions.insert(deviceExtensions.end(), bindlessSupport.extensions.begin(), bindlessSupport.extensions.end());
+			requiredFeatures
+				.setShaderStorageBufferArrayDynamicIndexing(VK_TRUE)
+				.setShaderSampledImageArrayDynamicIndexing(VK_TRUE);
+		}
+		else
+		{
+			std::cout << "bindless: descriptor indexing not supported (or too few update-after-bind descriptors), binding vertex buffers instead" << std::endl;
+			bindless = false;
+		}
+	}
+
+	bool memoryBudget = false;
+	if (properties2)
+	{
+		for (const auto& extension : availableDeviceExtensions)
+		{
+			memoryBudget = memoryBudget || std::strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0;
+		}
+	}
+	if (memoryBudget)
+	{
+		deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	}
+	else
+	{
+		std::cout << "memory budget: " << VK_EXT_MEMORY_BUDGET_EXTENSION_NAME << " not available, estimating budgets from the heap sizes" << std::endl;
+	}
 
 	vk::DeviceCreateInfo deviceInfo = vk::DeviceCreateInfo()
-		.setPQueueCreateInfos(&deviceQueueInfo)
-		.setQueueCreateInfoCount(1)
-		.setPEnabledFeatures({})
+		.setPNext(bindless ? &bindlessSupport.enabledFeatures : nullptr)
+		.setPQueueCreateInfos(deviceQueueInfos.data())
+		.setQueueCreateInfoCount(static_cast<uint32_t>(deviceQueueInfos.size()))
+		.setPEnabledFeatures(&requiredFeatures)
 		.setEnabledExtensionCount(static_cast<uint32_t>(deviceExtensions.size()))
 		.setPpEnabledExtensionNames(deviceExtensions.data())
 		.setEnabledLayerCount(static_cast<uint32_t>(instanceLayers.size()))
 		.setPpEnabledLayerNames(instanceLayers.data());
 
 	vk::Device logicalDevice = physicalDevice.createDevice(deviceInfo);
-	vk::Queue queue = logicalDevice.getQueue(0, 0);
+	vk::Queue queue = logicalDevice.getQueue(queueFamilies.graphics, 0);
+	vk::Queue presentQueue = headless ? queue : logicalDevice.getQueue(queueFamilies.present, 0);
+	vk::Queue computeQueue = logicalDevice.getQueue(queueFamilies.compute, 0);
+	vk::Queue transferQueue = logicalDevice.getQueue(queueFamilies.transfer, 0);
 
-	// Create a Vulkan surface for rendering
-	VkSurfaceKHR c_surface;
-	if (!SDL_Vulkan_CreateSurface(window, static_cast<VkInstance>(instance), &c_surface))
+	MemoryAllocator allocator(physicalDevice, logicalDevice);
+	if (memoryBudget)
 	{
-		std::cout << "Could not create a Vulkan surface." << std::endl;
-		return 1;
+		allocator.enableMemoryBudget(vk::DispatchLoaderDynamic(instance));
+	}
+	allocator.setBudgetLimit(vk::DeviceSize(memoryBudgetMb) << 20);
+	UploadEngine uploads(logicalDevice, physicalDevice, allocator, transferQueue, queueFamilies.transfer, queue, queueFamilies.graphics);
+
+	// Set layouts are shared by signature; long-lived sets come from one allocator that is never reset
+	DescriptorLayoutCache descriptorLayouts(logicalDevice);
+	DescriptorAllocator descriptors(logicalDevice);
+
+	std::unique_ptr<BindlessHeap> bindlessHeap;
+	if (bindless)
+	{
+		bindlessHeap.reset(new BindlessHeap(logicalDevice, descriptorLayouts, bindlessSupport, framesInFlight));
 	}
-	vk::SurfaceKHR surface = vk::SurfaceKHR(c_surface);
 
-	vk::SurfaceCapabilitiesKHR surfaceCapabilities = physicalDevice.getSurfaceCapabilitiesKHR(surface);
-	std::vector<vk::SurfaceFormatKHR> surfaceFormats = physicalDevice.getSurfaceFormatsKHR(surface);
-	std::vector<vk::PresentModeKHR> surfacePresentModes = physicalDevice.getSurfacePresentModesKHR(surface);
+	// Per-frame uniforms, bound at set 0 of the quad pipeline with a dynamic offset per frame
+	UniformRing uniforms(physicalDevice, logicalDevice, allocator, descriptorLayouts, descriptors, framesInFlight, 64 * 1024, sizeof(FrameUniforms));
+
+	vk::SwapchainKHR swapchain;
+	vk::Extent2D extent = requestedExtent;
 
 	vk::SurfaceFormatKHR chosenSurfaceFormat;
 	chosenSurfaceFormat.colorSpace = vk::ColorSpaceKHR::eSrgbNonlinear;
 	chosenSurfaceFormat.format = vk::Format::eB8G8R8A8Unorm; //vk::Format::eB8G8R8A8Srgb;
 
-	vk::PresentModeKHR chosenPresentMode = vk::PresentModeKHR::eMailbox;
-	//vk::PresentModeKHR chosenPresentMode = vk::PresentModeKHR::eFifo;
+	// The format is picked once: the render pass and pipeline depend on it, so recreation keeps it
+	if (!headless)
+	{
+		chosenSurfaceFormat = chooseSurfaceFormat(physicalDevice.getSurfaceFormatsKHR(surface));
+	}
+	vk::PresentModeKHR chosenPresentMode = vk::PresentModeKHR::eFifo;
+
+	// In headless mode these are images we allocate ourselves rather than ones owned by a swapchain
+	std::vector<vk::Image> swapchainImages;
+	std::vector<Allocation*> headlessImageAllocations;
+
+	// Creates a swapchain for the surface's current size. Passing the previous swapchain lets the
+	// driver hand its resources over. Returns false, leaving everything as it was, when the
+	// window has no area (e.g. while minimized).
+	auto createSwapchain = [&](vk::SwapchainKHR oldSwapchain) -> bool
+	{
+		vk::SurfaceCapabilitiesKHR surfaceCapabilities = physicalDevice.getSurfaceCapabilitiesKHR(surface);
+		std::vector<vk::PresentModeKHR> surfacePresentModes = physicalDevice.getSurfacePresentModesKHR(surface);
+
+		vk::PresentModeKHR newPresentMode = choosePresentMode(presentPolicy, surfacePresentModes);
+
+		vk::Extent2D newExtent = surfaceCapabilities.currentExtent;
+		if (newExtent.width == (std::numeric_limits<uint32_t>::max)())
+		{
+			// The surface lets us pick, so match the window
+			int width, height;
+			SDL_Vulkan_GetDrawableSize(window, &width, &height);
+			newExtent.width = (std::max)(surfaceCapabilities.minImageExtent.width, (std::min)(surfaceCapabilities.maxImageExtent.width, static_cast<uint32_t>(width)));
+			newExtent.height = (std::max)(surfaceCapabilities.minImageExtent.height, (std::min)(surfaceCapabilities.maxImageExtent.height, static_cast<uint32_t>(height)));
+		}
+
+		if (newExtent.width == 0 || newExtent.height == 0)
+		{
+			return false;
+		}
+
+		uint32_t imageCount = chooseImageCount(presentPolicy, newPresentMode, surfaceCapabilities);
+
+		// Dynamic resolution blits into the swapchain images, and capture copies out of them
+		vk::ImageUsageFlags imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+		if (resolutionTargetMs > 0.0)
+		{
+			if (surfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferDst)
+			{
+				imageUsage |= vk::ImageUsageFlagBits::eTransferDst;
+			}
+			else
+			{
+				std::cout << "The surface can't blit into its images, dynamic resolution disabled" << std::endl;
+				resolutionTargetMs = 0.0;
+			}
+		}
+		if (!capturePath.empty())
+		{
+			if (surfaceCapabilities.supportedUsageFlags & vk::ImageUsageFlagBits::eTransferSrc)
+			{
+				imageUsage |= vk::ImageUsageFlagBits::eTransferSrc;
+			}
+			else
+			{
+				std::cout << "The surface can't copy out of its images, capture disabled" << std::endl;
+				capturePath.clear();
+			}
+		}
+
+		// Graphics renders into the images and present reads them; share them if those are different families
+		uint32_t swapchainFamilies[] = { queueFamilies.graphics, queueFamilies.present };
+		bool concurrentImages = queueFamilies.graphics != queueFamilies.present;
+
+		vk::SwapchainCreateInfoKHR swapchainInfo = vk::SwapchainCreateInfoKHR()
+			.setSurface(surface)
+			.setMinImageCount(imageCount)
+			.setImageFormat(chosenSurfaceFormat.format)
+			.setImageColorSpace(chosenSurfaceFormat.colorSpace)
+			.setImageExtent(newExtent)
+			.setImageArrayLayers(1)
+			.setImageUsage(imageUsage)
+			.setImageSharingMode(concurrentImages ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive)
+			.setQueueFamilyIndexCount(concurrentImages ? 2 : 0)
+			.setPQueueFamilyIndices(concurrentImages ? swapchainFamilies : nullptr)
+			.setPreTransform(surfaceCapabilities.currentTransform)
+			.setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
+			.setPresentMode(newPresentMode)
+			.setClipped(VK_TRUE)
+			.setOldSwapchain(oldSwapchain);
+
+		swapchain = logicalDevice.createSwapchainKHR(swapchainInfo);
+		extent = newExtent;
+		chosenPresentMode = newPresentMode;
+
+		swapchainImages = logicalDevice.getSwapchainImagesKHR(swapchain);
+		if (swapchainImages.size() > maxSwapchainImages)
+		{
+			throw std::runtime_error("swapchain has more images than we have query slots for!");
+		}
+
+		return true;
+	};
 
-	vk::Extent2D extent = surfaceCapabilities.currentExtent;
+	if (!headless)
+	{
+		if (!createSwapchain(VK_NULL_HANDLE))
+		{
+			std::cout << "Could not create a swapchain for a window with no area." << std::endl;
+			return 1;
+		}
 
-	uint32_t imageCount = surfaceCapabilities.minImageCount + 1;
-	if (surfaceCapabilities.maxImageCount > 0 && imageCount > surfaceCapabilities.maxImageCount) {
-		imageCount = surfaceCapabilities.maxImageCount;
+		std::cout << "Presenting " << presentPolicyName(presentPolicy) << " with " << vk::to_string(chosenPresentMode)
+			<< ", " << swapchainImages.size() << " images, " << vk::to_string(chosenSurfaceFormat.format) << std::endl;
+	}
+	else
+	{
+		// One render target per frame in flight, so consecutive frames never touch the same image
+		for (uint32_t i = 0; i < framesInFlight; ++i)
+		{
+			vk::ImageCreateInfo imageInfo = vk::ImageCreateInfo()
+				.setImageType(vk::ImageType::e2D)
+				.setFormat(chosenSurfaceFormat.format)
+				.setExtent(vk::Extent3D(extent.width, extent.height, 1))
+				.setMipLevels(1)
+				.setArrayLayers(1)
+				.setSamples(vk::SampleCountFlagBits::e1)
+				.setTiling(vk::ImageTiling::eOptimal)
+				.setUsage(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst)
+				.setSharingMode(vk::SharingMode::eExclusive)
+				.setInitialLayout(vk::ImageLayout::eUndefined);
+
+			Allocation* allocation = allocator.createImage(imageInfo, MemoryUsage::GpuOnly);
+
+			swapchainImages.push_back(allocation->image);
+			headlessImageAllocations.push_back(allocation);
+		}
 	}
 
-	uint32_t result = physicalDevice.getSurfaceSupportKHR(0, surface);
-	std::cout << "physical device surface support? " << result << std::endl;
-
-	vk::SwapchainCreateInfoKHR swapchainInfo = vk::SwapchainCreateInfoKHR()
-		.setSurface(surface)
-		.setMinImageCount(imageCount)
-		.setImageFormat(chosenSurfaceFormat.format)
-		.setImageColorSpace(chosenSurfaceFormat.colorSpace)
-		.setImageExtent(extent)
-		.setImageArrayLayers(1)
-		.setImageUsage(vk::ImageUsageFlagBits::eColorAttachment)
-		.setImageSharingMode(vk::SharingMode::eExclusive)
-		.setQueueFamilyIndexCount(0)
-		.setPQueueFamilyIndices(nullptr)
-		.setPreTransform(surfaceCapabilities.currentTransform)
-		.setCompositeAlpha(vk::CompositeAlphaFlagBitsKHR::eOpaque)
-		.setPresentMode(chosenPresentMode)
-		.setClipped(VK_TRUE)
-		.setOldSwapchain(VK_NULL_HANDLE);
-
-	vk::SwapchainKHR swapchain = logicalDevice.createSwapchainKHR(swapchainInfo);
-
-	std::vector<vk::Image> swapchainImages = logicalDevice.getSwapchainImagesKHR(swapchain);
-	std::vector<vk::ImageView> swapchainImageViews(swapchainImages.size());
-	for (size_t i = 0; i < swapchainImageViews.size(); ++i)
-	{
-		vk::ImageViewCreateInfo imageViewInfo = vk::ImageViewCreateInfo()
-			.setImage(swapchainImages[i])
-			.setViewType(vk::ImageViewType::e2D)
-			.setFormat(chosenSurfaceFormat.format);
-
-		imageViewInfo.components.r = vk::ComponentSwizzle::eIdentity;
-		imageViewInfo.components.g = vk::ComponentSwizzle::eIdentity;
-		imageViewInfo.components.b = vk::ComponentSwizzle::eIdentity;
-		imageViewInfo.components.a = vk::ComponentSwizzle::eIdentity;
-
-		imageViewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
-		imageViewInfo.subresourceRange.baseMipLevel = 0;
-		imageViewInfo.subresourceRange.levelCount = 1;
-		imageViewInfo.subresourceRange.baseArrayLayer = 0;
-		imageViewInfo.subresourceRange.layerCount = 1;
-
-		vk::ImageView imageView = logicalDevice.createImageView(imageViewInfo);
-		swapchainImageViews[i] = imageView;
-	}
-
-	vk::ShaderModuleCreateInfo vertexShaderCreateInfo = vk::ShaderModuleCreateInfo()
-		.setCodeSize(vertexShader.size())
-		.setPCode(reinterpret_cast<const uint32_t*>(vertexShader.data()));
-	vk::ShaderModule vertexShaderModule = logicalDevice.createShaderModule(vertexShaderCreateInfo);
-
-	vk::ShaderModuleCreateInfo fragmentShaderCreateInfo = vk::ShaderModuleCreateInfo()
-		.setCodeSize(fragmentShader.size())
-		.setPCode(reinterpret_cast<const uint32_t*>(fragmentShader.data()));
-	vk::ShaderModule fragmentShaderModule = logicalDevice.createShaderModule(fragmentShaderCreateInfo);
-
-
-
-	vk::PipelineShaderStageCreateInfo pipelineVertexShaderStageInfo = vk::PipelineShaderStageCreateInfo()
-		.setStage(vk::ShaderStageFlagBits::eVertex)
-		.setModule(vertexShaderModule)
-		.setPName("main");
-
-	vk::PipelineShaderStageCreateInfo pipelineFragmentShaderStageInfo = vk::PipelineShaderStageCreateInfo()
-		.setStage(vk::ShaderStageFlagBits::eFragment)
-		.setModule(fragmentShaderModule)
-		.setPName("main");
-
-	vk::PipelineShaderStageCreateInfo shaderStages[] = { pipelineVertexShaderStageInfo, pipelineFragmentShaderStageInfo };
-
-
-	vk::PipelineVertexInputStateCreateInfo vertexInputInfo = vk::PipelineVertexInputStateCreateInfo()
-		.setVertexBindingDescriptionCount(0)
-		.setPVertexBindingDescriptions(nullptr)
-		.setVertexAttributeDescriptionCount(0)
-		.setPVertexAttributeDescriptions(nullptr);
-
-	vk::PipelineInputAssemblyStateCreateInfo inputAssemblyInfo = vk::PipelineInputAssemblyStateCreateInfo()
-		.setTopology(vk::PrimitiveTopology::eTriangleFan)
-		.setPrimitiveRestartEnable(VK_FALSE);
-
-	vk::Viewport viewport = vk::Viewport()
-		.setX(0.0f)
-		.setY(0.0f)
-		.setWidth(extent.width)
-		.setHeight(extent.height)
-		.setMinDepth(0.0f)
-		.setMaxDepth(1.0f);
-
-	vk::Rect2D scissor = vk::Rect2D()
-		.setOffset(vk::Offset2D(0, 0))
-		.setExtent(extent);
-
-	vk::PipelineViewportStateCreateInfo viewportInfo = vk::PipelineViewportStateCreateInfo()
-		.setViewportCount(1)
-		.setPViewports(&viewport)
-		.setScissorCount(1)
-		.setPScissors(&scissor);
-
-	vk::PipelineRasterizationStateCreateInfo rasterizerInfo = vk::PipelineRasterizationStateCreateInfo()
-		.setDepthClampEnable(VK_FALSE)
-		.setRasterizerDiscardEnable(VK_FALSE)
-		.setPolygonMode(vk::PolygonMode::eFill)
-		.setLineWidth(1.0f)
-		.setCullMode(vk::CullModeFlagBits::eBack)
-		.setFrontFace(vk::FrontFace::eClockwise)
-		.setDepthBiasEnable(VK_FALSE)
-		.setDepthBiasConstantFactor(0.0f)
-		.setDepthBiasClamp(0.0f)
-		.setDepthBiasSlopeFactor(0.0f);
-
-	vk::PipelineMultisampleStateCreateInfo multisamplingInfo = vk::PipelineMultisampleStateCreateInfo()
-		.setSampleShadingEnable(VK_FALSE)
-		.setRasterizationSamples(vk::SampleCountFlagBits::e1)
-		.setMinSampleShading(1.0f)
-		.setPSampleMask(nullptr)
-		.setAlphaToCoverageEnable(VK_FALSE)
-		.setAlphaToOneEnable(VK_FALSE);
-
-	vk::PipelineColorBlendAttachmentState colorBlendAttachment = vk::PipelineColorBlendAttachmentState()
-		.setColorWriteMask(vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA)
-		.setBlendEnable(VK_FALSE)
-		.setSrcColorBlendFactor(vk::BlendFactor::eOne)
-		.setDstColorBlendFactor(vk::BlendFactor::eZero)
-		.setColorBlendOp(vk::BlendOp::eAdd)
-		.setSrcAlphaBlendFactor(vk::BlendFactor::eOne)
-		.setDstAlphaBlendFactor(vk::BlendFactor::eZero)
-		.setAlphaBlendOp(vk::BlendOp::eAdd);
-
-	vk::PipelineColorBlendStateCreateInfo colorBlendInfo = vk::PipelineColorBlendStateCreateInfo()
-		.setLogicOpEnable(VK_FALSE)
-		.setLogicOp(vk::LogicOp::eCopy)
-		.setAttachmentCount(1)
-		.setPAttachments(&colorBlendAttachment)
-		.setBlendConstants({ 0.0f, 0.0f, 0.0f, 0.0f });
+	std::vector<vk::ImageView> swapchainImageViews;
+	auto createImageViews = [&]()
+	{
+		swapchainImageViews.resize(swapchainImages.size());
+		for (size_t i = 0; i < swapchainImageViews.size(); ++i)
+		{
+			vk::ImageViewCreateInfo imageViewInfo = vk::ImageViewCreateInfo()
+				.setImage(swapchainImages[i])
+				.setViewType(vk::ImageViewType::e2D)
+				.setFormat(chosenSurfaceFormat.format);
+
+			imageViewInfo.components.r = vk::ComponentSwizzle::eIdentity;
+			imageViewInfo.components.g = vk::ComponentSwizzle::eIdentity;
+			imageViewInfo.components.b = vk::ComponentSwizzle::eIdentity;
+			imageViewInfo.components.a = vk::ComponentSwizzle::eIdentity;
+
+			imageViewInfo.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+			imageViewInfo.subresourceRange.baseMipLevel = 0;
+			imageViewInfo.subresourceRange.levelCount = 1;
+			imageViewInfo.subresourceRange.baseArrayLayer = 0;
+			imageViewInfo.subresourceRange.layerCount = 1;
+
+			vk::ImageView imageView = logicalDevice.createImageView(imageViewInfo);
+			swapchainImageViews[i] = imageView;
+		}
+	};
+	createImageViews();
+
+	ShaderLibrary shaderLibrary(logicalDevice, "shaders");
+
+	// Binding 0 is the quad's vertices, binding 1 steps once per instance
+	vk::VertexInputBindingDescription vertexBindings[] = {
+		vk::VertexInputBindingDescription(0, sizeof(Vertex), vk::VertexInputRate::eVertex),
+		vk::VertexInputBindingDescription(1, sizeof(QuadInstance), vk::VertexInputRate::eInstance),
+	};
+
+	vk::VertexInputAttributeDescription vertexAttributes[] = {
+		vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat, offsetof(Vertex, position)),
+		vk::VertexInputAttributeDescription(1, 0, vk::Format::eR32G32B32Sfloat, offsetof(Vertex, color)),
+		vk::VertexInputAttributeDescription(2, 1, vk::Format::eR32G32B32A32Sfloat, offsetof(QuadInstance, transform)),
+		vk::VertexInputAttributeDescription(3, 1, vk::Format::eR32G32B32A32Sfloat, offsetof(QuadInstance, color)),
+	};
+
+	// The view: xy center, z zoom. The cull pass takes it as push constants, the quad shaders as
+	// a matrix in the frame uniforms.
+	const float camera[4] = { 0.0f, 0.0f, zoom, 0.0f };
+
+	FrameUniforms frameUniforms;
+	frameUniforms.viewProjection = glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(zoom, zoom, 1.0f)), glm::vec3(-camera[0], -camera[1], 0.0f));
+
+	// Bindless drawing pushes the heap index of the instance buffer per draw
+	vk::PushConstantRange drawRange = vk::PushConstantRange()
+		.setStageFlags(vk::ShaderStageFlagBits::eVertex)
+		.setOffset(0)
+		.setSize(sizeof(uint32_t));
+
+	vk::DescriptorSetLayout setLayouts[] = { uniforms.layout(), bindlessHeap ? bindlessHeap->layout() : vk::DescriptorSetLayout() };
 
 	vk::PipelineLayoutCreateInfo pipelineLayoutInfo = vk::PipelineLayoutCreateInfo()
-		.setSetLayoutCount(0)
-		.setPSetLayouts(nullptr)
-		.setPushConstantRangeCount(0)
-		.setPPushConstantRanges(nullptr);
+		.setSetLayoutCount(bindlessHeap ? 2 : 1)
+		.setPSetLayouts(setLayouts)
+		.setPushConstantRangeCount(bindlessHeap ? 1 : 0)
+		.setPPushConstantRanges(bindlessHeap ? &drawRange : nullptr);
 
 	vk::PipelineLayout pipelineLayout = logicalDevice.createPipelineLayout(pipelineLayoutInfo);
 
+	// Frames are rendered through the render graph, which makes its own render passes. This one only
+	// describes the attachments to the pipeline, which works with any compatible render pass.
 	vk::AttachmentDescription colorAttachment = vk::AttachmentDescription()
 		.setFormat(chosenSurfaceFormat.format)
 		.setSamples(vk::SampleCountFlagBits::e1)
@@ -398,7 +897,7 @@ int main()
 		.setStencilLoadOp(vk::AttachmentLoadOp::eDontCare)
 		.setStencilStoreOp(vk::AttachmentStoreOp::eDontCare)
 		.setInitialLayout(vk::ImageLayout::eUndefined)
-		.setFinalLayout(vk::ImageLayout::ePresentSrcKHR);
+		.setFinalLayout(headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR);
 
 	vk::AttachmentReference colorAttachmentReference = vk::AttachmentReference()
 		.setAttachment(0)
@@ -427,94 +926,651 @@ int main()
 
 	vk::RenderPass renderPass = logicalDevice.createRenderPass(renderPassInfo);
 
-	vk::GraphicsPipelineCreateInfo graphicsPipelineInfo = vk::GraphicsPipelineCreateInfo()
-		.setStageCount(2)
-		.setPStages(shaderStages)
-		.setPVertexInputState(&vertexInputInfo)
-		.setPInputAssemblyState(&inputAssemblyInfo)
-		.setPViewportState(&viewportInfo)
-		.setPRasterizationState(&rasterizerInfo)
-		.setPMultisampleState(&multisamplingInfo)
-		.setPDepthStencilState(nullptr)
-		.setPColorBlendState(&colorBlendInfo)
-		.setPDynamicState(nullptr)
-		.setLayout(pipelineLayout)
-		.setRenderPass(renderPass)
-		.setSubpass(0)
-		.setBasePipelineHandle(VK_NULL_HANDLE)
-		.setBasePipelineIndex(-1);
-
-	vk::Pipeline graphicsPipeline = logicalDevice.createGraphicsPipeline(VK_NULL_HANDLE, graphicsPipelineInfo);
-
-	std::vector<vk::Framebuffer> swapchainFramebuffers(swapchainImageViews.size());
-	for (size_t i = 0; i < swapchainImages.size(); ++i) 
-	{
-		vk::ImageView attachments[] = { swapchainImageViews[i] };
-
-		vk::FramebufferCreateInfo framebufferInfo = vk::FramebufferCreateInfo()
-			.setRenderPass(renderPass)
-			.setAttachmentCount(1)
-			.setPAttachments(attachments)
-			.setWidth(extent.width)
-			.setHeight(extent.height)
-			.setLayers(1);
-
-		vk::Framebuffer framebuffer = logicalDevice.createFramebuffer(framebufferInfo);
-		swapchainFramebuffers[i] = framebuffer;
+	std::vector<uint32_t> instanceCounts;
+	if (sweepInstances)
+	{
+		for (uint32_t count = 1; count <= 1024 * 1024; count *= 4)
+		{
+			instanceCounts.push_back(count);
+		}
+	}
+	else
+	{
+		instanceCounts.push_back(particleCount > 0 ? particleCount : instanceCount);
+	}
+
+	GraphicsPipelineShared pipelineShared;
+	pipelineShared.vertexBindings.assign(std::begin(vertexBindings), std::end(vertexBindings));
+	pipelineShared.vertexAttributes.assign(std::begin(vertexAttributes), std::end(vertexAttributes));
+	if (bindlessHeap)
+	{
+		// The bindless vertex shader reads instances from the heap, only the quad comes from a vertex buffer
+		pipelineShared.vertexBindings.resize(1);
+		pipelineShared.vertexAttributes.resize(2);
+	}
+	pipelineShared.layout = pipelineLayout;
+	pipelineShared.renderPass = renderPass;
+
+	// The grid never rotates its quads, so it can drop the rotation from the vertex shader. Until that
+	// variant has compiled in the background, the generic one draws exactly the same thing.
+	PipelineKey drawKey;
+	drawKey.blend = blendMode;
+	if (particleCount == 0)
+	{
+		drawKey.specialize(instanceRotationConstant, VK_FALSE);
 	}
 
+	// The rest of startup is mostly disk reads and pipeline compiles that don't depend on each
+	// other, so it runs as a graph of jobs. The compute job is the only one that submits to a
+	// queue; the uploads wait until the graph is done.
+	JobSystem jobs(jobThreads);
+	jobs.setTracing(!jobTracePath.empty());
+
+	std::unique_ptr<PipelineCache> pipelineCacheOwner;
+	std::unique_ptr<PipelineRegistry> pipelinesOwner;
+	vk::Pipeline graphicsPipeline;
+	vk::ShaderModule particleShader;
+	vk::ShaderModule cullShader;
+	std::unique_ptr<ParticleSystem> particles;
+	std::unique_ptr<GpuCulling> culling;
+	std::vector<QuadInstance> firstInstances;
+
+	JobGraph startup;
+	JobGraph::Job loadShaders = startup.add("shader modules", [&]
+	{
+		// The library isn't thread safe, so every module comes from this one job
+		pipelineShared.vertexShader = shaderLibrary.module(bindlessHeap ? "bindless.spv" : "vert.spv");
+		pipelineShared.fragmentShader = shaderLibrary.module("frag.spv");
+		if (particleCount > 0)
+		{
+			particleShader = shaderLibrary.module("particles.spv");
+		}
+		if (gpuCulling)
+		{
+			cullShader = shaderLibrary.module("cull.spv");
+		}
+	});
+	JobGraph::Job loadPipelineCache = startup.add("pipeline cache", [&]
+	{
+		pipelineCacheOwner.reset(new PipelineCache(logicalDevice, physicalDevice, "pipeline_cache.bin"));
+	});
+	JobGraph::Job quadPipeline = startup.add("quad pipeline", [&]
+	{
+		pipelinesOwner.reset(new PipelineRegistry(logicalDevice, *pipelineCacheOwner, pipelineShared, (std::max)(1u, std::thread::hardware_concurrency() / 2)));
+		graphicsPipeline = pipelinesOwner->get(drawKey);
+	});
+	JobGraph::Job computePipelines = startup.add("compute pipelines", [&]
+	{
+		if (particleCount > 0)
+		{
+			particles.reset(new ParticleSystem(physicalDevice, logicalDevice, allocator, *pipelineCacheOwner, descriptorLayouts, descriptors, queueFamilies, computeQueue, particleShader, particleCount, framesInFlight));
+		}
+		if (gpuCulling)
+		{
+			culling.reset(new GpuCulling(logicalDevice, allocator, *pipelineCacheOwner, descriptorLayouts, cullShader, instanceCounts.back(), 6));
+		}
+	});
+	startup.add("instance grid", [&]
+	{
+		firstInstances = makeQuadGrid(instanceCounts.front());
+	});
+	startup.precede(loadShaders, quadPipeline);
+	startup.precede(loadPipelineCache, quadPipeline);
+	startup.precede(loadShaders, computePipelines);
+	startup.precede(loadPipelineCache, computePipelines);
+
+	auto startupStart = std::chrono::high_resolution_clock::now();
+	jobs.run(startup);
+	std::cout << "startup jobs took " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupStart).count()
+		<< "ms on " << jobs.threadCount() << " threads" << std::endl;
+
+	PipelineCache& pipelineCache = *pipelineCacheOwner;
+	PipelineRegistry& pipelines = *pipelinesOwner;
+
+	pipelineCache.logStats();
+
 	vk::CommandPoolCreateInfo commandPoolInfo = vk::CommandPoolCreateInfo()
-		.setQueueFamilyIndex(0);
+		.setQueueFamilyIndex(queueFamilies.graphics);
 
 	vk::CommandPool commandPool = logicalDevice.createCommandPool(commandPoolInfo);
 
 	vk::CommandBufferAllocateInfo allocateInfo = vk::CommandBufferAllocateInfo()
 		.setCommandPool(commandPool)
 		.setLevel(vk::CommandBufferLevel::ePrimary)
-		.setCommandBufferCount((uint32_t)swapchainFramebuffers.size());
+		.setCommandBufferCount((uint32_t)swapchainImages.size());
 
 	std::vector<vk::CommandBuffer> commandBuffers = logicalDevice.allocateCommandBuffers(allocateInfo);
 
-	for (size_t i = 0; i < commandBuffers.size(); ++i)
-	{
-		vk::CommandBufferBeginInfo beginInfo = vk::CommandBufferBeginInfo()
-			.setFlags(vk::CommandBufferUsageFlagBits::eSimultaneousUse)
-			.setPInheritanceInfo(nullptr);
-
-		commandBuffers[i].begin(beginInfo);
+	const Vertex quadVertices[] = {
+		{ { -0.5f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+		{ { 0.5f, -0.5f }, { 0.0f, 1.0f, 0.0f } },
+		{ { 0.5f, 0.5f }, { 0.0f, 0.0f, 1.0f } },
+		{ { -0.5f, 0.5f }, { 1.0f, 1.0f, 1.0f } },
+	};
+	const uint16_t quadIndices[] = { 0, 1, 2, 2, 3, 0 };
 
-		vk::ClearValue cv = vk::ClearValue();
-		cv.color.setFloat32({ 0.0f, 0.0f, 0.0f, 1.0f });
+	Allocation* vertexBuffer = allocator.createBuffer(sizeof(quadVertices), vk::BufferUsageFlagBits::eVertexBuffer, MemoryUsage::GpuOnly);
+	Allocation* indexBuffer = allocator.createBuffer(sizeof(quadIndices), vk::BufferUsageFlagBits::eIndexBuffer, MemoryUsage::GpuOnly);
+	uploads.uploadBuffer(vertexBuffer->buffer, 0, quadVertices, sizeof(quadVertices));
+	uploads.uploadBuffer(indexBuffer->buffer, 0, quadIndices, sizeof(quadIndices));
 
-		vk::RenderPassBeginInfo renderPassInfo = vk::RenderPassBeginInfo()
-			.setRenderPass(renderPass)
-			.setFramebuffer(swapchainFramebuffers[i])
-			.setClearValueCount(1)
-			.setPClearValues(&cv);
+	// Sized for the biggest count we will draw; each sweep step re-uploads a new grid into it
+	Allocation* instanceBuffer = allocator.createBuffer(instanceCounts.back() * sizeof(QuadInstance), vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eStorageBuffer, MemoryUsage::GpuOnly);
+	size_t sweepStep = 0;
 
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = extent;
+	auto uploadInstances = [&](const std::vector<QuadInstance>& instances)
+	{
+		uploads.wait(uploads.uploadBuffer(instanceBuffer->buffer, 0, instances.data(), instances.size() * sizeof(QuadInstance)));
+	};
+	uploadInstances(firstInstances);
+	firstInstances.clear();
+
+	// With particles the instances come from the compute queue's output, which changes every frame
+	vk::Buffer drawInstanceBuffer = instanceBuffer->buffer;
+
+	// The buffers that may leave device memory when it runs short. With particles the grid's
+	// instances are never drawn, so they are the first to go.
+	ResidencyManager residency(logicalDevice, allocator, queue, queueFamilies.graphics, framesInFlight);
+	ResidencyManager::Handle residentVertices = residency.track(vertexBuffer, "quad vertices");
+	ResidencyManager::Handle residentIndices = residency.track(indexBuffer, "quad indices");
+	ResidencyManager::Handle residentInstances = residency.track(instanceBuffer, "instances");
+
+	// Two timestamps per command buffer, bracketing the render pass
+	bool gpuTimestamps = physicalDevice.getQueueFamilyProperties()[queueFamilies.graphics].timestampValidBits > 0;
+	double timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+
+	vk::QueryPool timestampQueryPool;
+	if (gpuTimestamps)
+	{
+		vk::QueryPoolCreateInfo queryPoolInfo = vk::QueryPoolCreateInfo()
+			.setQueryType(vk::QueryType::eTimestamp)
+			.setQueryCount(maxSwapchainImages * 2);
 
-		commandBuffers[i].beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
-		commandBuffers[i].bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
-		commandBuffers[i].draw(4, 1, 0, 0);
-		commandBuffers[i].endRenderPass();
-		commandBuffers[i].end();
+		timestampQueryPool = logicalDevice.createQueryPool(queryPoolInfo);
+	}
+	else
+	{
+		std::cout << "graphics queue family does not support timestamps, GPU timing disabled" << std::endl;
 	}
 
+	std::vector<DrawItem> drawList;
+	auto buildDrawList = [&](uint32_t count)
+	{
+		uint32_t draws = (std::min)(drawCount, count);
+		drawList.resize(draws);
+		for (uint32_t d = 0; d < draws; ++d)
+		{
+			drawList[d].firstInstance = static_cast<uint32_t>(uint64_t(count) * d / draws);
+			drawList[d].instanceCount = static_cast<uint32_t>(uint64_t(count) * (d + 1) / draws) - drawList[d].firstInstance;
+		}
+	};
+	buildDrawList(instanceCounts[sweepStep]);
+
+	// Heap index of the instance buffer being drawn. Resolved on the main thread before recording,
+	// since adding a buffer to the heap isn't thread safe.
+	uint32_t bindlessInstances = 0;
+
+	// Dynamic offset of this recording's frame uniforms. Pre-recorded command buffers are replayed
+	// on any frame, so they read a copy that is written once and never rewound.
+	uint32_t frameUniformOffset = 0;
+	const uint32_t staticFrameUniforms = uniforms.pushPersistent(frameUniforms);
+
+	// What the draws cover: the whole target, or less of it under dynamic resolution
+	vk::Extent2D renderExtent = extent;
+
+	auto recordDraws = [&](vk::CommandBuffer commandBuffer, size_t begin, size_t end)
+	{
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+
+		// Dynamic state isn't inherited by secondary command buffers, so every slice sets its own
+		commandBuffer.setViewport(0, vk::Viewport(0.0f, 0.0f, static_cast<float>(renderExtent.width), static_cast<float>(renderExtent.height), 0.0f, 1.0f));
+		commandBuffer.setScissor(0, vk::Rect2D(vk::Offset2D(0, 0), renderExtent));
+
+		vk::DescriptorSet sets[] = { uniforms.set(), bindlessHeap ? bindlessHeap->set() : vk::DescriptorSet() };
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, bindlessHeap ? 2 : 1, sets, 1, &frameUniformOffset);
+
+		if (bindlessHeap)
+		{
+			commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(bindlessInstances), &bindlessInstances);
+		}
+
+		vk::Buffer vertexBuffers[] = { vertexBuffer->buffer, culling ? culling->visibleBuffer() : drawInstanceBuffer };
+		vk::DeviceSize vertexOffsets[] = { 0, 0 };
+		commandBuffer.bindVertexBuffers(0, bindlessHeap ? 1 : 2, vertexBuffers, vertexOffsets);
+		commandBuffer.bindIndexBuffer(indexBuffer->buffer, 0, vk::IndexType::eUint16);
+
+		if (culling)
+		{
+			// The cull pass filled in the instance count
+			commandBuffer.drawIndexedIndirect(culling->indirectBuffer(), 0, 1, sizeof(vk::DrawIndexedIndirectCommand));
+			return;
+		}
+
+		for (size_t d = begin; d < end; ++d)
+		{
+			commandBuffer.drawIndexed(6, drawList[d].instanceCount, 0, 0, drawList[d].firstInstance);
+		}
+	};
+
+	// With GPU culling there is a single indirect draw, however the draw list was split
+	auto drawItemCount = [&]() -> size_t
+	{
+		return culling ? 1 : drawList.size();
+	};
+
+	std::unique_ptr<ParallelRecorder> recorder;
+	if (recordThreads > 0)
+	{
+		recorder.reset(new ParallelRecorder(jobs, logicalDevice, queueFamilies.graphics, recordThreads, framesInFlight));
+	}
+
+	// The scene is rendered into a full-size offscreen image, but only into its top-left
+	// renderExtent, which a blit then stretches over the frame. There is one scene image for
+	// all frames in flight: the graph makes each frame's clear wait for the previous frame's
+	// blit out of it, which costs less than an image per frame.
+	std::unique_ptr<DynamicResolution> resolution;
+	vk::Filter upscaleFilter = vk::Filter::eLinear;
+	if (resolutionTargetMs > 0.0 && !gpuTimestamps)
+	{
+		std::cout << "Dynamic resolution needs GPU timestamps, disabled" << std::endl;
+	}
+	else if (resolutionTargetMs > 0.0)
+	{
+		vk::FormatFeatureFlags features = physicalDevice.getFormatProperties(chosenSurfaceFormat.format).optimalTilingFeatures;
+		vk::FormatFeatureFlags blit = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst;
+		if ((features & blit) == blit)
+		{
+			upscaleFilter = features & vk::FormatFeatureFlagBits::eSampledImageFilterLinear ? vk::Filter::eLinear : vk::Filter::eNearest;
+			resolution.reset(new DynamicResolution(resolutionTargetMs, minResolutionScale));
+		}
+		else
+		{
+			std::cout << "Can't blit " << vk::to_string(chosenSurfaceFormat.format) << " images, dynamic resolution disabled" << std::endl;
+		}
+	}
+
+	std::unique_ptr<FrameCapture> capture;
+	if (!capturePath.empty())
+	{
+		if (FrameCapture::supportsFormat(chosenSurfaceFormat.format))
+		{
+			// A slot per frame in flight, plus room for the encoder to fall a little behind
+			uint32_t slots = captureRing ? captureRing : framesInFlight + 2;
+			capture.reset(new FrameCapture(logicalDevice, allocator, chosenSurfaceFormat.format, extent, slots, capturePath, captureFormat));
+		}
+		else
+		{
+			std::cout << "Can't capture " << vk::to_string(chosenSurfaceFormat.format) << " images, capture disabled" << std::endl;
+		}
+	}
+
+	// Particles swap instance buffers every frame, so they can't use the pre-recorded command buffers
+	// either. Each captured frame copies into a different slot, and the resolution may change any frame.
+	bool recordEveryFrame = recorder || particles || capture || resolution;
+
+	// Sets recorded into a frame's command buffer come from that frame's allocator, which is reset in
+	// bulk once the frame's fence has signaled. Pre-recorded command buffers get an allocator of their
+	// own, retired along with them.
+	std::vector<DescriptorAllocator> frameDescriptors(framesInFlight, DescriptorAllocator(logicalDevice));
+	std::shared_ptr<DescriptorAllocator> staticDescriptors = std::make_shared<DescriptorAllocator>(logicalDevice);
+
+	// The frame as a render graph: the optional cull pass, then the quads into the target image
+	// (or the scaled scene image, blitted into the target after). Rebuilt along with the
+	// swapchain, since the target's extent is baked into it.
+	std::shared_ptr<RenderGraph> frameGraph;
+	RenderResource frameTarget = 0;
+	uint32_t recordingFrameIndex = 0;
+	int32_t captureSlot = -1;
+	auto buildFrameGraph = [&]()
+	{
+		frameGraph = std::make_shared<RenderGraph>(logicalDevice, allocator);
+
+		// Swapchain images are only ours once the acquire semaphore wait at color attachment output
+		// is done. Headless targets may still be being copied out by an earlier frame.
+		vk::PipelineStageFlags targetReady = headless
+			? vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eTransfer
+			: vk::PipelineStageFlagBits::eColorAttachmentOutput;
+
+		frameTarget = frameGraph->importImage("target", chosenSurfaceFormat.format, extent, vk::ImageLayout::eUndefined,
+			headless ? vk::ImageLayout::eTransferSrcOptimal : vk::ImageLayout::ePresentSrcKHR, targetReady);
+
+		RenderResource sceneTarget = frameTarget;
+		if (resolution)
+		{
+			TransientImageDesc sceneDesc;
+			sceneDesc.format = chosenSurfaceFormat.format;
+			sceneDesc.extent = extent;
+			sceneDesc.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+			sceneTarget = frameGraph->createImage("scene", sceneDesc);
+		}
+
+		// Uploaded, or written by the particle simulation, before the frame starts
+		RenderResource instances = frameGraph->importBuffer("instances");
+
+		// With bindless descriptors the vertex shader fetches instances itself rather than
+		// through a vertex buffer binding
+		ResourceUsage instanceRead = bindlessHeap ? ResourceUsage::VertexStorageRead : ResourceUsage::VertexBuffer;
+
+		RenderResource visible = 0;
+		RenderResource indirect = 0;
+		if (culling)
+		{
+			// The previous frame drew from these, so the cull has to wait for that draw
+			visible = frameGraph->importBuffer("visible instances", instanceRead);
+			indirect = frameGraph->importBuffer("indirect draw", ResourceUsage::IndirectBuffer);
+
+			frameGraph->addComputePass("cull", [&](vk::CommandBuffer commandBuffer, const RenderPassContext&)
+			{
+				DescriptorAllocator& passDescriptors = recordEveryFrame ? frameDescriptors[recordingFrameIndex] : *staticDescriptors;
+				culling->record(commandBuffer, passDescriptors, drawInstanceBuffer, instanceCounts[sweepStep], camera);
+			})
+				.read(instances, ResourceUsage::StorageRead)
+				.write(visible, ResourceUsage::StorageWrite)
+				.write(indirect, ResourceUsage::TransferDestination)
+				.write(indirect, ResourceUsage::StorageWrite);
+		}
+
+		RenderGraphPass& mainPass = frameGraph->addGraphicsPass("quads", [&](vk::CommandBuffer commandBuffer, const RenderPassContext& context)
+		{
+			if (recorder)
+			{
+				vk::CommandBufferInheritanceInfo inheritanceInfo = vk::CommandBufferInheritanceInfo()
+					.setRenderPass(context.renderPass)
+					.setSubpass(0)
+					.setFramebuffer(context.framebuffer);
+
+				commandBuffer.executeCommands(recorder->record(recordingFrameIndex, inheritanceInfo, drawItemCount(), recordDraws));
+			}
+			else
+			{
+				recordDraws(commandBuffer, 0, drawItemCount());
+			}
+		});
+
+		vk::ClearValue clearColor;
+		clearColor.color.setFloat32({ 0.0f, 0.0f, 0.0f, 1.0f });
+		mainPass.clear(sceneTarget, ResourceUsage::ColorAttachment, clearColor);
+
+		if (culling)
+		{
+			mainPass
+				.read(visible, instanceRead)
+				.read(indirect, ResourceUsage::IndirectBuffer);
+		}
+		else
+		{
+			mainPass.read(instances, instanceRead);
+		}
+
+		if (recorder)
+		{
+			mainPass.secondaryCommandBuffers();
+		}
+
+		if (resolution)
+		{
+			frameGraph->addComputePass("upscale", [&, sceneTarget](vk::CommandBuffer commandBuffer, const RenderPassContext&)
+			{
+				vk::ImageSubresourceLayers layers(vk::ImageAspectFlagBits::eColor, 0, 0, 1);
+				vk::ImageBlit region = vk::ImageBlit()
+					.setSrcSubresource(layers)
+					.setDstSubresource(layers);
+				region.srcOffsets[1] = vk::Offset3D(static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1);
+				region.dstOffsets[1] = vk::Offset3D(static_cast<int32_t>(extent.width), static_cast<int32_t>(extent.height), 1);
+
+				commandBuffer.blitImage(frameGraph->image(sceneTarget), vk::ImageLayout::eTransferSrcOptimal,
+					frameGraph->image(frameTarget), vk::ImageLayout::eTransferDstOptimal, region, upscaleFilter);
+			})
+				.read(sceneTarget, ResourceUsage::TransferSource)
+				.write(frameTarget, ResourceUsage::TransferDestination);
+		}
+
+		if (capture)
+		{
+			frameGraph->addComputePass("capture", [&](vk::CommandBuffer commandBuffer, const RenderPassContext&)
+			{
+				if (captureSlot >= 0)
+				{
+					capture->record(commandBuffer, frameGraph->image(frameTarget), captureSlot);
+				}
+			})
+				.read(frameTarget, ResourceUsage::TransferSource)
+				.sideEffect();
+		}
+
+		frameGraph->compile();
+	};
+	buildFrameGraph();
+
+	auto recordFrame = [&](vk::CommandBuffer commandBuffer, uint32_t image, vk::CommandBufferUsageFlags usage, uint32_t frameIndex)
+	{
+		vk::CommandBufferBeginInfo beginInfo = vk::CommandBufferBeginInfo()
+			.setFlags(usage)
+			.setPInheritanceInfo(nullptr);
+
+		commandBuffer.begin(beginInfo);
 
-	vk::SemaphoreCreateInfo semaphoreInfo = vk::SemaphoreCreateInfo();
-	vk::Semaphore imageAvailable = logicalDevice.createSemaphore(semaphoreInfo);
-	vk::Semaphore renderFinished = logicalDevice.createSemaphore(semaphoreInfo);
-
+		uint32_t firstQuery = image * 2;
+		if (gpuTimestamps)
+		{
+			commandBuffer.resetQueryPool(timestampQueryPool, firstQuery, 2);
+			commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestampQueryPool, firstQuery);
+		}
+
+		recordingFrameIndex = frameIndex;
+		frameUniformOffset = recordEveryFrame ? uniforms.push(frameUniforms) : staticFrameUniforms;
+		if (bindlessHeap)
+		{
+			bindlessInstances = bindlessHeap->buffer(culling ? culling->visibleBuffer() : drawInstanceBuffer);
+		}
+		renderExtent = resolution ? resolution->scaledExtent(extent) : extent;
+		frameGraph->setRenderArea(renderExtent);
+		frameGraph->bindImage(frameTarget, swapchainImages[image], swapchainImageViews[image]);
+		frameGraph->execute(commandBuffer);
+
+		if (gpuTimestamps)
+		{
+			commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestampQueryPool, firstQuery + 1);
+		}
+
+		commandBuffer.end();
+	};
+
+	// The pre-recorded path: one command buffer per swapchain image, reused every frame
+	auto recordCommandBuffers = [&]()
+	{
+		if (recordEveryFrame)
+		{
+			return;
+		}
+
+		for (size_t i = 0; i < commandBuffers.size(); ++i)
+		{
+			recordFrame(commandBuffers[i], static_cast<uint32_t>(i), vk::CommandBufferUsageFlagBits::eSimultaneousUse, 0);
+		}
+	};
+	recordCommandBuffers();
 
 
+	vk::SemaphoreCreateInfo semaphoreInfo = vk::SemaphoreCreateInfo();
+
+	// Fences start signaled so the first wait on each frame returns immediately
+	vk::FenceCreateInfo fenceInfo = vk::FenceCreateInfo()
+		.setFlags(vk::FenceCreateFlagBits::eSignaled);
+
+	std::vector<FrameContext> frames(framesInFlight);
+	for (auto& frame : frames)
+	{
+		frame.inFlight = logicalDevice.createFence(fenceInfo);
+		frame.imageAvailable = logicalDevice.createSemaphore(semaphoreInfo);
+		frame.renderFinished = logicalDevice.createSemaphore(semaphoreInfo);
+
+		if (recordEveryFrame)
+		{
+			vk::CommandPoolCreateInfo framePoolInfo = vk::CommandPoolCreateInfo()
+				.setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+				.setQueueFamilyIndex(queueFamilies.graphics);
+
+			frame.commandPool = logicalDevice.createCommandPool(framePoolInfo);
+
+			vk::CommandBufferAllocateInfo frameAllocateInfo = vk::CommandBufferAllocateInfo()
+				.setCommandPool(frame.commandPool)
+				.setLevel(vk::CommandBufferLevel::ePrimary)
+				.setCommandBufferCount(1);
+
+			frame.commandBuffer = logicalDevice.allocateCommandBuffers(frameAllocateInfo)[0];
+		}
+	}
+
+	// The fence of the frame that last rendered to each swapchain image, so we never
+	// submit to an image that a previous frame is still using.
+	std::vector<vk::Fence> imagesInFlight(swapchainImages.size(), vk::Fence());
+	size_t currentFrame = 0;
+
+
+	FrameProfiler profiler(1000, !tracePath.empty());
+
+	// Low latency paces the CPU to the display so we don't render frames mailbox would throw
+	// away, or queue them up behind a blocking FIFO present. Headless runs are never paced.
+	FramePacer pacer;
+	if (!headless)
+	{
+		if (targetFps < 0.0 && presentPolicy == PresentPolicy::LowLatency)
+		{
+			SDL_DisplayMode displayMode;
+			bool knownRate = SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &displayMode) == 0 && displayMode.refresh_rate > 0;
+			targetFps = knownRate ? displayMode.refresh_rate : 60.0;
+		}
+		pacer.setTargetFps((std::max)(0.0, targetFps));
+	}
+
+	// Which frame last submitted each image's command buffer, so its timestamps can be read
+	// back before the command buffer is submitted again (and overwrites them).
+	std::vector<int64_t> pendingTimestampFrame(maxSwapchainImages, -1);
+	auto collectGpuTime = [&](uint32_t image)
+	{
+		if (!gpuTimestamps || pendingTimestampFrame[image] < 0)
+		{
+			return;
+		}
+
+		uint64_t timestamps[2];
+		vk::Result queryResult = logicalDevice.getQueryPoolResults(timestampQueryPool, image * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+		if (queryResult == vk::Result::eSuccess)
+		{
+			double gpuMs = (timestamps[1] - timestamps[0]) * timestampPeriod / 1e6;
+			profiler.setGpuTime(static_cast<uint64_t>(pendingTimestampFrame[image]), gpuMs);
+			if (resolution)
+			{
+				resolution->addSample(static_cast<uint64_t>(pendingTimestampFrame[image]), gpuMs);
+			}
+			if (particles)
+			{
+				particles->noteGraphicsInterval(static_cast<uint64_t>(pendingTimestampFrame[image]), timestamps[0], timestamps[1]);
+			}
+		}
+		pendingTimestampFrame[image] = -1;
+	};
+
+	uint64_t frameNumber = 0;
+	auto renderStart = std::chrono::high_resolution_clock::now();
+	auto lastStatsTime = renderStart;
+	auto stepStart = renderStart;
+	auto lastSimulateTime = renderStart;
+	uint32_t framesInStep = 0;
+	uint64_t stepFirstFrame = 0;
+
+	// Set when acquire or present reports the swapchain no longer matches the surface, or the window resized
+	bool swapchainDirty = false;
+	std::deque<RetiredSwapchain> retiredSwapchains;
+
+	// The pre-recorded command buffers may still be executing, so re-recording them means
+	// recording a fresh set and retiring the old one
+	auto replaceCommandBuffers = [&](RetiredSwapchain& retired)
+	{
+		if (recordEveryFrame)
+		{
+			return;
+		}
+
+		retired.commandBuffers = commandBuffers;
+		retired.descriptors = staticDescriptors;
+		staticDescriptors = std::make_shared<DescriptorAllocator>(logicalDevice);
+
+		allocateInfo.setCommandBufferCount(static_cast<uint32_t>(swapchainImages.size()));
+		commandBuffers = logicalDevice.allocateCommandBuffers(allocateInfo);
+		recordCommandBuffers();
+	};
+
+	// Builds the new swapchain from the old one without waiting for the GPU. The old resources go
+	// on the retired list and are destroyed once every frame that might still use them has finished.
+	auto recreateSwapchain = [&]() -> bool
+	{
+		RetiredSwapchain retired;
+		retired.swapchain = swapchain;
+		retired.imageViews = swapchainImageViews;
+		retired.frameGraph = frameGraph;
+		retired.retiredAtFrame = frameNumber;
+
+		if (!createSwapchain(swapchain))
+		{
+			return false;
+		}
+
+		createImageViews();
+		buildFrameGraph();
+
+		replaceCommandBuffers(retired);
+		retiredSwapchains.push_back(retired);
+
+		// The old images' bookkeeping means nothing for the new ones
+		imagesInFlight.assign(swapchainImages.size(), vk::Fence());
+		pendingTimestampFrame.assign(maxSwapchainImages, -1);
+
+		swapchainDirty = false;
+		return true;
+	};
+
+	auto destroyRetiredSwapchain = [&](const RetiredSwapchain& retired)
+	{
+		if (retired.frameGraph)
+		{
+			retired.frameGraph->destroy();
+		}
+		for (const auto& imageView : retired.imageViews)
+		{
+			logicalDevice.destroyImageView(imageView);
+		}
+		if (!retired.commandBuffers.empty())
+		{
+			logicalDevice.freeCommandBuffers(commandPool, retired.commandBuffers);
+		}
+		if (retired.descriptors)
+		{
+			retired.descriptors->destroy();
+		}
+		if (retired.swapchain)
+		{
+			logicalDevice.destroySwapchainKHR(retired.swapchain);
+		}
+	};
+
 	// Poll for user input.
 	bool stillRunning = true;
 	while (stillRunning) 
 	{
+		pacer.wait();
+
+		if (!headless && presentPolicy == PresentPolicy::LowLatency)
+		{
+			// Don't sample input for a frame until the previous one is off the GPU; anything
+			// queued behind it would only add to input-to-photon latency
+			const FrameContext& previous = frames[(currentFrame + frames.size() - 1) % frames.size()];
+			logicalDevice.waitForFences(previous.inFlight, VK_TRUE, (std::numeric_limits<uint64_t>::max)());
+		}
+
 		SDL_Event event;
-		while (SDL_PollEvent(&event)) 
+		while (!headless && SDL_PollEvent(&event)) 
 		{
 
 			switch (event.type) 
@@ -524,6 +1580,13 @@ int main()
 				stillRunning = false;
 				break;
 
+			case SDL_WINDOWEVENT:
+				if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+				{
+					swapchainDirty = true;
+				}
+				break;
+
 			default:
 				// Do nothing.
 				break;
@@ -532,75 +1595,485 @@ int main()
 
 		// draw
 
+		if (!headless && swapchainDirty && !recreateSwapchain())
+		{
+			// Minimized, there is nothing to render into until the window comes back
+			SDL_Delay(16);
+			continue;
+		}
+
+		FrameRecord& record = profiler.beginFrame(frameNumber);
+
+		uploads.poll();
+
+		FrameContext& frame = frames[currentFrame];
+		logicalDevice.waitForFences(frame.inFlight, VK_TRUE, (std::numeric_limits<uint64_t>::max)());
+		frameDescriptors[currentFrame].reset();
+		uniforms.beginFrame(static_cast<uint32_t>(currentFrame));
+		if (bindlessHeap)
+		{
+			bindlessHeap->beginFrame(frameNumber);
+		}
+		if (capture && frame.submittedFrame >= 0)
+		{
+			capture->complete(static_cast<uint64_t>(frame.submittedFrame));
+		}
+
+		while (!retiredSwapchains.empty() && frameNumber >= retiredSwapchains.front().retiredAtFrame + frames.size())
+		{
+			destroyRetiredSwapchain(retiredSwapchains.front());
+			retiredSwapchains.pop_front();
+		}
+
+		vk::Pipeline drawPipeline = pipelines.get(drawKey);
+		if (drawPipeline != graphicsPipeline)
+		{
+			// The specialized variant has finished compiling
+			graphicsPipeline = drawPipeline;
+
+			if (!recordEveryFrame)
+			{
+				RetiredSwapchain retired;
+				retired.retiredAtFrame = frameNumber;
+				replaceCommandBuffers(retired);
+				retiredSwapchains.push_back(retired);
+			}
+		}
+
+		residency.touch(residentVertices, frameNumber);
+		residency.touch(residentIndices, frameNumber);
+		if (!particles)
+		{
+			residency.touch(residentInstances, frameNumber);
+		}
+		if (residency.update(frameNumber))
+		{
+			// Buffers moved between heaps, so anything recorded against the old ones is stale
+			if (!particles && drawInstanceBuffer != instanceBuffer->buffer)
+			{
+				// Recording looks the new buffer up in the heap again
+				if (bindlessHeap)
+				{
+					bindlessHeap->remove(drawInstanceBuffer, frameNumber);
+				}
+				drawInstanceBuffer = instanceBuffer->buffer;
+			}
+
+			if (!recordEveryFrame)
+			{
+				RetiredSwapchain retired;
+				retired.retiredAtFrame = frameNumber;
+				replaceCommandBuffers(retired);
+				retiredSwapchains.push_back(retired);
+			}
+		}
+
 		uint32_t imageIndex;
-		logicalDevice.acquireNextImageKHR(swapchain, (std::numeric_limits<uint64_t>::max)(), imageAvailable, VK_NULL_HANDLE, &imageIndex);
+		if (headless)
+		{
+			// Nothing to acquire, just cycle through our own targets
+			imageIndex = static_cast<uint32_t>(frameNumber % swapchainImages.size());
+		}
+		else
+		{
+			auto acquireStart = FrameProfiler::Clock::now();
+			vk::Result acquireResult = logicalDevice.acquireNextImageKHR(swapchain, (std::numeric_limits<uint64_t>::max)(), frame.imageAvailable, VK_NULL_HANDLE, &imageIndex);
+			record.acquireMs = FrameProfiler::millisecondsSince(acquireStart);
 
-		vk::Semaphore waitSemaphores[] = { imageAvailable };
-		vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
-		vk::Semaphore signalSemaphores[] = { renderFinished };
+			if (acquireResult == vk::Result::eErrorOutOfDateKHR)
+			{
+				// Nothing was acquired and the semaphore won't be signaled, so try again with a new swapchain
+				swapchainDirty = true;
+				continue;
+			}
+			if (acquireResult == vk::Result::eSuboptimalKHR)
+			{
+				// Still presentable, render this frame and rebuild afterwards
+				swapchainDirty = true;
+			}
+			else if (acquireResult != vk::Result::eSuccess)
+			{
+				// Device or surface lost, or out of memory: imageIndex was never written
+				throw std::runtime_error("failed to acquire swapchain image: " + vk::to_string(acquireResult));
+			}
+		}
+
+		if (imagesInFlight[imageIndex])
+		{
+			logicalDevice.waitForFences(imagesInFlight[imageIndex], VK_TRUE, (std::numeric_limits<uint64_t>::max)());
+		}
+		imagesInFlight[imageIndex] = frame.inFlight;
+
+		collectGpuTime(imageIndex);
+		pendingTimestampFrame[imageIndex] = static_cast<int64_t>(frameNumber);
+
+		vk::CommandBuffer submitCommandBuffer = commandBuffers[imageIndex];
+		if (recordEveryFrame)
+		{
+			if (particles)
+			{
+				// Headless runs step at a fixed rate so benchmarks simulate the same thing every time
+				auto now = std::chrono::high_resolution_clock::now();
+				float deltaSeconds = headless ? 1.0f / 60.0f : (std::min)(1.0f / 30.0f, std::chrono::duration<float>(now - lastSimulateTime).count());
+				lastSimulateTime = now;
+
+				drawInstanceBuffer = particles->simulate(frameNumber, static_cast<uint32_t>(currentFrame), deltaSeconds);
+			}
+
+			auto recordStart = FrameProfiler::Clock::now();
+			logicalDevice.resetCommandPool(frame.commandPool, vk::CommandPoolResetFlags());
+			captureSlot = capture ? capture->begin(frameNumber, extent) : -1;
+			if (resolution)
+			{
+				resolution->scaleFor(frameNumber);
+			}
+			recordFrame(frame.commandBuffer, imageIndex, vk::CommandBufferUsageFlagBits::eOneTimeSubmit, static_cast<uint32_t>(currentFrame));
+			record.recordMs = FrameProfiler::millisecondsSince(recordStart);
+			submitCommandBuffer = frame.commandBuffer;
+		}
+
+		std::vector<vk::Semaphore> waitSemaphores;
+		std::vector<vk::PipelineStageFlags> waitStages;
+		std::vector<vk::Semaphore> signalSemaphores;
+		if (!headless)
+		{
+			waitSemaphores.push_back(frame.imageAvailable);
+			waitStages.push_back(vk::PipelineStageFlagBits::eColorAttachmentOutput);
+			signalSemaphores.push_back(frame.renderFinished);
+		}
+		if (particles)
+		{
+			// Only vertex fetch (or the cull pass) needs the simulation, the rest of the frame can start without it
+			waitSemaphores.push_back(particles->simulated(frameNumber));
+			waitStages.push_back(culling ? vk::PipelineStageFlagBits::eComputeShader : vk::PipelineStageFlagBits::eVertexInput);
+			signalSemaphores.push_back(particles->drawn(frameNumber));
+		}
 
 		vk::SubmitInfo submitInfo = vk::SubmitInfo()
-			.setWaitSemaphoreCount(1)
-			.setPWaitSemaphores(waitSemaphores)
-			.setPWaitDstStageMask(waitStages)
+			.setWaitSemaphoreCount(static_cast<uint32_t>(waitSemaphores.size()))
+			.setPWaitSemaphores(waitSemaphores.data())
+			.setPWaitDstStageMask(waitStages.data())
 			.setCommandBufferCount(1)
-			.setPCommandBuffers(&commandBuffers[imageIndex])
-			.setSignalSemaphoreCount(1)
-			.setPSignalSemaphores(signalSemaphores);
+			.setPCommandBuffers(&submitCommandBuffer)
+			.setSignalSemaphoreCount(static_cast<uint32_t>(signalSemaphores.size()))
+			.setPSignalSemaphores(signalSemaphores.data());
+
+		logicalDevice.resetFences(frame.inFlight);
+
+		auto submitStart = FrameProfiler::Clock::now();
+		queue.submit(submitInfo, frame.inFlight);
+		frame.submittedFrame = static_cast<int64_t>(frameNumber);
+		record.submitMs = FrameProfiler::millisecondsSince(submitStart);
+
+		if (!headless)
+		{
+			vk::SwapchainKHR swapchains[] = { swapchain };
+
+			vk::PresentInfoKHR presentInfo = vk::PresentInfoKHR()
+				.setWaitSemaphoreCount(1)
+				.setPWaitSemaphores(&frame.renderFinished)
+				.setSwapchainCount(1)
+				.setPSwapchains(swapchains)
+				.setPImageIndices(&imageIndex)
+				.setPResults(nullptr);
+
+			auto presentStart = FrameProfiler::Clock::now();
+			vk::Result presentResult = presentQueue.presentKHR(&presentInfo);
+			if (presentResult == vk::Result::eErrorOutOfDateKHR || presentResult == vk::Result::eSuboptimalKHR)
+			{
+				swapchainDirty = true;
+			}
+			else if (presentResult != vk::Result::eSuccess)
+			{
+				throw std::runtime_error("failed to present swapchain image: " + vk::to_string(presentResult));
+			}
+			record.presentMs = FrameProfiler::millisecondsSince(presentStart);
+		}
+
+		profiler.endFrame();
+
+		++frameNumber;
+		currentFrame = (currentFrame + 1) % frames.size();
+
+		if ((headless || frameCountGiven) && !sweepInstances)
+		{
+			stillRunning = frameNumber < frameCount;
+		}
+
+		if (sweepInstances && ++framesInStep == frameCount)
+		{
+			logicalDevice.waitIdle();
+			for (uint32_t i = 0; i < pendingTimestampFrame.size(); ++i)
+			{
+				collectGpuTime(i);
+			}
 
-		queue.submit(submitInfo, VK_NULL_HANDLE);
+			double seconds = std::chrono::duration<double>(FrameProfiler::Clock::now() - stepStart).count();
+			// Only this step's frames; the window still holds the tail of the previous step
+			Percentiles gpu = profiler.percentiles(&FrameRecord::gpuMs, stepFirstFrame);
+			std::cout << "instances " << instanceCounts[sweepStep] << ": " << framesInStep / seconds << " fps, "
+				<< instanceCounts[sweepStep] * (framesInStep / seconds) << " instances/s, gpu p50 " << gpu.p50 << "ms" << std::endl;
 
-		vk::SwapchainKHR swapchains[] = { swapchain };
+			if (++sweepStep == instanceCounts.size())
+			{
+				stillRunning = false;
+			}
+			else
+			{
+				logicalDevice.resetCommandPool(commandPool, vk::CommandPoolResetFlags());
+				staticDescriptors->reset();
+				uploadInstances(makeQuadGrid(instanceCounts[sweepStep]));
+				buildDrawList(instanceCounts[sweepStep]);
+				recordCommandBuffers();
+				framesInStep = 0;
+				stepFirstFrame = frameNumber;
+				stepStart = FrameProfiler::Clock::now();
+			}
+		}
+
+		// Once a second, show the rolling percentiles (p50/p95/p99) in the title bar and optionally the console
+		if (std::chrono::duration<double>(FrameProfiler::Clock::now() - lastStatsTime).count() >= 1.0)
+		{
+			lastStatsTime = FrameProfiler::Clock::now();
+			std::string statsLine = profiler.summary();
+			if (resolution)
+			{
+				statsLine += ", resolution " + std::to_string(static_cast<int>(resolution->scale() * 100.0f + 0.5f)) + "%";
+			}
+
+			// The fullest device local heap, against its budget
+			std::vector<HeapBudget> budgets = allocator.heapBudgets();
+			const HeapBudget* fullest = nullptr;
+			for (uint32_t heap = 0; heap < budgets.size(); ++heap)
+			{
+				if ((allocator.memoryProperties().memoryHeaps[heap].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+					&& (!fullest || budgets[heap].pressure() > fullest->pressure()))
+				{
+					fullest = &budgets[heap];
+				}
+			}
+			if (fullest)
+			{
+				statsLine += ", vram " + std::to_string(fullest->usage >> 20) + "/" + std::to_string(fullest->budget >> 20) + "MB";
+			}
+			if (uint32_t evicted = residency.evictedCount())
+			{
+				statsLine += " (" + std::to_string(evicted) + " buffers evicted)";
+			}
 
-		vk::PresentInfoKHR presentInfo = vk::PresentInfoKHR()
-			.setWaitSemaphoreCount(1)
-			.setPWaitSemaphores(signalSemaphores)
-			.setSwapchainCount(1)
-			.setPSwapchains(swapchains)
-			.setPImageIndices(&imageIndex)
-			.setPResults(nullptr);
+			if (!headless)
+			{
+				SDL_SetWindowTitle(window, ("Vulkan Window - " + statsLine).c_str());
+			}
 
-		queue.presentKHR(presentInfo);
+			if (printStats)
+			{
+				std::cout << statsLine << std::endl;
+			}
+		}
 	}
 
 	logicalDevice.waitIdle();
 
+	for (const auto& retired : retiredSwapchains)
+	{
+		destroyRetiredSwapchain(retired);
+	}
+
+	for (uint32_t i = 0; i < pendingTimestampFrame.size(); ++i)
+	{
+		collectGpuTime(i);
+	}
+
+	std::cout << profiler.summary() << std::endl;
+
+	if (particles)
+	{
+		particles->collectAll();
+		particles->logStats(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count());
+	}
+
+	if (resolution)
+	{
+		resolution->logStats();
+	}
+
+	if (capture)
+	{
+		// Everything submitted has finished; write out what is still in the ring
+		capture->complete(frameNumber);
+		capture->finish();
+		capture->logStats(std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - renderStart).count());
+		capture->destroy();
+	}
+
+	if (!tracePath.empty())
+	{
+		if (profiler.exportTrace(tracePath))
+		{
+			std::cout << "wrote frame trace to " << tracePath << std::endl;
+		}
+		else
+		{
+			std::cout << "Could not write frame trace to " << tracePath << std::endl;
+		}
+	}
+
+	if (!reportPath.empty())
+	{
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - renderStart;
+
+		std::vector<std::pair<std::string, std::string>> labels;
+		labels.push_back(std::make_pair("device", std::string(physicalDevice.getProperties().deviceName)));
+		labels.push_back(std::make_pair("presentMode", headless ? std::string("headless") : vk::to_string(chosenPresentMode)));
+
+		if (profiler.exportReport(reportPath, labels, frameNumber, elapsed.count()))
+		{
+			std::cout << "wrote run report to " << reportPath << std::endl;
+		}
+		else
+		{
+			std::cout << "Could not write run report to " << reportPath << std::endl;
+		}
+	}
+
+	if (headless)
+	{
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - renderStart;
+		std::cout << "rendered " << frameNumber << " frames at " << extent.width << "x" << extent.height
+			<< " in " << elapsed.count() << "s (" << frameNumber / elapsed.count() << " fps)" << std::endl;
+	}
+
 	// Clean up.
 
+	frameGraph->logStats();
+	frameGraph->destroy();
+
 	for (const auto& imageView : swapchainImageViews)
 	{
 		logicalDevice.destroyImageView(imageView);
 	}
 
-	for (const auto& framebuffer : swapchainFramebuffers)
+	for (const auto& allocation : headlessImageAllocations)
 	{
-		logicalDevice.destroyFramebuffer(framebuffer);
+		allocator.destroyImage(allocation);
 	}
 
-	logicalDevice.destroyShaderModule(vertexShaderModule);
-	logicalDevice.destroyShaderModule(fragmentShaderModule);
+	shaderLibrary.logStats();
+	shaderLibrary.destroy();
 
 	logicalDevice.destroyCommandPool(commandPool);
 
-	logicalDevice.destroySemaphore(imageAvailable);
-	logicalDevice.destroySemaphore(renderFinished);
+	residency.logStats();
+	residency.destroy();
 
-	logicalDevice.destroyPipeline(graphicsPipeline);
+	allocator.destroyBuffer(vertexBuffer);
+	allocator.destroyBuffer(indexBuffer);
+	if (bindlessHeap)
+	{
+		bindlessHeap->remove(instanceBuffer->buffer, frameNumber);
+	}
+	allocator.destroyBuffer(instanceBuffer);
+
+	if (gpuTimestamps)
+	{
+		logicalDevice.destroyQueryPool(timestampQueryPool);
+	}
+
+	if (recorder)
+	{
+		recorder->logStats();
+		recorder->destroy();
+	}
+
+	jobs.logStats();
+	if (!jobTracePath.empty())
+	{
+		if (jobs.exportTrace(jobTracePath))
+		{
+			std::cout << "wrote job trace to " << jobTracePath << std::endl;
+		}
+		else
+		{
+			std::cout << "Could not write job trace to " << jobTracePath << std::endl;
+		}
+	}
+	jobs.destroy();
+
+	if (particles)
+	{
+		particles->destroy();
+	}
+
+	if (culling)
+	{
+		culling->destroy();
+	}
+
+	for (const auto& frame : frames)
+	{
+		if (frame.commandPool)
+		{
+			logicalDevice.destroyCommandPool(frame.commandPool);
+		}
+		logicalDevice.destroyFence(frame.inFlight);
+		logicalDevice.destroySemaphore(frame.imageAvailable);
+		logicalDevice.destroySemaphore(frame.renderFinished);
+	}
+
+	pipelines.logStats();
+	pipelines.destroy();
+
+	for (auto& frameAllocator : frameDescriptors)
+	{
+		frameAllocator.destroy();
+	}
+	staticDescriptors->destroy();
+	descriptors.destroy();
+
+	uniforms.logStats();
+	uniforms.destroy();
+
+	if (bindlessHeap)
+	{
+		bindlessHeap->logStats();
+		bindlessHeap->destroy();
+	}
+
+	pipelineCache.save();
+	pipelineCache.destroy();
 
 	logicalDevice.destroyPipelineLayout(pipelineLayout);
 
+	descriptorLayouts.logStats();
+	descriptorLayouts.destroy();
+
 	logicalDevice.destroyRenderPass(renderPass);
 
-	logicalDevice.destroySwapchainKHR(swapchain);
+	if (!headless)
+	{
+		logicalDevice.destroySwapchainKHR(swapchain);
+
+		instance.destroySurfaceKHR(surface);
+	}
+
+	uploads.destroy();
 
-	instance.destroySurfaceKHR(surface);
+	allocator.logStats();
+	allocator.destroy();
 
 	logicalDevice.destroy();
 
-	SDL_DestroyWindow(window);
-	SDL_Quit();
+	if (!headless)
+	{
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+	}
+
+	debugMessenger.destroy();
 
-	instance.destroyDebugUtilsMessengerEXT(debugUtilsMessenger, nullptr, vk::DispatchLoaderDynamic(instance));
+	// Nothing can call the debug callback any more, so the last messages can go out
+	logger.stop();
 
 	instance.destroy();
 
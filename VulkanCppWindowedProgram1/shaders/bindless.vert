@@ -0,0 +1,51 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+
+// Off for instances that never rotate, which saves the sin/cos per vertex
+layout(constant_id = 0) const bool instanceRotation = true;
+
+// Per instance: xy offset, z scale, w rotation in radians
+struct Instance {
+    vec4 transform;
+    vec4 color;
+};
+
+// Written once a frame into the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 viewProjection;
+} frame;
+
+// Every storage buffer in the bindless heap
+layout(set = 1, binding = 0) readonly buffer Instances {
+    Instance instances[];
+} buffers[];
+
+// Which heap buffer holds this draw's instances
+layout(push_constant) uniform Draw {
+    uint instanceBuffer;
+} draw;
+
+void main() {
+    // gl_InstanceIndex already includes the draw's firstInstance
+    Instance instance = buffers[draw.instanceBuffer].instances[gl_InstanceIndex];
+
+    vec2 position = inPosition * instance.transform.z;
+    if (instanceRotation) {
+        float s = sin(instance.transform.w);
+        float c = cos(instance.transform.w);
+        position = mat2(c, s, -s, c) * position;
+    }
+
+    gl_Position = frame.viewProjection * vec4(position + instance.transform.xy, 0.0, 1.0);
+    fragColor = inColor * instance.color.rgb;
+}
\ No newline at end of file
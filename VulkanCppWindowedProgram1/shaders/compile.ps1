@@ -1,6 +1,26 @@
-$items = Get-ChildItem -Path .\* -Include *.vert, *.frag
+# Run by the pre-build step so the .spv files always match their sources; they are not checked in
+$glslang = "glslangValidator.exe"
+if ($env:VULKAN_SDK)
+{
+    $glslang = Join-Path $env:VULKAN_SDK "Bin\glslangValidator.exe"
+}
+
+$items = Get-ChildItem -Path .\* -Include *.vert, *.frag, *.comp
 
 foreach ($item in $items)
 {
-    glslangValidator.exe -e main -V $item
-}
\ No newline at end of file
+    # Always name the output: left to itself glslangValidator names it after the stage, so every
+    # compute shader would land in comp.spv. shader.vert/.frag keep their historical names.
+    $output = "$($item.BaseName).spv"
+    if ($item.BaseName -eq "shader")
+    {
+        $output = "$($item.Extension.TrimStart('.')).spv"
+    }
+
+    & $glslang -e main -V $item -o $output
+
+    if ($LASTEXITCODE -ne 0)
+    {
+        exit $LASTEXITCODE
+    }
+}
@@ -0,0 +1,53 @@
+// Packs compiled SPIR-V into one archive the program maps at startup.
+//
+//   pack_shaders shaders.spvpack vert.spv frag.spv ...
+//
+// Each shader is stored under its file name without the directory, which is the name the
+// program asks the shader library for.
+
+#include "../ShaderArchive.h"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "usage: " << argv[0] << " <archive> <shader.spv>..." << std::endl;
+		return 1;
+	}
+
+	std::vector<std::pair<std::string, std::vector<char>>> shaders;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string path = argv[i];
+		std::ifstream file(path, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			std::cerr << "pack_shaders: cannot open " << path << std::endl;
+			return 1;
+		}
+
+		std::vector<char> code(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(code.data(), code.size());
+
+		size_t slash = path.find_last_of("/\\");
+		shaders.push_back(std::make_pair(slash == std::string::npos ? path : path.substr(slash + 1), code));
+	}
+
+	try
+	{
+		writeShaderArchive(argv[1], shaders);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "pack_shaders: " << e.what() << std::endl;
+		return 1;
+	}
+
+	std::cout << "pack_shaders: wrote " << shaders.size() << " shaders to " << argv[1] << std::endl;
+	return 0;
+}
@@ -5,23 +5,31 @@ out gl_PerVertex {
     vec4 gl_Position;
 };
 
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// Per instance: xy offset, z scale, w rotation in radians
+layout(location = 2) in vec4 inTransform;
+layout(location = 3) in vec4 inInstanceColor;
+
 layout(location = 0) out vec3 fragColor;
 
-vec2 positions[4] = vec2[](
-    vec2(-0.5, -0.5),
-	vec2(0.5, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// Off for instances that never rotate, which saves the sin/cos per vertex
+layout(constant_id = 0) const bool instanceRotation = true;
 
-vec3 colors[4] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0),
-    vec3(1.0, 1.0, 1.0)
-);
+// Written once a frame into the uniform ring
+layout(set = 0, binding = 0) uniform Frame {
+    mat4 viewProjection;
+} frame;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    vec2 position = inPosition * inTransform.z;
+    if (instanceRotation) {
+        float s = sin(inTransform.w);
+        float c = cos(inTransform.w);
+        position = mat2(c, s, -s, c) * position;
+    }
+
+    gl_Position = frame.viewProjection * vec4(position + inTransform.xy, 0.0, 1.0);
+    fragColor = inColor * inInstanceColor.rgb;
 }
\ No newline at end of file